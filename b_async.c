@@ -0,0 +1,236 @@
+/**************************************************************
+* Class::  CSC-415-02 Spring 2025
+* Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+* Student IDs:: 922525848, 922707016, 922711514, 918371654
+* GitHub-Name:: Jasuv
+* Group-Name:: Debug Thugs
+* Project:: Basic File System
+*
+* File:: b_async.c
+*
+* Description:: Asynchronous file I/O on top of b_pread/b_pwrite.
+*	Submitted requests wait on a queue for one of B_ASYNC_WORKERS
+*	threads, which are started on the first submission and stopped
+*	by b_async_shutdown once the queue has drained. Since
+*	b_pread/b_pwrite are thread safe, any number of requests can be
+*	in flight on one file or across files.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "b_async.h"
+
+typedef struct b_async_request
+	{
+	int id;
+	int write;			// 1 for b_pwrite, 0 for b_pread
+	b_io_fd fd;
+	char * buffer;
+	int count;
+	off_t offset;
+	b_io_callback callback;
+	void * arg;
+	int result;
+	struct b_async_request * next;
+	} b_async_request;
+
+static pthread_mutex_t asyncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t asyncWork = PTHREAD_COND_INITIALIZER;	// a request was queued
+static pthread_cond_t asyncDone = PTHREAD_COND_INITIALIZER;	// a completion was queued
+
+static b_async_request * submitHead = NULL;		// waiting for a worker
+static b_async_request * submitTail = NULL;
+static b_async_request * completeHead = NULL;	// waiting for b_reap
+static b_async_request * completeTail = NULL;
+
+static int outstanding = 0;		// submitted and not reaped (or called back) yet
+static int nextId = 0;
+static int workersStarted = 0;
+static pthread_t workers[B_ASYNC_WORKERS];
+static int stopping = 0;			// b_async_shutdown is waiting for the workers
+
+// Body of a worker thread, runs queued requests one after another
+static void * b_asyncWorker (void * arg)
+	{
+	pthread_mutex_lock(&asyncLock);
+	while (1)
+		{
+		while (submitHead == NULL && !stopping)
+			{
+			pthread_cond_wait(&asyncWork, &asyncLock);
+			}
+		if (submitHead == NULL)
+			{
+			break;	// stopping and nothing left to run
+			}
+
+		b_async_request * req = submitHead;
+		submitHead = req->next;
+		if (submitHead == NULL)
+			{
+			submitTail = NULL;
+			}
+		pthread_mutex_unlock(&asyncLock);
+
+		if (req->write)
+			req->result = b_pwrite(req->fd, req->buffer, req->count, req->offset);
+		else
+			req->result = b_pread(req->fd, req->buffer, req->count, req->offset);
+
+		if (req->callback != NULL)
+			{
+			req->callback(req->id, req->result, req->arg);
+			free(req);
+			pthread_mutex_lock(&asyncLock);
+			outstanding--;
+			pthread_cond_broadcast(&asyncDone);
+			continue;
+			}
+
+		pthread_mutex_lock(&asyncLock);
+		req->next = NULL;
+		if (completeTail == NULL)
+			completeHead = req;
+		else
+			completeTail->next = req;
+		completeTail = req;
+		pthread_cond_broadcast(&asyncDone);
+		}
+	pthread_mutex_unlock(&asyncLock);
+	return (NULL);
+	}
+
+// Queue a request and hand back its id, starting the workers if needed
+static int b_submit (int write, b_io_fd fd, char * buffer, int count,
+		off_t offset, b_io_callback callback, void * arg)
+	{
+	if (buffer == NULL || count < 0 || offset < 0)
+		{
+		return (-1);
+		}
+
+	b_async_request * req = malloc(sizeof(b_async_request));
+	if (req == NULL)
+		{
+		printf("Memory allocation failed for async request\n");
+		return (-1);
+		}
+	req->write = write;
+	req->fd = fd;
+	req->buffer = buffer;
+	req->count = count;
+	req->offset = offset;
+	req->callback = callback;
+	req->arg = arg;
+	req->result = -1;
+	req->next = NULL;
+
+	pthread_mutex_lock(&asyncLock);
+	if (stopping)
+		{
+		pthread_mutex_unlock(&asyncLock);
+		printf("Async I/O is shutting down\n");
+		free(req);
+		return (-1);
+		}
+	while (workersStarted < B_ASYNC_WORKERS)
+		{
+		if (pthread_create(&workers[workersStarted], NULL, b_asyncWorker, NULL) != 0)
+			{
+			break;
+			}
+		workersStarted++;
+		}
+	if (workersStarted == 0)
+		{
+		pthread_mutex_unlock(&asyncLock);
+		printf("Could not start async I/O workers\n");
+		free(req);
+		return (-1);
+		}
+
+	req->id = nextId;
+	nextId = (nextId == 0x7FFFFFFF) ? 0 : nextId + 1;
+	if (submitTail == NULL)
+		submitHead = req;
+	else
+		submitTail->next = req;
+	submitTail = req;
+	outstanding++;
+	int id = req->id;
+	pthread_cond_signal(&asyncWork);
+	pthread_mutex_unlock(&asyncLock);
+
+	return (id);
+	}
+
+int b_submit_read (b_io_fd fd, char * buffer, int count, off_t offset,
+		b_io_callback callback, void * arg)
+	{
+	return (b_submit(0, fd, buffer, count, offset, callback, arg));
+	}
+
+int b_submit_write (b_io_fd fd, char * buffer, int count, off_t offset,
+		b_io_callback callback, void * arg)
+	{
+	return (b_submit(1, fd, buffer, count, offset, callback, arg));
+	}
+
+int b_reap (b_completion * events, int max, int wait)
+	{
+	if (events == NULL || max <= 0)
+		{
+		return (0);
+		}
+
+	pthread_mutex_lock(&asyncLock);
+	// requests with a callback never reach the queue, so only wait while
+	// something could still show up on it
+	while (wait && completeHead == NULL && outstanding > 0)
+		{
+		pthread_cond_wait(&asyncDone, &asyncLock);
+		}
+
+	int reaped = 0;
+	while (reaped < max && completeHead != NULL)
+		{
+		b_async_request * req = completeHead;
+		completeHead = req->next;
+		if (completeHead == NULL)
+			{
+			completeTail = NULL;
+			}
+		outstanding--;
+
+		events[reaped].id = req->id;
+		events[reaped].result = req->result;
+		events[reaped].arg = req->arg;
+		reaped++;
+		free(req);
+		}
+	pthread_mutex_unlock(&asyncLock);
+
+	return (reaped);
+	}
+
+void b_async_shutdown ()
+	{
+	pthread_mutex_lock(&asyncLock);
+	stopping = 1;
+	pthread_cond_broadcast(&asyncWork);
+	int started = workersStarted;
+	pthread_mutex_unlock(&asyncLock);
+
+	// the workers run whatever is still queued before they exit
+	for (int i = 0; i < started; i++)
+		{
+		pthread_join(workers[i], NULL);
+		}
+
+	pthread_mutex_lock(&asyncLock);
+	workersStarted = 0;
+	stopping = 0;
+	pthread_mutex_unlock(&asyncLock);
+	}
@@ -0,0 +1,57 @@
+/**************************************************************
+* Class::  CSC-415-02 Spring 2025
+* Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+* Student IDs:: 922525848, 922707016, 922711514, 918371654
+* GitHub-Name:: Jasuv
+* Group-Name:: Debug Thugs
+* Project:: Basic File System
+*
+* File:: b_async.h
+*
+* Description:: Interface of asynchronous file I/O. Reads and writes
+*	are queued and carried out by a pool of worker threads, the
+*	results come back through a completion queue or a callback.
+*
+**************************************************************/
+
+#ifndef _B_ASYNC_H
+#define _B_ASYNC_H
+#include "b_io.h"
+
+#ifndef B_ASYNC_WORKERS
+#define B_ASYNC_WORKERS 4		// threads carrying out queued requests
+#endif
+
+// Called from a worker thread when a request with a callback finishes
+typedef void (*b_io_callback) (int id, int result, void * arg);
+
+// A finished request as handed back by b_reap
+typedef struct b_completion
+	{
+	int id;			// what b_submit_read/b_submit_write returned
+	int result;		// what b_pread/b_pwrite returned
+	void * arg;		// the arg passed at submission
+	} b_completion;
+
+// Queue a positional read or write of count bytes at offset. Returns the
+// request id, or -1 if the request could not be queued. The buffer must stay
+// valid until the request completes. If callback is NULL the result goes to
+// the completion queue, otherwise callback is called instead.
+// Requests run in any order, even on the same file.
+int b_submit_read (b_io_fd fd, char * buffer, int count, off_t offset,
+		b_io_callback callback, void * arg);
+int b_submit_write (b_io_fd fd, char * buffer, int count, off_t offset,
+		b_io_callback callback, void * arg);
+
+// Take up to max finished requests off the completion queue. With wait set
+// it blocks until at least one is there, unless nothing is outstanding.
+// Returns how many were stored in events.
+int b_reap (b_completion * events, int max, int wait);
+
+// Run every request still queued, then stop and join the workers. Called
+// when the file system is unmounted, before the block cache goes away;
+// finished requests stay on the completion queue for b_reap. The workers
+// start again on the next submission.
+void b_async_shutdown ();
+
+#endif
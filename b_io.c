@@ -19,13 +19,68 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "b_io.h"
 #include "mfs.h"
 #include <fsLow.h>
 #include <freeSpace.h>
+#include "blockCache.h"
+#include "blockDevice.h"
+#include "crc32c.h"
+#include "lz4.h"
 
-#define MAXFCBS 20
+#define FCB_SEGMENT_SIZE 64	//FCBs added to the table at a time
+#define FCB_NONE 0xFFFFFFFFu	//marks the end of the free list
 #define B_CHUNK_SIZE 512
+#define FILE_LOCK_STRIPES 64	//reader/writer locks shared out among open files
+
+#define RA_MIN_WINDOW 4		//blocks read ahead once sequential access is detected
+#define RA_MAX_WINDOW 32	//the readahead window stops doubling here, a multiple of COMPRESS_CHUNK_BLOCKS
+
+#define COPY_CHUNK_BLOCKS 64	//blocks moved per step of b_copy_range
+
+#define META_WRITE_INTERVAL 5	//seconds the directory entry of a file being written may lag behind
+
+#define COMPRESS_CHUNK_BLOCKS 16	//blocks of a compressed file compressed together
+#define COMPRESS_CHUNK_SIZE (COMPRESS_CHUNK_BLOCKS * B_CHUNK_SIZE)
+#define PACKED_CACHE_CHUNKS 16	//decompressed chunks kept for readers of compressed files
+
+// A window of blocks for the readahead thread to pull into the block cache.
+// The physical block numbers are captured when the window is queued so the
+// thread never has to look at the directory entry.
+typedef struct b_readahead
+	{
+	int lba[RA_MAX_WINDOW];	//physical block of each block in the window
+	int count;			//number of blocks in the window
+	int packed;			//whole chunks of a compressed file, decompress them too
+	struct b_readahead * next;	//link in the readahead queue
+	} b_readahead;
+
+// A chunk of a compressed file (DE_COMPRESS) that compresses by at least a
+// block is stored as an extent: this header, the compressed data, and zeros
+// up to the end of its last block. Its block map is the blocks of the
+// extent, then a BLOCK_PACKED entry for each block saved, so the map alone
+// tells how a chunk is stored and how much data it decompresses to. Chunks
+// that do not compress are stored as is.
+typedef struct b_packHeader
+	{
+	uint32_t length;	//bytes of compressed data after the header
+	uint32_t crc;		//crc32c of the compressed data
+	} b_packHeader;
+
+// A chunk decompressed by the readahead thread, waiting for its reader. It
+// is found by the extent it came from, so a chunk rewritten since (even in
+// the same blocks) is never mistaken for it.
+typedef struct b_packedChunk
+	{
+	int lba;			//first block of the extent
+	b_packHeader header;	//header of the extent
+	int blocks;			//blocks of data it decompresses to, 0 for an empty slot
+	unsigned long used;		//last time it was added or taken, for replacement
+	char data[COMPRESS_CHUNK_SIZE];
+	} b_packedChunk;
 
 typedef struct b_fcb
 	{
@@ -37,45 +92,313 @@ typedef struct b_fcb
 	// Added information
 	de_struct* fi;
 	de_struct* parent_dir;
-	int current_block;
-	int start_block;
+	int current_block;	//logical block of the file position (position = current_block * B_CHUNK_SIZE + index)
+	int buf_block;		//logical block currently held in buf, -1 if none
+	int dirty;			//buf holds data not in the block cache yet, only while a write is under way
+	unsigned long buf_generation;	//bufGeneration when buf was read
 	int flags;
+	_Atomic b_io_fd next_free;	//next fd on the free list while this FCB is unused
+	pthread_mutex_t lock;	//held for every operation on the fd
+	int meta_dirty;		//size, mtime or block map changed since the entry was last written
+	time_t meta_written;	//when the directory entry was last written
+
+	// sequential access detection
+	int ra_position;	//file position where the last read ended
+	int ra_window;		//size of the next readahead window, 0 when not sequential
+	int ra_ahead;		//first logical block not requested from the readahead thread yet
+	int ra_marker;		//first block of the last window, reaching it requests the next one
+
+	// compressed files are read and written a chunk at a time
+	char * chunk;		//one chunk of file data, then as much room to compress it into
+	int chunk_index;	//chunk held in chunk, -1 if none
+	int chunk_length;	//bytes of file data in chunk, the rest is zeros
+	int chunk_dirty;	//chunk holds data not yet written to disk
+	unsigned long chunk_generation;	//packGeneration when chunk was read
+	int chunk_reserved[COMPRESS_CHUNK_BLOCKS];	//blocks allocated for storing chunk, not in the map yet
+	int chunk_reserved_count;
+	int chunk_covered;	//blocks of data chunk has room to be stored in, -1 if not worked out yet
 	} b_fcb;
 	
-b_fcb fcbArray[MAXFCBS];
+// The FCB table grows one segment at a time up to B_MAX_FCBS open files.
+// Segments are never moved or freed, so a b_fcb pointer stays valid for as
+// long as the file is open.
+b_fcb * fcbSegments[B_MAX_FCBS / FCB_SEGMENT_SIZE];
+_Atomic int fcbSegmentCount = 0;
+pthread_mutex_t fcbGrowLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Head of the free FCB list. The low 32 bits hold the first free fd and the
+// high 32 bits a counter bumped on every change, so a pop that raced with a
+// pop and push of the same fd fails its compare and swap (no ABA).
+_Atomic uint64_t fcbFreeHead = FCB_NONE;
+
+pthread_once_t startup = PTHREAD_ONCE_INIT;	//Runs b_startup once
+
+// A file may be open through several FCBs that all point at the same
+// directory entry (directories are shared through the directory cache).
+// Reads of a file share its lock and writes take it exclusively, picked by
+// the address of the entry. Lock order is FCB, file, directory, allocator.
+pthread_rwlock_t fileLocks[FILE_LOCK_STRIPES];
+
+// The readahead thread serves a queue of windows from every open file
+pthread_mutex_t raLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t raWork = PTHREAD_COND_INITIALIZER;	//signalled when a window is queued
+b_readahead * raHead = NULL;
+b_readahead * raTail = NULL;
+int raStarted = 0;
+
+// Chunks decompressed ahead of their readers by the readahead thread
+b_packedChunk packedCache[PACKED_CACHE_CHUNKS];
+pthread_mutex_t packedLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long packedClock = 0;
+
+// Bumped whenever a chunk of a compressed file is written, a chunk an FCB
+// read before that may be stale and is read again
+_Atomic unsigned long packGeneration = 0;
+
+// Bumped whenever a write to or truncate of a file that is not compressed
+// ends, a block another FCB read into its buf before that may be stale and
+// is read again
+_Atomic unsigned long bufGeneration = 0;
+
+// Look up the FCB behind a file descriptor, NULL if there is none
+static b_fcb * b_fcbOf (b_io_fd fd)
+	{
+	if (fd < 0 || fd >= fcbSegmentCount * FCB_SEGMENT_SIZE)
+		{
+		return (NULL);
+		}
+	return (&fcbSegments[fd / FCB_SEGMENT_SIZE][fd % FCB_SEGMENT_SIZE]);
+	}
+
+// Push the chain of fds first..last (already linked through next_free)
+// onto the free list
+static void b_pushFree (b_io_fd first, b_io_fd last)
+	{
+	uint64_t head = atomic_load(&fcbFreeHead);
+	uint64_t newHead;
+	do
+		{
+		b_fcbOf(last)->next_free = (b_io_fd) (uint32_t) head;
+		newHead = ((head >> 32) + 1) << 32 | (uint32_t) first;
+		} while (!atomic_compare_exchange_weak(&fcbFreeHead, &head, newHead));
+	}
+
+// Add another segment of FCBs to the table. Returns -1 once the table is at
+// B_MAX_FCBS.
+static int b_growFCBs ()
+	{
+	int result = 0;
+	pthread_mutex_lock(&fcbGrowLock);
+
+	// somebody else may have grown the table while we waited
+	if ((uint32_t) atomic_load(&fcbFreeHead) == FCB_NONE)
+		{
+		if (fcbSegmentCount * FCB_SEGMENT_SIZE >= B_MAX_FCBS)
+			{
+			result = -1;
+			}
+		else
+			{
+			b_fcb * segment = calloc(FCB_SEGMENT_SIZE, sizeof(b_fcb));
+			if (segment == NULL)
+				{
+				result = -1;
+				}
+			else
+				{
+				int base = fcbSegmentCount * FCB_SEGMENT_SIZE;
+				for (int i = 0; i < FCB_SEGMENT_SIZE; i++)
+					{
+					segment[i].buf = NULL; //indicates a free fcb
+					segment[i].next_free = base + i + 1;
+					pthread_mutex_init(&segment[i].lock, NULL);
+					}
+				fcbSegments[fcbSegmentCount] = segment;
+				fcbSegmentCount++;
+				b_pushFree(base, base + FCB_SEGMENT_SIZE - 1);
+				}
+			}
+		}
+
+	pthread_mutex_unlock(&fcbGrowLock);
+	return (result);
+	}
+
+static void b_startup ()
+	{
+	for (int i = 0; i < FILE_LOCK_STRIPES; i++)
+		{
+		pthread_rwlock_init(&fileLocks[i], NULL);
+		}
 
-int startup = 0;	//Indicates that this has not been initialized
+	//start with one segment of free FCBs
+	b_growFCBs();
+	}
 
-//Method to initialize our file system
+//Method to initialize our file system, safe to call from any thread
 void b_init ()
 	{
-	//init fcbArray to all free
-	for (int i = 0; i < MAXFCBS; i++)
+	pthread_once(&startup, b_startup);
+	}
+
+// The lock that guards the data and block map of a file
+static pthread_rwlock_t * b_fileLock (de_struct * fi)
+	{
+	return (&fileLocks[((uintptr_t) fi / sizeof(de_struct)) % FILE_LOCK_STRIPES]);
+	}
+
+// Take the file lock for an operation that only reads the file. Reading
+// a compressed file may first write back the chunk this FCB changed, which
+// changes the block map, so then the lock is taken for writing. Caller
+// holds the FCB lock, which keeps chunk_dirty from changing.
+static void b_lockFileRead (b_fcb * fcb)
+	{
+	if (fcb->chunk_dirty)
+		{
+		pthread_rwlock_wrlock(b_fileLock(fcb->fi));
+		}
+	else
+		{
+		pthread_rwlock_rdlock(b_fileLock(fcb->fi));
+		}
+	}
+
+// Lock the FCB of an open file, NULL (and nothing locked) if fd is not open
+static b_fcb * b_lockFCB (b_io_fd fd)
+	{
+	b_fcb * fcb = b_fcbOf(fd);
+	if (fcb == NULL)
+		{
+		return (NULL);
+		}
+	pthread_mutex_lock(&fcb->lock);
+	if (fcb->fi == NULL)
 		{
-		fcbArray[i].buf = NULL; //indicates a free fcbArray
+		pthread_mutex_unlock(&fcb->lock);
+		return (NULL);
 		}
-		
-	startup = 1;
+	return (fcb);
 	}
 
-//Method to get a free FCB element
+//Method to get a free FCB element, pops the head of the free list
 b_io_fd b_getFCB ()
 	{
-	for (int i = 0; i < MAXFCBS; i++)
+	uint64_t head = atomic_load(&fcbFreeHead);
+	while (1)
 		{
-		if (fcbArray[i].buf == NULL)
+		uint32_t fd = (uint32_t) head;
+		if (fd == FCB_NONE)
+			{
+			if (b_growFCBs() != 0)
+				{
+				return (-1);  //all in use
+				}
+			head = atomic_load(&fcbFreeHead);
+			continue;
+			}
+
+		// fd may be popped and pushed again by others before our CAS, which
+		// the tag then fails, so next_free is atomic
+		uint64_t newHead = ((head >> 32) + 1) << 32 | (uint32_t) b_fcbOf(fd)->next_free;
+		if (atomic_compare_exchange_weak(&fcbFreeHead, &head, newHead))
 			{
-			return i;		//Not thread safe (But do not worry about it for this assignment)
+			return ((b_io_fd) fd);
 			}
 		}
-	return (-1);  //all in use
+	}
+
+// Files opened with O_APPEND write at the end of file, which another FCB may
+// have moved since our last write. The block map is not needed: the tail
+// block is usually still in buf from the previous append, and b_fillBuffer
+// reads it again from the block cache if another FCB appended to it since
+// (every write leaves its tail block there, see b_updateSize). Caller holds
+// the file lock.
+static void b_appendPosition (b_fcb * fcb)
+	{
+	if (fcb->flags & O_APPEND)
+		{
+		fcb->current_block = fcb->fi->size / B_CHUNK_SIZE;
+		fcb->index = fcb->fi->size % B_CHUNK_SIZE;
+		}
+	}
+
+// Mark an FCB closed and free its buffers. Caller holds the FCB lock, and
+// only the caller that cleared fi may push the fd onto the free list: once
+// fi is NULL b_lockFCB fails, so a second close of the fd cannot get here.
+static void b_clearFCB (b_fcb * fcb)
+	{
+	free(fcb->buf);
+	fcb->buf = NULL;
+	free(fcb->chunk);
+	fcb->chunk = NULL;
+	fcb->fi = NULL;
+	fcb->parent_dir = NULL;
+	}
+
+// Give an FCB back to the free list
+static void b_releaseFCB (b_io_fd fd)
+	{
+	b_fcb * fcb = b_fcbOf(fd);
+	pthread_mutex_lock(&fcb->lock);
+	b_clearFCB(fcb);
+	pthread_mutex_unlock(&fcb->lock);
+	b_pushFree(fd, fd);
 	}
 	
+static int b_truncateFCB (b_fcb * fcb, off_t length);
+
+// Point a new FCB at the directory entry of the file it opens
+static void b_setupFCB (b_fcb * fcb, de_struct * entry, de_struct * parentDir, int flags)
+	{
+	fcb->fi = entry;
+	fcb->flags = flags;
+	fcb->index = 0;
+	fcb->buflen = 0;
+	fcb->current_block = 0;
+	fcb->buf_block = -1;		// blocks are loaded on first access
+	fcb->dirty = 0;
+	fcb->parent_dir = parentDir;
+	fcb->ra_position = 0;
+	fcb->ra_window = 0;
+	fcb->meta_dirty = 0;
+	fcb->meta_written = getTime();
+	fcb->chunk_index = -1;
+	fcb->chunk_dirty = 0;
+	fcb->chunk_reserved_count = 0;
+	fcb->chunk_covered = -1;
+	}
+
+// The open flags that act on a file that already existed: O_TRUNC empties
+// it and frees its blocks, O_APPEND starts at the end of file so reads and
+// b_seek(SEEK_CUR) see the position the first write will use. Returns 0 on
+// success, -1 if the truncate failed.
+static int b_openExisting (b_fcb * fcb)
+	{
+	if (fcb->flags & O_TRUNC)
+		{
+		pthread_rwlock_wrlock(b_fileLock(fcb->fi));
+		int truncated = b_truncateFCB(fcb, 0);
+		pthread_rwlock_unlock(b_fileLock(fcb->fi));
+		if (truncated != 0)
+			{
+			return (-1);
+			}
+		}
+
+	if (fcb->flags & O_APPEND)
+		{
+		pthread_rwlock_rdlock(b_fileLock(fcb->fi));
+		b_appendPosition(fcb);
+		pthread_rwlock_unlock(b_fileLock(fcb->fi));
+		}
+	return (0);
+	}
+
 // Interface to open a buffered file
 // Modification of interface for this assignment, flags match the Linux flags for open
 // O_RDONLY, O_WRONLY, or O_RDWR
 b_io_fd b_open(char * filename, int flags) {
-    if (startup == 0) b_init();  //Initialize our system
+    b_init();  //Initialize our system
     
     b_io_fd returnFd;
     
@@ -88,23 +411,19 @@ b_io_fd b_open(char * filename, int flags) {
         printf("No free FCB slots available\n");
         return -1;
     }
+    b_fcb * fcb = b_fcbOf(returnFd);
     
-    fcbArray[returnFd].buf = malloc(B_CHUNK_SIZE);
-    if (fcbArray[returnFd].buf == NULL) {
+    fcb->buf = allocBlockBuffer(B_CHUNK_SIZE);
+    if (fcb->buf == NULL) {
         printf("Memory allocation failed for file buffer\n");
-		fcbArray[returnFd].buf = NULL;
-		fcbArray[returnFd].fi = NULL;
-		fcbArray[returnFd].parent_dir = NULL;
+		b_releaseFCB(returnFd);
         return -1;
     }
     
     parseInfo *ppi = malloc(sizeof(parseInfo));
     if (ppi == NULL) {
         printf("Memory allocation failed for parseInfo\n");
-        free(fcbArray[returnFd].buf);
-		fcbArray[returnFd].buf = NULL;
-		fcbArray[returnFd].fi = NULL;
-		fcbArray[returnFd].parent_dir = NULL;
+        b_releaseFCB(returnFd);
         return -1;
     }
     
@@ -116,164 +435,136 @@ b_io_fd b_open(char * filename, int flags) {
         // if O_CREAT flag is set, create the file
         if (flags & O_CREAT) {
             de_struct *parentDir = ppi->parent;
-            
-            // Find an empty slot in the parent directory
-            int emptySlot = -1;
-            for (int i = 0; i < DIRECTORY_ENTRIES; i++) {
-                if (parentDir[i].file_name[0] == '\0') {
-                    emptySlot = i;
-                    break;
-                }
-            }
-            
-            if (emptySlot == -1) {
-                printf("Parent directory is full, cannot create file\n");
+            lockDirectory(parentDir, 1);
+
+            // another thread may have created it since the path was parsed
+            int slot = findInDirectory(ppi->lastElementName, parentDir);
+            if (slot != -1 && parentDir[slot].is_directory) {
+                printf("Cannot open directory as file: %s\n", filename);
+                unlockDirectory(parentDir);
                 free(ppi);
-                free(fcbArray[returnFd].buf);
-				fcbArray[returnFd].buf = NULL;
-				fcbArray[returnFd].fi = NULL;
-				fcbArray[returnFd].parent_dir = NULL;
+                b_releaseFCB(returnFd);
                 return -1;
             }
+
+            int existed = (slot != -1);
+            if (slot == -1) {
+                // Find an empty slot in the parent directory
+                int emptySlot = -1;
+                for (int i = 0; i < DIRECTORY_ENTRIES; i++) {
+                    if (parentDir[i].file_name[0] == '\0') {
+                        emptySlot = i;
+                        break;
+                    }
+                }
             
-            // Allocate a block for the new file
-            int *newFileBlocks = allocateBlocks(1);
-            if (newFileBlocks == NULL) {
-                printf("Failed to allocate block for new file\n");
-                free(ppi);
-                free(fcbArray[returnFd].buf);
-				fcbArray[returnFd].buf = NULL;
-				fcbArray[returnFd].fi = NULL;
-				fcbArray[returnFd].parent_dir = NULL;
-                return -1;
-            }
+                if (emptySlot == -1) {
+                    printf("Parent directory is full, cannot create file\n");
+                    unlockDirectory(parentDir);
+                    free(ppi);
+                    b_releaseFCB(returnFd);
+                    return -1;
+                }
+            
+                // Allocate a block for the new file
+                int *newFileBlocks = allocateBlocks(1);
+                if (newFileBlocks == NULL) {
+                    printf("Failed to allocate block for new file\n");
+                    unlockDirectory(parentDir);
+                    free(ppi);
+                    b_releaseFCB(returnFd);
+                    return -1;
+                }
             
-            // get file name from path
-            char *fileName = ppi->lastElementName;
-            if (fileName == NULL) {
-                // Get filename from the original path if necessary
-                fileName = strrchr(filename, '/');
+                // get file name from path
+                char *fileName = ppi->lastElementName;
                 if (fileName == NULL) {
-                    fileName = filename;
-                } else {
-                    fileName++;
+                    // Get filename from the original path if necessary
+                    fileName = strrchr(filename, '/');
+                    if (fileName == NULL) {
+                        fileName = filename;
+                    } else {
+                        fileName++;
+                    }
                 }
-            }
 
-			//printf("updating parentDir[%d] to %s\n", emptySlot, fileName);
+    			//printf("updating parentDir[%d] to %s\n", emptySlot, fileName);
             
-            // init the new file entry
-            time_t now = getTime();
-            strcpy(parentDir[emptySlot].file_name, fileName);
-            parentDir[emptySlot].size = 0;
-            parentDir[emptySlot].mode = 0777; 
-            parentDir[emptySlot].blocks_allocated[0] = newFileBlocks[0];
-            parentDir[emptySlot].blocks_count = 1;
-            parentDir[emptySlot].date_created = now;
-            parentDir[emptySlot].date_modified = now;
-            parentDir[emptySlot].is_directory = 0;
+                // init the new file entry
+                time_t now = getTime();
+                strcpy(parentDir[emptySlot].file_name, fileName);
+                parentDir[emptySlot].size = 0;
+                parentDir[emptySlot].mode = 0777; 
+                parentDir[emptySlot].blocks_allocated[0] = newFileBlocks[0];
+                parentDir[emptySlot].blocks_count = 1;
+                parentDir[emptySlot].date_created = now;
+                parentDir[emptySlot].date_modified = now;
+                parentDir[emptySlot].is_directory = 0;
+                parentDir[emptySlot].flags = parentDir[0].flags & DE_COMPRESS;
+                free(newFileBlocks);
             
-            // write the updated parent directory to disk
-		   for (int i = 0; i < parentDir[0].blocks_count; i++) {
-				void * dirToBlocks = (void *)((char *)parentDir + i * BLOCK_SIZE);
-				if (LBAwrite(dirToBlocks, 1, parentDir[0].blocks_allocated[i]) != 1) {
-					printf("Error writing updated block %d for parent directory\n", i);
-							if (parentDir != rootDir && parentDir != cwDir) {
-								free(parentDir);
-							}
-							fcbArray[returnFd].buf = NULL;
-							fcbArray[returnFd].fi = NULL;
-							fcbArray[returnFd].parent_dir = NULL;
-					return -1;
-				}
-			}
+                // write the updated parent directory to disk
+                if (cacheWriteBlocks(parentDir, parentDir[0].blocks_allocated, parentDir[0].blocks_count)
+                    != parentDir[0].blocks_count) {
+                    printf("Error writing updated blocks of parent directory\n");
+                    unlockDirectory(parentDir);
+                    free(ppi);
+                    b_releaseFCB(returnFd);
+                    return -1;
+                }
+                slot = emptySlot;
+            }
+            unlockDirectory(parentDir);
             
             // Update FCB with the new file information
-            fcbArray[returnFd].fi = &parentDir[emptySlot];
-            fcbArray[returnFd].flags = flags;
-            fcbArray[returnFd].index = 0;
-            fcbArray[returnFd].current_block = 0;
-			fcbArray[returnFd].start_block = newFileBlocks[0];
-			fcbArray[returnFd].parent_dir = parentDir;
-            
-            free(newFileBlocks);
+            b_setupFCB(fcb, &parentDir[slot], parentDir, flags);
+
+            // a file created by someone else still gets O_TRUNC and O_APPEND
+            if (existed && b_openExisting(fcb) != 0) {
+                free(ppi);
+                b_releaseFCB(returnFd);
+                return -1;
+            }
         } else {
             // File doesn't exist and O_CREAT not specified
             printf("File not found: %s\n", filename);
             free(ppi);
-            free(fcbArray[returnFd].buf);
-			fcbArray[returnFd].buf = NULL;
-			fcbArray[returnFd].fi = NULL;
-			fcbArray[returnFd].parent_dir = NULL;
+            b_releaseFCB(returnFd);
             return -1;
         }
     } else {
 
         // File exists
-        de_struct *entry = &ppi->parent[ppi->index];
+        de_struct *parentDir = ppi->parent;
+        lockDirectory(parentDir, 0);
+        int slot = findInDirectory(ppi->lastElementName, parentDir);
+        if (slot == -1) {
+            // removed since the path was parsed
+            printf("File not found: %s\n", filename);
+            unlockDirectory(parentDir);
+            free(ppi);
+            b_releaseFCB(returnFd);
+            return -1;
+        }
+        de_struct *entry = &parentDir[slot];
         
         // Check if it's a directory
-        if (entry->is_directory) {
+        int isDirectory = entry->is_directory;
+        unlockDirectory(parentDir);
+        if (isDirectory) {
             printf("Cannot open directory as file: %s\n", filename);
             free(ppi);
-            free(fcbArray[returnFd].buf);
-			fcbArray[returnFd].buf = NULL;
-			fcbArray[returnFd].fi = NULL;
-			fcbArray[returnFd].parent_dir = NULL;
+            b_releaseFCB(returnFd);
             return -1;
         }
         
-        // Handle O_TRUNC flag - reset file size to 0
-        if (flags & O_TRUNC) {
-            entry->size = 0;
-            time_t now = getTime();
-            entry->date_modified = now;
-            
-            // Write the updated entry back to disk
-		    for (int i = 0; i < ppi->parent->blocks_count; i++) {
-				void * dirToBlocks = (void *)((char *)ppi->parent + i * BLOCK_SIZE);
-				if (LBAwrite(dirToBlocks, 1, ppi->parent->blocks_allocated[i]) != 1) {
-					printf("Error writing updated block %d for parent directory\n", i);
-							if (ppi->parent != rootDir && ppi->parent != cwDir) {
-								free(ppi->parent);
-							}
-							fcbArray[returnFd].buf = NULL;
-							fcbArray[returnFd].fi = NULL;
-							fcbArray[returnFd].parent_dir = NULL;
-					return -1;
-				}
-			}
-        }
-        
-        // For read or read/write, load the first block
-        if ((flags & O_RDONLY) || (flags & O_RDWR)) {
-            // Only try to read if the file has content
-            if (entry->size > 0) {
-                int blockNum = entry->blocks_allocated[0];
-                int blocksRead = LBAread(fcbArray[returnFd].buf, 1, blockNum);
-                if (blocksRead <= 0) {
-                    printf("Failed to read block %d for file %s\n", blockNum, filename);
-                    free(fcbArray[returnFd].buf);
-                    free(ppi);
-					fcbArray[returnFd].buf = NULL;
-					fcbArray[returnFd].fi = NULL;
-					fcbArray[returnFd].parent_dir = NULL;
-                    return -1;
-                }
-                fcbArray[returnFd].buflen = (entry->size < B_CHUNK_SIZE) ? entry->size : B_CHUNK_SIZE;
-            } else {
-                // Empty file
-                fcbArray[returnFd].buflen = 0;
-            }
-        }
-        
         // Set up FCB entry
-        fcbArray[returnFd].fi = entry;
-        fcbArray[returnFd].flags = flags;
-        fcbArray[returnFd].index = 0;
-        fcbArray[returnFd].current_block = 0;
-		fcbArray[returnFd].start_block = entry->blocks_allocated[0];
-		fcbArray[returnFd].parent_dir = ppi->parent;
+        b_setupFCB(fcb, entry, parentDir, flags);
+		if (b_openExisting(fcb) != 0) {
+			free(ppi);
+			b_releaseFCB(returnFd);
+			return -1;
+		}
 
     }
 
@@ -282,161 +573,1291 @@ b_io_fd b_open(char * filename, int flags) {
 }
 
 
-// Interface to seek function	
-int b_seek (b_io_fd fd, off_t offset, int whence)
+// Translate a logical block of the file into its physical LBA through the
+// block map in the directory entry. Returns BLOCK_HOLE (-1) if the block is
+// not mapped.
+// b_ownBlocks may swap a mapping while other FCBs of the file read, so the
+// map is read atomically.
+static int b_blockToLBA (b_fcb * fcb, int block)
 	{
-	if (startup == 0) b_init();  //Initialize our system
-
-	// check that fd is between 0 and (MAXFCBS-1)
-	if ((fd < 0) || (fd >= MAXFCBS))
+	if (block < 0 || block >= fcb->fi->blocks_count)
 		{
-		return (-1); 					//invalid file descriptor
+		return (-1);
 		}
-		
-		
-	return (0); //Change this
+	return (__atomic_load_n(&fcb->fi->blocks_allocated[block], __ATOMIC_RELAXED));
 	}
 
+// Count how many logical blocks starting at block (up to max) are holes
+static int b_holeRun (b_fcb * fcb, int block, int max)
+	{
+	int run = 0;
+	while (run < max && b_blockToLBA(fcb, block + run) == BLOCK_HOLE)
+		{
+		run++;
+		}
+	return (run);
+	}
 
-// Interface to write function    
-int b_write(b_io_fd fd, char *buffer, int count) {
-    if (startup == 0) b_init();  // Initialize our system
+// Count how many logical blocks starting at block are also physically
+// contiguous on disk (up to max) so they can be moved with a single LBA call
+static int b_contiguousRun (b_fcb * fcb, int block, int max)
+	{
+	int first = b_blockToLBA(fcb, block);
+	if (first < 0)
+		{
+		return (0);
+		}
 
-    // check that fd is between 0 and (MAXFCBS-1)
-    if ((fd < 0) || (fd >= MAXFCBS)) 
+	int run = 1;
+	while (run < max && b_blockToLBA(fcb, block + run) == first + run)
 		{
-        return (-1);  					// invalid file descriptor
-    	}
+		run++;
+		}
+	return (run);
+	}
 
-    // check if file is open
-    if (fcbArray[fd].fi == NULL) {
-        return -1;  // File not open
-    }
+// Copy on write for cloned files: a block shared with a clone (see b_clone)
+// must not be written in place, so every shared block among the count
+// blocks starting at block is swapped for a block of our own and the other
+// files keep the old one. The caller is about to overwrite the blocks
+// completely, so nothing is copied. Caller holds the file lock, which
+// keeps b_clone from sharing more blocks meanwhile. Returns -1 if no
+// blocks were left.
+static int b_ownBlocks (b_fcb * fcb, int block, int count)
+	{
+	int lbas[MAX_DE_BLOCK_COUNT];
+	int n = 0;
+	for (int i = block; i < block + count && n < MAX_DE_BLOCK_COUNT; i++)
+		{
+		lbas[n++] = b_blockToLBA(fcb, i);
+		}
 
-    // check write permission
-    if (!(fcbArray[fd].flags & O_WRONLY) && !(fcbArray[fd].flags & O_RDWR)) {
-        return -1;  // File not opened for writing
-    }
+	int shared = sharedBlocks(lbas, n);
+	if (shared == 0)
+		{
+		return (0);
+		}
 
-    int bytesWritten = 0;      // bytes written so far
-    int bytesToWrite = count;  // bytes remaining to write
-    int currentPos = 0;        // current position in buffer
+	int * newBlocks = allocateBlocks(shared);
+	if (newBlocks == NULL)
+		{
+		return (-1);
+		}
 
-    // if we have data in the buffer already
-    if (fcbArray[fd].index > 0) {
-        // how much space remains in the current buffer
-        int remainingBufferSpace = B_CHUNK_SIZE - fcbArray[fd].index;
-        
-        // write to the buffer as much as will fit
-        int bytesToCopy = (bytesToWrite < remainingBufferSpace) ? bytesToWrite : remainingBufferSpace;
-        
-        memcpy(fcbArray[fd].buf + fcbArray[fd].index, buffer, bytesToCopy);
-        fcbArray[fd].index += bytesToCopy;
-        bytesWritten += bytesToCopy;
-        currentPos += bytesToCopy;
-        bytesToWrite -= bytesToCopy;
-        
-        // if buffer is full, write it to disk
-        if (fcbArray[fd].index == B_CHUNK_SIZE) {
-            // Write the block to disk
-		    if (LBAwrite(fcbArray[fd].buf, 1, fcbArray[fd].start_block + fcbArray[fd].current_block) != 1) {
-                return bytesWritten;  
-            }
-        
-            // clear buffer for next block
-            fcbArray[fd].index = 0;
-            fcbArray[fd].current_block++;
-        }
-    }
+	// the count may have dropped since it was taken (another clone wrote
+	// or went away), so look again while the map cannot change
+	de_struct * fi = fcb->fi;
+	int swapped = 0;
+	lockDirectory(fcb->parent_dir, 1);
+	for (int i = 0; i < n && swapped < shared; i++)
+		{
+		int lba = fi->blocks_allocated[block + i];
+		if (sharedBlocks(&lba, 1) == 1)
+			{
+			lbas[swapped] = lba;
+			__atomic_store_n(&fi->blocks_allocated[block + i], newBlocks[swapped], __ATOMIC_RELAXED);
+			swapped++;
+			}
+		}
+	unlockDirectory(fcb->parent_dir);
+	fcb->meta_dirty = 1;
 
-    // write whole blocks directly from the buffer
-    while (bytesToWrite >= B_CHUNK_SIZE) {
-        // Write block directly from user's buffer
-        if (LBAwrite(buffer + currentPos, 1, fcbArray[fd].start_block+fcbArray[fd].current_block) != 1) {
-            return bytesWritten; 
-        }
-        
-        bytesWritten += B_CHUNK_SIZE;
-        currentPos += B_CHUNK_SIZE;
-        bytesToWrite -= B_CHUNK_SIZE;
-        fcbArray[fd].current_block++;
-    }
+	// give back what was not needed and drop our references to the old blocks
+	freeBlocks(newBlocks + swapped, shared - swapped);
+	freeBlocks(lbas, swapped);
+	free(newBlocks);
+	return (0);
+	}
 
-    // copy any remaining bytes to buffer
-    if (bytesToWrite > 0) {
-        memcpy(fcbArray[fd].buf, buffer + currentPos, bytesToWrite);
-        fcbArray[fd].index = bytesToWrite;
-        bytesWritten += bytesToWrite;
-    }
+// Copy the block map of a chunk of a compressed file into lba
+static void b_chunkMap (b_fcb * fcb, int chunk, int * lba)
+	{
+	for (int i = 0; i < COMPRESS_CHUNK_BLOCKS; i++)
+		{
+		lba[i] = b_blockToLBA(fcb, chunk * COMPRESS_CHUNK_BLOCKS + i);
+		}
+	}
 
-    // update file size
-    int newSize = fcbArray[fd].fi->size;
-    int bytesWrittenToFile = bytesWritten;
-    
-    // calculate how many bytes are written beyond the current file size
-	int currentLoc = fcbArray[fd].current_block * B_CHUNK_SIZE + fcbArray[fd].index;
+// Look at the block map of a chunk: returns how many blocks its compressed
+// extent takes and sets *blocks to the blocks of data it holds, or returns
+// 0 if the chunk is not stored compressed.
+static int b_packedExtent (int * lba, int * blocks)
+	{
+	int extent = 0;
+	while (extent < COMPRESS_CHUNK_BLOCKS && lba[extent] >= 0)
+		{
+		extent++;
+		}
+	*blocks = 0;
+	for (int i = extent; i < COMPRESS_CHUNK_BLOCKS; i++)
+		{
+		if (lba[i] == BLOCK_PACKED)
+			{
+			*blocks = i + 1;
+			}
+		}
+	return ((*blocks > 0) ? extent : 0);
+	}
 
-    if (currentLoc > newSize) {
-        newSize = currentLoc;
-        
-        // update file size and modification time
-        fcbArray[fd].fi->size = newSize;
-        fcbArray[fd].fi->date_modified = getTime();
-        
-        // make sure we have enough blocks allocated
-        int blocksNeeded = (newSize + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
-        if (blocksNeeded > fcbArray[fd].fi->blocks_count) {
-            // Allocate more blocks if needed
-            int additionalBlocks = blocksNeeded - fcbArray[fd].fi->blocks_count;
-            int *newBlocks = allocateBlocks(additionalBlocks);
-            
-            if (newBlocks == NULL) {
-                // Could not allocate more blocks
-                return bytesWritten;
-            }
-            
-            for (int i = 0; i < additionalBlocks; i++) {
-                if (fcbArray[fd].fi->blocks_count < MAX_DE_BLOCK_COUNT) {
-                    fcbArray[fd].fi->blocks_allocated[fcbArray[fd].fi->blocks_count] = newBlocks[i];
-                    fcbArray[fd].fi->blocks_count++;
-                }
-            }
-            
-            free(newBlocks);
-        }
-        
-        // Write directory entry back to disk to update info
-		de_struct *parentDir = fcbArray[fd].parent_dir;
+// Read the compressed extent in the blocks lba[0] to lba[extent - 1] into
+// staging. Returns its header, NULL if it could not be read or does not
+// match its checksum (a torn write, or blocks rewritten since the map was
+// looked at).
+static b_packHeader * b_readExtent (int * lba, int extent, char * staging)
+	{
+	if (cacheReadBlocks(staging, lba, extent) != extent)
+		{
+		return (NULL);
+		}
+	b_packHeader * header = (b_packHeader *) staging;
+	if (header->length > extent * B_CHUNK_SIZE - sizeof(b_packHeader)
+			|| crc32c(header + 1, header->length) != header->crc)
+		{
+		return (NULL);
+		}
+	return (header);
+	}
 
-        for (int i = 0; i < parentDir[0].blocks_count; i++) {
-            void *dirToBlocks = (void *)((char *)parentDir + i * BLOCK_SIZE);
-            if (LBAwrite(dirToBlocks, 1, parentDir[0].blocks_allocated[i]) != 1) {
-                printf("Error writing updated block %d for parent directory\n", i);
-                return bytesWritten;
-            }
-        }
-		
-    }
+// Decompress an extent read by b_readExtent into blocks blocks of data
+static int b_inflate (b_packHeader * header, int blocks, char * out)
+	{
+	int size = blocks * B_CHUNK_SIZE;
+	return ((lz4Decompress(header + 1, header->length, out, size) == size) ? 0 : -1);
+	}
 
-	//printf("bytesWritten: %d\n", bytesWritten);
+// Look for the chunk the readahead thread decompressed from the extent at
+// lba with this header. If out is not NULL it is copied there, and the slot
+// is the first to be replaced since its reader has its own copy now.
+// Returns 1 if it was found.
+static int b_packedTake (int lba, b_packHeader * header, int blocks, char * out)
+	{
+	int found = 0;
+	pthread_mutex_lock(&packedLock);
+	for (int i = 0; i < PACKED_CACHE_CHUNKS && !found; i++)
+		{
+		b_packedChunk * slot = &packedCache[i];
+		if (slot->blocks == blocks && slot->lba == lba
+				&& slot->header.length == header->length && slot->header.crc == header->crc)
+			{
+			if (out != NULL)
+				{
+				memcpy(out, slot->data, blocks * B_CHUNK_SIZE);
+				slot->used = 0;
+				}
+			found = 1;
+			}
+		}
+	pthread_mutex_unlock(&packedLock);
+	return (found);
+	}
 
-    return bytesWritten;
-}
+// Keep a chunk decompressed by the readahead thread for its reader, in
+// place of the one left alone longest
+static void b_packedGive (int lba, b_packHeader * header, int blocks, char * data)
+	{
+	pthread_mutex_lock(&packedLock);
+	b_packedChunk * slot = &packedCache[0];
+	for (int i = 1; i < PACKED_CACHE_CHUNKS; i++)
+		{
+		if (packedCache[i].used < slot->used)
+			{
+			slot = &packedCache[i];
+			}
+		}
+	slot->lba = lba;
+	slot->header = *header;
+	slot->blocks = blocks;
+	memcpy(slot->data, data, blocks * B_CHUNK_SIZE);
+	slot->used = ++packedClock;
+	pthread_mutex_unlock(&packedLock);
+	}
 
+// Write the chunk buffer of a compressed file back to disk if it holds
+// unwritten data. The chunk is compressed if that saves at least a block
+// and stored as is otherwise. Blocks the chunk had that no clone shares are
+// written again in place, shared ones are left to the clones (copy on
+// write, see b_clone) and new blocks are allocated for the rest. Caller
+// holds the file lock for writing.
+static int b_storeChunk (b_fcb * fcb)
+	{
+	if (!fcb->chunk_dirty)
+		{
+		return (0);
+		}
 
+	de_struct * fi = fcb->fi;
+	int first = fcb->chunk_index * COMPRESS_CHUNK_BLOCKS;
+	int blocks = (fcb->chunk_length + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+	if (first + blocks > MAX_DE_BLOCK_COUNT)
+		{
+		blocks = MAX_DE_BLOCK_COUNT - first;
+		}
 
-// Interface to read a buffer
+	char * data = fcb->chunk;
+	int extent = blocks;
+	if (blocks > 1)
+		{
+		b_packHeader * header = (b_packHeader *) (fcb->chunk + COMPRESS_CHUNK_SIZE);
+		int room = (blocks - 1) * B_CHUNK_SIZE - sizeof(b_packHeader);
+		int length = lz4Compress(fcb->chunk, blocks * B_CHUNK_SIZE, header + 1, room);
+		if (length > 0)
+			{
+			int size = sizeof(b_packHeader) + length;
+			header->length = length;
+			header->crc = crc32c(header + 1, length);
+			extent = (size + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+			memset((char *) header + size, 0, extent * B_CHUNK_SIZE - size);
+			data = (char *) header;
+			}
+		}
 
-// Filling the callers request is broken into three parts
-// Part 1 is what can be filled from the current buffer, which may or may not be enough
-// Part 2 is after using what was left in our buffer there is still 1 or more block
-//        size chunks needed to fill the callers request.  This represents the number of
-//        bytes in multiples of the blocksize.
-// Part 3 is a value less than blocksize which is what remains to copy to the callers buffer
-//        after fulfilling part 1 and part 2.  This would always be filled from a refill 
-//        of our buffer.
-//  +-------------+------------------------------------------------+--------+
-//  |             |                                                |        |
+	// keep the blocks the chunk has that are ours alone, old[] is left
+	// with the ones to give back
+	int old[COMPRESS_CHUNK_BLOCKS];
+	int oldCount = fi->blocks_count - first;
+	if (oldCount < 0)
+		{
+		oldCount = 0;
+		}
+	if (oldCount > COMPRESS_CHUNK_BLOCKS)
+		{
+		oldCount = COMPRESS_CHUNK_BLOCKS;
+		}
+	for (int i = 0; i < oldCount; i++)
+		{
+		old[i] = b_blockToLBA(fcb, first + i);
+		}
+	int target[COMPRESS_CHUNK_BLOCKS];
+	int needed = 0;
+	for (int i = 0; i < extent; i++)
+		{
+		target[i] = -1;
+		if (i < oldCount && old[i] >= 0 && sharedBlocks(&old[i], 1) == 0)
+			{
+			target[i] = old[i];
+			old[i] = BLOCK_HOLE;
+			}
+		else
+			{
+			needed++;
+			}
+		}
+
+	// the blocks b_reserveChunk set aside go first, more are only needed if
+	// a clone took a share of blocks the chunk had meanwhile
+	int added[COMPRESS_CHUNK_BLOCKS];
+	int reserved = (needed < fcb->chunk_reserved_count) ? needed : fcb->chunk_reserved_count;
+	if (needed > 0)
+		{
+		int * newBlocks = NULL;
+		if (needed > reserved)
+			{
+			newBlocks = allocateBlocks(needed - reserved);
+			if (newBlocks == NULL)
+				{
+				printf("No space left to write chunk %d of %s\n", fcb->chunk_index, fi->file_name);
+				return (-1);
+				}
+			}
+		int next = 0;
+		for (int i = 0; i < extent; i++)
+			{
+			if (target[i] < 0)
+				{
+				added[next] = (next < reserved) ? fcb->chunk_reserved[next] : newBlocks[next - reserved];
+				target[i] = added[next++];
+				}
+			}
+		free(newBlocks);
+		}
+
+	if (cacheWriteBlocks(data, target, extent) != extent)
+		{
+		printf("Error writing chunk %d of %s\n", fcb->chunk_index, fi->file_name);
+		freeBlocks(added + reserved, needed - reserved);
+		return (-1);
+		}
+
+	// readers of the directory must not see the map half updated
+	lockDirectory(fcb->parent_dir, 1);
+	while (fi->blocks_count < first + blocks)
+		{
+		fi->blocks_allocated[fi->blocks_count] = BLOCK_HOLE;
+		fi->blocks_count++;
+		}
+	for (int i = 0; i < blocks; i++)
+		{
+		fi->blocks_allocated[first + i] = (i < extent) ? target[i] : BLOCK_PACKED;
+		}
+	for (int i = blocks; i < oldCount; i++)
+		{
+		fi->blocks_allocated[first + i] = BLOCK_HOLE;
+		}
+	unlockDirectory(fcb->parent_dir);
+	fcb->meta_dirty = 1;
+
+	freeBlocks(old, oldCount);
+	fcb->chunk_dirty = 0;
+	fcb->chunk_generation = atomic_fetch_add(&packGeneration, 1) + 1;
+
+	// what compression saved goes back
+	if (fcb->chunk_reserved_count > reserved)
+		{
+		freeBlocks(fcb->chunk_reserved + reserved, fcb->chunk_reserved_count - reserved);
+		}
+	fcb->chunk_reserved_count = 0;
+	fcb->chunk_covered = -1;
+	return (0);
+	}
+
+// Give back the blocks set aside for storing the chunk buffer, for a chunk
+// that is dropped instead of stored
+static void b_releaseChunkBlocks (b_fcb * fcb)
+	{
+	if (fcb->chunk_reserved_count > 0)
+		{
+		freeBlocks(fcb->chunk_reserved, fcb->chunk_reserved_count);
+		}
+	fcb->chunk_reserved_count = 0;
+	fcb->chunk_covered = -1;
+	}
+
+// Make sure the chunk buffer can be stored once it holds length bytes of
+// data, however badly they compress, so a full disk shows as a short write
+// and not as a failed store after the write returned. The chunk may need a
+// block for each block of data. The blocks it has that no clone shares are
+// written again in place (see b_storeChunk), the rest are allocated here
+// and held until it is stored. Returns how many bytes of the chunk there is
+// room for. Caller holds the file lock for writing.
+static int b_reserveChunk (b_fcb * fcb, int length)
+	{
+	int first = fcb->chunk_index * COMPRESS_CHUNK_BLOCKS;
+	int blocks = (length + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+	if (first + blocks > MAX_DE_BLOCK_COUNT)
+		{
+		blocks = MAX_DE_BLOCK_COUNT - first;
+		}
+	if (blocks <= fcb->chunk_covered)
+		{
+		return (length);
+		}
+
+	int mapped[COMPRESS_CHUNK_BLOCKS];
+	int owned = 0;
+	for (int i = 0; i < blocks; i++)
+		{
+		int lba = b_blockToLBA(fcb, first + i);
+		if (lba >= 0)
+			{
+			mapped[owned++] = lba;
+			}
+		}
+	owned -= sharedBlocks(mapped, owned);
+	int needed = blocks - owned - fcb->chunk_reserved_count;
+	if (needed > 0)
+		{
+		int * newBlocks = allocateBlocks(needed);
+		if (newBlocks == NULL)
+			{
+			// only as much as was covered before
+			return ((fcb->chunk_covered > 0) ? fcb->chunk_covered * B_CHUNK_SIZE : 0);
+			}
+		memcpy(fcb->chunk_reserved + fcb->chunk_reserved_count, newBlocks, needed * sizeof(int));
+		fcb->chunk_reserved_count += needed;
+		free(newBlocks);
+		}
+	fcb->chunk_covered = blocks;
+	return (length);
+	}
+
+// Make sure the chunk buffer holds the given chunk of a compressed file,
+// writing back whatever chunk was there before. A compressed chunk the
+// readahead thread has decompressed already is taken from it, anything
+// else is read (and decompressed) here. If the caller is about to write
+// over the whole chunk nothing is read.
+static int b_loadChunk (b_fcb * fcb, int chunk, int overwrite)
+	{
+	if (fcb->chunk_index == chunk && (fcb->chunk_dirty || overwrite
+			|| fcb->chunk_generation == atomic_load(&packGeneration)))
+		{
+		return (0);
+		}
+
+	if (b_storeChunk(fcb) != 0)
+		{
+		return (-1);
+		}
+	if (fcb->chunk == NULL)
+		{
+		fcb->chunk = allocBlockBuffer(2 * COMPRESS_CHUNK_SIZE);
+		if (fcb->chunk == NULL)
+			{
+			printf("Memory allocation failed for chunk buffer\n");
+			return (-1);
+			}
+		}
+	fcb->chunk_index = -1;
+	fcb->chunk_covered = -1;
+	fcb->chunk_generation = atomic_load(&packGeneration);
+
+	int first = chunk * COMPRESS_CHUNK_BLOCKS;
+	int length = (int) fcb->fi->size - first * B_CHUNK_SIZE;
+	if (length < 0 || overwrite)
+		{
+		length = 0;
+		}
+	if (length > COMPRESS_CHUNK_SIZE)
+		{
+		length = COMPRESS_CHUNK_SIZE;
+		}
+
+	int lba[COMPRESS_CHUNK_BLOCKS];
+	int blocks;
+	b_chunkMap(fcb, chunk, lba);
+	int extent = b_packedExtent(lba, &blocks);
+	if (length > 0 && extent > 0)
+		{
+		b_packHeader * header = b_readExtent(lba, extent, fcb->chunk + COMPRESS_CHUNK_SIZE);
+		if (header == NULL || (!b_packedTake(lba[0], header, blocks, fcb->chunk)
+				&& b_inflate(header, blocks, fcb->chunk) != 0))
+			{
+			printf("Error reading compressed chunk %d of %s\n", chunk, fcb->fi->file_name);
+			return (-1);
+			}
+		memset(fcb->chunk + blocks * B_CHUNK_SIZE, 0, COMPRESS_CHUNK_SIZE - blocks * B_CHUNK_SIZE);
+		}
+	else if (length > 0)
+		{
+		// stored as is, one read per contiguous run
+		for (int i = 0; i < COMPRESS_CHUNK_BLOCKS; )
+			{
+			if (lba[i] < 0)
+				{
+				memset(fcb->chunk + i * B_CHUNK_SIZE, 0, B_CHUNK_SIZE);
+				i++;
+				continue;
+				}
+			int run = 1;
+			while (i + run < COMPRESS_CHUNK_BLOCKS && lba[i + run] == lba[i] + run)
+				{
+				run++;
+				}
+			if (cacheRead(fcb->chunk + i * B_CHUNK_SIZE, run, lba[i]) != run)
+				{
+				printf("Error reading block %d of %s\n", first + i, fcb->fi->file_name);
+				return (-1);
+				}
+			i += run;
+			}
+		}
+
+	// nothing past the end of file, so a write after a gap leaves zeros in it
+	if (!overwrite)
+		{
+		memset(fcb->chunk + length, 0, COMPRESS_CHUNK_SIZE - length);
+		}
+	fcb->chunk_length = length;
+	fcb->chunk_index = chunk;
+	fcb->chunk_dirty = 0;
+	return (0);
+	}
+
+// Read count bytes (all before the end of file) of a compressed file
+// through the chunk buffer. Caller holds the FCB lock and the file lock,
+// for writing if the chunk buffer is dirty (see b_lockFileRead).
+static int b_readChunks (b_fcb * fcb, char * buffer, int count)
+	{
+	int position = fcb->current_block * B_CHUNK_SIZE + fcb->index;
+	int done = 0;
+	while (done < count)
+		{
+		int chunk = (position + done) / COMPRESS_CHUNK_SIZE;
+		int offset = (position + done) % COMPRESS_CHUNK_SIZE;
+		int part = COMPRESS_CHUNK_SIZE - offset;
+		if (part > count - done)
+			{
+			part = count - done;
+			}
+		if (b_loadChunk(fcb, chunk, 0) != 0)
+			{
+			break;
+			}
+		memcpy(buffer + done, fcb->chunk + offset, part);
+		done += part;
+		}
+
+	fcb->current_block = (position + done) / B_CHUNK_SIZE;
+	fcb->index = (position + done) % B_CHUNK_SIZE;
+	return ((done > 0 || count == 0) ? done : -1);
+	}
+
+// Write to a compressed file through the chunk buffer, which is stored
+// once the writer moves on to another chunk or the write is done. The
+// blocks to store it in are set aside first, so this is short of count if
+// the disk is full. Caller holds the file lock for writing.
+static int b_writeChunks (b_fcb * fcb, char * buffer, int count)
+	{
+	int position = fcb->current_block * B_CHUNK_SIZE + fcb->index;
+	if (count > MAX_DE_BLOCK_COUNT * B_CHUNK_SIZE - position)
+		{
+		count = MAX_DE_BLOCK_COUNT * B_CHUNK_SIZE - position;
+		}
+
+	int done = 0;
+	while (done < count)
+		{
+		int chunk = (position + done) / COMPRESS_CHUNK_SIZE;
+		int offset = (position + done) % COMPRESS_CHUNK_SIZE;
+		int part = COMPRESS_CHUNK_SIZE - offset;
+		if (part > count - done)
+			{
+			part = count - done;
+			}
+		if (b_loadChunk(fcb, chunk, part == COMPRESS_CHUNK_SIZE) != 0)
+			{
+			break;
+			}
+		int end = (offset + part > fcb->chunk_length) ? offset + part : fcb->chunk_length;
+		int room = b_reserveChunk(fcb, end);
+		if (room <= offset)
+			{
+			break;
+			}
+		if (part > room - offset)
+			{
+			part = room - offset;
+			}
+		memcpy(fcb->chunk + offset, buffer + done, part);
+		fcb->chunk_dirty = 1;
+		if (offset + part > fcb->chunk_length)
+			{
+			fcb->chunk_length = offset + part;
+			}
+		done += part;
+		}
+
+	fcb->current_block = (position + done) / B_CHUNK_SIZE;
+	fcb->index = (position + done) % B_CHUNK_SIZE;
+	return (done);
+	}
+
+// Body of the readahead thread. It pulls queued windows into the block
+// cache, where the reader finds them (or waits on them if they are still
+// being loaded), and decompresses the chunks of compressed files so their
+// reader finds them ready in packedCache.
+static void * b_readaheadWorker (void * arg)
+	{
+	static char scratch[RA_MAX_WINDOW * B_CHUNK_SIZE] __attribute__((aligned(DEVICE_ALIGNMENT)));
+	static char inflated[COMPRESS_CHUNK_SIZE];
+
+	pthread_mutex_lock(&raLock);
+	while (1)
+		{
+		while (raHead == NULL)
+			{
+			pthread_cond_wait(&raWork, &raLock);
+			}
+
+		b_readahead * ra = raHead;
+		raHead = ra->next;
+		if (raHead == NULL)
+			{
+			raTail = NULL;
+			}
+		pthread_mutex_unlock(&raLock);
+
+		// read the window one contiguous run at a time
+		for (int i = 0; i < ra->count; )
+			{
+			if (ra->lba[i] < 0)
+				{
+				i++;
+				continue;
+				}
+			int run = 1;
+			while (i + run < ra->count && ra->lba[i + run] == ra->lba[i] + run)
+				{
+				run++;
+				}
+			if (cacheRead(scratch, run, ra->lba[i]) != run)
+				{
+				break;
+				}
+			i += run;
+			}
+
+		// the blocks are in the cache now, decompress the chunks they hold
+		for (int i = 0; ra->packed && i + COMPRESS_CHUNK_BLOCKS <= ra->count; i += COMPRESS_CHUNK_BLOCKS)
+			{
+			int blocks;
+			int extent = b_packedExtent(&ra->lba[i], &blocks);
+			if (extent == 0)
+				{
+				continue;
+				}
+			b_packHeader * header = b_readExtent(&ra->lba[i], extent, scratch);
+			if (header != NULL && !b_packedTake(ra->lba[i], header, blocks, NULL)
+					&& b_inflate(header, blocks, inflated) == 0)
+				{
+				b_packedGive(ra->lba[i], header, blocks, inflated);
+				}
+			}
+		free(ra);
+
+		pthread_mutex_lock(&raLock);
+		}
+	return (NULL);
+	}
+
+// Keep the readahead thread ahead of a sequential reader. Like the Linux
+// readahead marker, the next window is requested as soon as the reader
+// reaches the first block of the previous one, and every window is twice
+// the size of the last one up to RA_MAX_WINDOW.
+static void b_readaheadSchedule (b_fcb * fcb)
+	{
+	if (fcb->current_block < fcb->ra_marker)
+		{
+		return;
+		}
+	if (fcb->ra_ahead < fcb->current_block)
+		{
+		fcb->ra_ahead = fcb->current_block;
+		}
+
+	// a compressed file is read ahead in whole chunks, from the one after
+	// the chunk the reader is decompressing itself
+	int packed = (fcb->fi->flags & DE_COMPRESS) != 0;
+	if (packed)
+		{
+		int next = (fcb->current_block / COMPRESS_CHUNK_BLOCKS + 1) * COMPRESS_CHUNK_BLOCKS;
+		if (fcb->ra_ahead < next)
+			{
+			fcb->ra_ahead = next;
+			}
+		}
+
+	int fileBlocks = (fcb->fi->size + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+	int count = fileBlocks - fcb->ra_ahead;
+	if (count > fcb->ra_window)
+		{
+		count = fcb->ra_window;
+		}
+	if (count <= 0)
+		{
+		return;
+		}
+	if (packed)
+		{
+		count = (count + COMPRESS_CHUNK_BLOCKS - 1) / COMPRESS_CHUNK_BLOCKS * COMPRESS_CHUNK_BLOCKS;
+		}
+
+	b_readahead * ra = malloc(sizeof(b_readahead));
+	if (ra == NULL)
+		{
+		return;
+		}
+	for (int i = 0; i < count; i++)
+		{
+		ra->lba[i] = b_blockToLBA(fcb, fcb->ra_ahead + i);
+		}
+	ra->count = count;
+	ra->packed = packed;
+	ra->next = NULL;
+
+	fcb->ra_marker = fcb->ra_ahead;
+	fcb->ra_ahead += count;
+	fcb->ra_window *= 2;
+	if (fcb->ra_window > RA_MAX_WINDOW)
+		{
+		fcb->ra_window = RA_MAX_WINDOW;
+		}
+
+	pthread_mutex_lock(&raLock);
+	if (!raStarted)
+		{
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, b_readaheadWorker, NULL) != 0)
+			{
+			pthread_mutex_unlock(&raLock);
+			free(ra);
+			return;
+			}
+		pthread_detach(tid);
+		raStarted = 1;
+		}
+	if (raTail == NULL)
+		raHead = ra;
+	else
+		raTail->next = ra;
+	raTail = ra;
+	pthread_cond_signal(&raWork);
+	pthread_mutex_unlock(&raLock);
+	}
+
+// Write the buffered block back to disk if it holds unwritten data
+static int b_flushBuffer (b_fcb * fcb)
+	{
+	// compressed files buffer a chunk instead
+	if (fcb->chunk_dirty)
+		{
+		return (b_storeChunk(fcb));
+		}
+
+	if (!fcb->dirty || fcb->buf_block < 0)
+		{
+		return (0);
+		}
+
+	// the file was truncated below this block after it was written
+	if (fcb->buf_block >= fcb->fi->blocks_count)
+		{
+		fcb->dirty = 0;
+		return (0);
+		}
+
+	// buf holds the whole block, so a shared block needs no copying
+	if (b_ownBlocks(fcb, fcb->buf_block, 1) != 0)
+		{
+		printf("No space left to write block %d of %s\n", fcb->buf_block, fcb->fi->file_name);
+		return (-1);
+		}
+
+	int lba = b_blockToLBA(fcb, fcb->buf_block);
+	if (lba < 0 || cacheWrite(fcb->buf, 1, lba) != 1)
+		{
+		printf("Error writing block %d of %s\n", fcb->buf_block, fcb->fi->file_name);
+		return (-1);
+		}
+	fcb->dirty = 0;
+	return (0);
+	}
+
+// Make sure buf holds the given logical block, writing back whatever block
+// was there before. Blocks past the end of file and holes start out zeroed.
+// A clean block is read again if another FCB may have written it since.
+static int b_fillBuffer (b_fcb * fcb, int block)
+	{
+	if (fcb->buf_block == block
+			&& (fcb->dirty || fcb->buf_generation == atomic_load(&bufGeneration)))
+		{
+		return (0);
+		}
+
+	if (b_flushBuffer(fcb) != 0)
+		{
+		return (-1);
+		}
+
+	fcb->buf_generation = atomic_load(&bufGeneration);
+	int blockStart = block * B_CHUNK_SIZE;
+	if (blockStart >= fcb->fi->size)
+		{
+		memset(fcb->buf, 0, B_CHUNK_SIZE);
+		fcb->buflen = 0;
+		}
+	else
+		{
+		int lba = b_blockToLBA(fcb, block);
+		if (lba == BLOCK_HOLE)
+			{
+			memset(fcb->buf, 0, B_CHUNK_SIZE);
+			}
+		else if (cacheRead(fcb->buf, 1, lba) != 1)
+			{
+			printf("Error reading block %d of %s\n", block, fcb->fi->file_name);
+			fcb->buf_block = -1;
+			return (-1);
+			}
+		int valid = fcb->fi->size - blockStart;
+		fcb->buflen = (valid < B_CHUNK_SIZE) ? valid : B_CHUNK_SIZE;
+		}
+
+	fcb->buf_block = block;
+	return (0);
+	}
+
+// Make sure the block map covers the bytes of the file from 'from' up to
+// 'to', allocating blocks as needed. Blocks the map grows by before 'from'
+// are left as holes, so writing far past the end of file only costs the
+// blocks written. If filled is not NULL, filled[block] is set for every
+// block allocated here. Returns where the covered range ends, which is short
+// of 'to' if the disk filled up. Caller holds the file lock for writing.
+static int b_reserveBlocks (b_fcb * fcb, int from, int to, char * filled)
+	{
+	de_struct * fi = fcb->fi;
+	int first = from / B_CHUNK_SIZE;
+	int last = (to + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+	if (last > MAX_DE_BLOCK_COUNT)
+		{
+		last = MAX_DE_BLOCK_COUNT;
+		}
+
+	int needed = 0;
+	for (int block = first; block < last; block++)
+		{
+		if (block >= fi->blocks_count || fi->blocks_allocated[block] == BLOCK_HOLE)
+			{
+			needed++;
+			}
+		}
+
+	if (needed > 0)
+		{
+		int * newBlocks = allocateBlocks(needed);
+		if (newBlocks == NULL)
+			{
+			// Could not allocate more blocks, write up to the first gap
+			int block = first;
+			while (block < last && block < fi->blocks_count
+					&& fi->blocks_allocated[block] != BLOCK_HOLE)
+				{
+				block++;
+				}
+			int covered = block * B_CHUNK_SIZE;
+			return ((covered < from) ? from : (to < covered) ? to : covered);
+			}
+
+		// the entry is part of the directory, so readers of the directory
+		// must not see the map half updated
+		lockDirectory(fcb->parent_dir, 1);
+		while (fi->blocks_count < last)
+			{
+			fi->blocks_allocated[fi->blocks_count] = BLOCK_HOLE;
+			fi->blocks_count++;
+			}
+		int next = 0;
+		for (int block = first; block < last; block++)
+			{
+			if (fi->blocks_allocated[block] == BLOCK_HOLE)
+				{
+				fi->blocks_allocated[block] = newBlocks[next++];
+				if (filled != NULL)
+					{
+					filled[block] = 1;
+					}
+				}
+			}
+		unlockDirectory(fcb->parent_dir);
+		fcb->meta_dirty = 1;
+		free(newBlocks);
+		}
+
+	int covered = last * B_CHUNK_SIZE;
+	return ((to < covered) ? to : covered);
+	}
+
+// Give back the blocks b_reserveBlocks allocated (marked in filled) that lie
+// wholly past 'from', for a write that stopped short of the range it
+// reserved, and drop the holes this leaves at the end of the map. Caller
+// holds the file lock for writing and has already grown the size.
+static int b_unreserveBlocks (b_fcb * fcb, int from, char * filled)
+	{
+	de_struct * fi = fcb->fi;
+	int first = (from + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+
+	// nothing was written to these blocks, not even through buf
+	if (fcb->buf_block >= first && filled[fcb->buf_block])
+		{
+		fcb->buf_block = -1;
+		fcb->dirty = 0;
+		}
+
+	int dropped[MAX_DE_BLOCK_COUNT];
+	int count = 0;
+	int keep = (fi->size + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+	lockDirectory(fcb->parent_dir, 1);
+	for (int block = first; block < fi->blocks_count; block++)
+		{
+		if (filled[block])
+			{
+			dropped[count++] = fi->blocks_allocated[block];
+			fi->blocks_allocated[block] = BLOCK_HOLE;
+			}
+		}
+	while (fi->blocks_count > keep && fi->blocks_allocated[fi->blocks_count - 1] == BLOCK_HOLE)
+		{
+		fi->blocks_count--;
+		fi->blocks_allocated[fi->blocks_count] = 0;
+		}
+	unlockDirectory(fcb->parent_dir);
+
+	if (count == 0)
+		{
+		return (0);
+		}
+	fcb->meta_dirty = 1;
+	return (freeBlocks(dropped, count));
+	}
+
+// Move the position of a locked FCB
+static off_t b_seekFCB (b_fcb * fcb, off_t offset, int whence)
+	{
+	off_t position;
+	switch (whence)
+		{
+		case SEEK_SET:
+			position = offset;
+			break;
+
+		case SEEK_CUR:
+			position = (off_t) fcb->current_block * B_CHUNK_SIZE
+				+ fcb->index + offset;
+			break;
+
+		case SEEK_END:
+			pthread_rwlock_rdlock(b_fileLock(fcb->fi));
+			position = (off_t) fcb->fi->size + offset;
+			pthread_rwlock_unlock(b_fileLock(fcb->fi));
+			break;
+
+		default:
+			return (-1);
+		}
+
+	if (position < 0 || position > (off_t) MAX_DE_BLOCK_COUNT * B_CHUNK_SIZE)
+		{
+		return (-1);
+		}
+
+	// only the position moves, the buffer stays tied to the block it holds
+	// so seeking inside the buffered block costs no I/O
+	fcb->current_block = position / B_CHUNK_SIZE;
+	fcb->index = position % B_CHUNK_SIZE;
+
+	return (position);
+	}
+
+// Interface to seek function
+int b_seek (b_io_fd fd, off_t offset, int whence)
+	{
+	b_init();  //Initialize our system
+
+	b_fcb * fcb = b_lockFCB(fd);
+	if (fcb == NULL)
+		{
+		return (-1); 					//invalid file descriptor or not open
+		}
+
+	off_t position = b_seekFCB(fcb, offset, whence);
+	pthread_mutex_unlock(&fcb->lock);
+	return (position);
+	}
+
+
+// Write through a locked FCB, caller holds the file lock for writing and
+// calls b_updateSize once it is done writing
+static int b_writeFCB(b_fcb *fcb, char *buffer, int count) {
+    // check write permission
+    if (!(fcb->flags & O_WRONLY) && !(fcb->flags & O_RDWR)) {
+        return -1;  // File not opened for writing
+    }
+
+    if (count <= 0) {
+        return 0;
+    }
+    b_appendPosition(fcb);
+    int position = fcb->current_block * B_CHUNK_SIZE + fcb->index;
+
+    // writing breaks up a sequential read
+    fcb->ra_window = 0;
+    fcb->ra_position = -1;
+
+    if (fcb->fi->flags & DE_COMPRESS) {
+        return b_writeChunks(fcb, buffer, count);
+    }
+
+    // make sure every block we are about to touch is mapped, and only
+    // write as much as could be allocated
+    int end = b_reserveBlocks(fcb, position, position + count, NULL);
+    int bytesToWrite = end - position;  // bytes remaining to write
+    if (bytesToWrite <= 0) {
+        return 0;
+    }
+
+    int bytesWritten = 0;      // bytes written so far
+    int currentPos = 0;        // current position in buffer
+
+    // Part 1: finish a partially written block through the buffer
+    if (fcb->index > 0 || bytesToWrite < B_CHUNK_SIZE) {
+        if (b_fillBuffer(fcb, fcb->current_block) != 0) {
+            return -1;
+        }
+
+        // zero any gap left by seeking past the valid data
+        if (fcb->index > fcb->buflen) {
+            memset(fcb->buf + fcb->buflen, 0, fcb->index - fcb->buflen);
+        }
+
+        int remainingBufferSpace = B_CHUNK_SIZE - fcb->index;
+        int bytesToCopy = (bytesToWrite < remainingBufferSpace) ? bytesToWrite : remainingBufferSpace;
+
+        memcpy(fcb->buf + fcb->index, buffer, bytesToCopy);
+        fcb->index += bytesToCopy;
+        fcb->dirty = 1;
+        if (fcb->index > fcb->buflen) {
+            fcb->buflen = fcb->index;
+        }
+        bytesWritten += bytesToCopy;
+        currentPos += bytesToCopy;
+        bytesToWrite -= bytesToCopy;
+
+        // if buffer is full, write it to disk and move to the next block
+        if (fcb->index == B_CHUNK_SIZE) {
+            fcb->index = 0;
+            fcb->current_block++;
+            if (b_flushBuffer(fcb) != 0) {
+                return bytesWritten;
+            }
+        }
+    }
+
+    // Part 2: write whole blocks directly from the caller's buffer, one LBA
+    // call per physically contiguous run
+    if (bytesToWrite >= B_CHUNK_SIZE &&
+        b_ownBlocks(fcb, fcb->current_block, bytesToWrite / B_CHUNK_SIZE) != 0) {
+        return bytesWritten;
+    }
+    while (bytesToWrite >= B_CHUNK_SIZE) {
+        int run = b_contiguousRun(fcb, fcb->current_block, bytesToWrite / B_CHUNK_SIZE);
+        int lba = b_blockToLBA(fcb, fcb->current_block);
+        if (run <= 0 || cacheWrite(buffer + currentPos, run, lba) != run) {
+            break;
+        }
+
+        // the buffered copy of any block we just overwrote is stale now
+        if (fcb->buf_block >= fcb->current_block && fcb->buf_block < fcb->current_block + run) {
+            fcb->buf_block = -1;
+            fcb->dirty = 0;
+        }
+
+        bytesWritten += run * B_CHUNK_SIZE;
+        currentPos += run * B_CHUNK_SIZE;
+        bytesToWrite -= run * B_CHUNK_SIZE;
+        fcb->current_block += run;
+    }
+
+    // Part 3: put the remaining tail in the buffer, it goes to the block
+    // cache once the write is done (see b_updateSize)
+    if (bytesToWrite > 0 && bytesToWrite < B_CHUNK_SIZE) {
+        if (b_fillBuffer(fcb, fcb->current_block) == 0) {
+            memcpy(fcb->buf, buffer + currentPos, bytesToWrite);
+            fcb->index = bytesToWrite;
+            fcb->dirty = 1;
+            if (fcb->index > fcb->buflen) {
+                fcb->buflen = fcb->index;
+            }
+            bytesWritten += bytesToWrite;
+        }
+    }
+
+	//printf("bytesWritten: %d\n", bytesWritten);
+
+    return bytesWritten;
+}
+
+// Write the directory entry of the file if it changed since it was last
+// written. Only the blocks holding the entry are written, not the whole
+// parent directory.
+static int b_writeMeta(b_fcb *fcb) {
+    if (!fcb->meta_dirty) {
+        return 0;
+    }
+
+    de_struct *parentDir = fcb->parent_dir;
+    lockDirectory(parentDir, 0);
+    int result = writeDirectoryEntry(parentDir, fcb->fi - parentDir);
+    unlockDirectory(parentDir);
+
+    if (result == 0) {
+        fcb->meta_dirty = 0;
+        fcb->meta_written = getTime();
+    }
+    return result;
+}
+
+// Finish a write: hand what it left in the FCB to the block cache, then
+// grow the file size to the current position if the file was written past
+// its end. The size is shared by every FCB of the file, so it must not
+// cover data that is still private to this one. The entry in memory, which
+// every user of the directory sees, is updated right away, but it only goes
+// to disk at b_fsync, b_close, or once META_WRITE_INTERVAL seconds have
+// passed, so a file written in many small pieces does not rewrite its
+// directory each time. Caller holds the file lock for writing.
+static void b_updateSize(b_fcb *fcb) {
+    // the partial block in buf is only copied into the cache, not written
+    // to disk, a compressed file stores its chunk. Whatever could not be
+    // written stays dirty and b_close reports it.
+    b_flushBuffer(fcb);
+    if (!(fcb->fi->flags & DE_COMPRESS)) {
+        fcb->buf_generation = atomic_fetch_add(&bufGeneration, 1) + 1;
+    }
+
+    // calculate how many bytes are written beyond the current file size
+	int currentLoc = fcb->current_block * B_CHUNK_SIZE + fcb->index;
+
+    if (currentLoc > fcb->fi->size) {
+		de_struct *parentDir = fcb->parent_dir;
+		lockDirectory(parentDir, 1);
+
+        // update file size and modification time
+        fcb->fi->size = currentLoc;
+        fcb->fi->date_modified = getTime();
+
+		unlockDirectory(parentDir);
+		fcb->meta_dirty = 1;
+    }
+
+    if (fcb->meta_dirty && getTime() - fcb->meta_written >= META_WRITE_INTERVAL) {
+        b_writeMeta(fcb);
+    }
+}
+
+// Cut the file down to (or extend it with a hole up to) length bytes,
+// caller holds the FCB lock and the file lock for writing. The blocks past
+// the new end go back to the allocator in one freeBlocks call, after the
+// directory entry no longer points at them. The position does not move.
+static int b_truncateFCB (b_fcb * fcb, off_t length)
+	{
+	de_struct * fi = fcb->fi;
+	if (length < 0 || length > (off_t) MAX_DE_BLOCK_COUNT * B_CHUNK_SIZE)
+		{
+		return (-1);
+		}
+
+	int keep = (length + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+	if (fi->flags & DE_COMPRESS)
+		{
+		// a chunk the new end cuts through is written again without what
+		// is past the end, a chunk wholly past it is dropped unwritten
+		int cut = length % COMPRESS_CHUNK_SIZE;
+		if (fcb->chunk_dirty && (off_t) fcb->chunk_index * COMPRESS_CHUNK_SIZE >= length)
+			{
+			fcb->chunk_dirty = 0;
+			b_releaseChunkBlocks(fcb);
+			}
+		if (length < fi->size && cut != 0)
+			{
+			if (b_loadChunk(fcb, length / COMPRESS_CHUNK_SIZE, 0) != 0)
+				{
+				return (-1);
+				}
+			memset(fcb->chunk + cut, 0, COMPRESS_CHUNK_SIZE - cut);
+			fcb->chunk_length = cut;
+			fcb->chunk_dirty = 1;
+			}
+		if (b_storeChunk(fcb) != 0)
+			{
+			return (-1);
+			}
+		fcb->chunk_index = -1;
+		atomic_fetch_add(&packGeneration, 1);
+		}
+	else
+		{
+		// clear the part of the new last block past the end of file, so it
+		// reads as zeros if the file grows again
+		if (length < fi->size && length % B_CHUNK_SIZE != 0
+				&& b_blockToLBA(fcb, keep - 1) != BLOCK_HOLE)
+			{
+			if (b_fillBuffer(fcb, keep - 1) != 0)
+				{
+				return (-1);
+				}
+			int tail = length % B_CHUNK_SIZE;
+			memset(fcb->buf + tail, 0, B_CHUNK_SIZE - tail);
+			fcb->dirty = 1;
+			}
+		if (b_flushBuffer(fcb) != 0)
+			{
+			return (-1);
+			}
+		fcb->buf_block = -1;
+		atomic_fetch_add(&bufGeneration, 1);
+		}
+
+	// only now, writing the chunk above may have grown the map
+	if (keep > fi->blocks_count)
+		{
+		keep = fi->blocks_count;
+		}
+
+	int dropped[MAX_DE_BLOCK_COUNT];
+	int count = 0;
+	lockDirectory(fcb->parent_dir, 1);
+	for (int i = keep; i < fi->blocks_count; i++)
+		{
+		dropped[count++] = fi->blocks_allocated[i];
+		fi->blocks_allocated[i] = 0;
+		}
+	fi->blocks_count = keep;
+	fi->size = length;
+	fi->date_modified = getTime();
+	unlockDirectory(fcb->parent_dir);
+
+	fcb->meta_dirty = 1;
+	if (b_writeMeta(fcb) != 0)
+		{
+		return (-1);
+		}
+	return (freeBlocks(dropped, count));
+	}
+
+// Interface to truncate an open file to length bytes, like ftruncate
+int b_truncate (b_io_fd fd, off_t length)
+	{
+	b_init();  //Initialize our system
+
+	b_fcb * fcb = b_lockFCB(fd);
+	if (fcb == NULL)
+		{
+		return (-1);
+		}
+	if (!(fcb->flags & (O_WRONLY | O_RDWR)))
+		{
+		pthread_mutex_unlock(&fcb->lock);
+		return (-1);				// not opened for writing
+		}
+
+	pthread_rwlock_wrlock(b_fileLock(fcb->fi));
+	int result = b_truncateFCB(fcb, length);
+	pthread_rwlock_unlock(b_fileLock(fcb->fi));
+	pthread_mutex_unlock(&fcb->lock);
+	return (result);
+	}
+
+// Interface to write function
+int b_write(b_io_fd fd, char *buffer, int count) {
+    b_init();  // Initialize our system
+
+    // check that fd is valid and the file is open
+    b_fcb *fcb = b_lockFCB(fd);
+    if (fcb == NULL)
+		{
+        return (-1);  					// invalid file descriptor
+    	}
+
+    pthread_rwlock_wrlock(b_fileLock(fcb->fi));
+    int result = b_writeFCB(fcb, buffer, count);
+    b_updateSize(fcb);
+    pthread_rwlock_unlock(b_fileLock(fcb->fi));
+    pthread_mutex_unlock(&fcb->lock);
+    return result;
+}
+
+
+
+// Interface to read a buffer
+
+// Filling the callers request is broken into three parts
+// Part 1 is what can be filled from the current buffer, which may or may not be enough
+// Part 2 is after using what was left in our buffer there is still 1 or more block
+//        size chunks needed to fill the callers request.  This represents the number of
+//        bytes in multiples of the blocksize.
+// Part 3 is a value less than blocksize which is what remains to copy to the callers buffer
+//        after fulfilling part 1 and part 2.  This would always be filled from a refill
+//        of our buffer.
+//  +-------------+------------------------------------------------+--------+
+//  |             |                                                |        |
 //  | filled from |  filled direct in multiples of the block size  | filled |
 //  | existing    |                                                | from   |
 //  | buffer      |                                                |refilled|
@@ -444,120 +1865,680 @@ int b_write(b_io_fd fd, char *buffer, int count) {
 //  |             |                                                |        |
 //  | Part1       |  Part 2                                        | Part3  |
 //  +-------------+------------------------------------------------+--------+
-int b_read (b_io_fd fd, char * buffer, int count)
+//
+// Every block is located through the file's block map, so the blocks of a
+// file do not need to be contiguous on disk.
+//
+// Caller holds the FCB lock and the file lock for reading.
+static int b_readFCB (b_fcb * fcb, char * buffer, int count)
 	{
-
-    if (startup == 0) b_init();  //Initialize our system
-    
-	// check that fd is between 0 and (MAXFCBS-1)
-    if (fd < 0 || fd >= MAXFCBS) {
-        return (-1);  // invalid descriptor
-    }
-    
-    if (fcbArray[fd].fi == NULL) {		// File is not open for this fd
-        return -1;  // File not open
-    }
-    
     int bytesReturned = 0;			// what we will return
-    int bytesRemaining= count;
+    int bytesRemaining = count;
     int bufferPos = 0;
-    int availableInBuffer = fcbArray[fd].buflen - fcbArray[fd].index;	// holds how many bytes are left in my buffer
-    
+
     // handle EOF
-    int bytesRead = (fcbArray[fd].current_block * BLOCK_SIZE) - availableInBuffer;
-    if ((bytesRead + count) > fcbArray[fd].fi->size) {
-        bytesRemaining = fcbArray[fd].fi->size - bytesRead;
+    int position = fcb->current_block * B_CHUNK_SIZE + fcb->index;
+    if ((position + count) > fcb->fi->size) {
+        bytesRemaining = fcb->fi->size - position;
         if (bytesRemaining <= 0){
 			return 0;  // Nothing left to read
-		} 
+		}
     }
-    
-    // Part 1: copy data from existing buffer if available
-    if (availableInBuffer > 0) {
+
+    // a read that starts where the last one ended is sequential and keeps
+    // the readahead going, anything else stops it
+    if (position == fcb->ra_position) {
+        if (fcb->ra_window == 0) {
+            // start at twice the request size, like Linux does for small reads
+            int requestBlocks = (bytesRemaining + B_CHUNK_SIZE - 1) / B_CHUNK_SIZE;
+            fcb->ra_window = 2 * requestBlocks;
+            if (fcb->ra_window < RA_MIN_WINDOW)
+                fcb->ra_window = RA_MIN_WINDOW;
+            if (fcb->ra_window > RA_MAX_WINDOW)
+                fcb->ra_window = RA_MAX_WINDOW;
+            fcb->ra_ahead = 0;
+            fcb->ra_marker = 0;
+        }
+    } else {
+        fcb->ra_window = 0;
+    }
+
+    // compressed files are read through the chunk buffer instead
+    if (fcb->fi->flags & DE_COMPRESS) {
+        bytesReturned = b_readChunks(fcb, buffer, bytesRemaining);
+        if (bytesReturned > 0) {
+            fcb->ra_position = position + bytesReturned;
+            if (fcb->ra_window != 0) {
+                b_readaheadSchedule(fcb);
+            }
+        }
+        return bytesReturned;
+    }
+
+    // Part 1: finish the block the position is in (from the buffer if loaded)
+    if (fcb->index > 0) {
+        if (b_fillBuffer(fcb, fcb->current_block) != 0) {
+            return -1;
+        }
+
+        int availableInBuffer = B_CHUNK_SIZE - fcb->index;
         int amountTransferred;
 		if(bytesRemaining < availableInBuffer){
 			amountTransferred = bytesRemaining;
 		}else{
 			amountTransferred = availableInBuffer;
 		}
-        
-        memcpy(buffer, fcbArray[fd].buf + fcbArray[fd].index, amountTransferred);
-        fcbArray[fd].index += amountTransferred;
+
+        memcpy(buffer, fcb->buf + fcb->index, amountTransferred);
+        fcb->index += amountTransferred;
         bufferPos += amountTransferred;
         bytesRemaining -= amountTransferred;
         bytesReturned += amountTransferred;
+
+        if (fcb->index == B_CHUNK_SIZE) {
+            fcb->index = 0;
+            fcb->current_block++;
+        }
     }
-    
-    // Part 2: read whole blocks directly
-    if (bytesRemaining >= BLOCK_SIZE) {
-        int blocksToRead = bytesRemaining / BLOCK_SIZE;
-        int blockPos = fcbArray[fd].start_block + fcbArray[fd].current_block;
-        
-        int blocksRead = LBAread(buffer + bufferPos, blocksToRead, blockPos);
-        
-        int bytesRead = blocksRead * BLOCK_SIZE;
-        fcbArray[fd].current_block += blocksRead;
+
+    // Part 2: read whole blocks directly, one LBA call per contiguous run
+    if (bytesRemaining >= B_CHUNK_SIZE) {
+        // anything still buffered must reach the disk before we read around it
+        if (b_flushBuffer(fcb) != 0) {
+            return bytesReturned;
+        }
+    }
+    while (bytesRemaining >= B_CHUNK_SIZE) {
+        int blocksRead;
+        int holes = b_holeRun(fcb, fcb->current_block, bytesRemaining / B_CHUNK_SIZE);
+        if (holes > 0) {
+            // nothing on disk to read, a hole is all zeros
+            memset(buffer + bufferPos, 0, holes * B_CHUNK_SIZE);
+            blocksRead = holes;
+        } else {
+            int run = b_contiguousRun(fcb, fcb->current_block, bytesRemaining / B_CHUNK_SIZE);
+            int blockPos = b_blockToLBA(fcb, fcb->current_block);
+            if (run <= 0) {
+                return bytesReturned;
+            }
+
+            blocksRead = cacheRead(buffer + bufferPos, run, blockPos);
+            if (blocksRead <= 0) {
+                return bytesReturned;
+            }
+        }
+
+        int bytesRead = blocksRead * B_CHUNK_SIZE;
+        fcb->current_block += blocksRead;
         bufferPos += bytesRead;
         bytesRemaining -= bytesRead;
         bytesReturned += bytesRead;
     }
-    
-    // Part 3: read final partial block 
-    if (bytesRemaining > 0) {
-        int blockPos = fcbArray[fd].start_block + fcbArray[fd].current_block;
-        int bytesRead = LBAread(fcbArray[fd].buf, 1, blockPos) * BLOCK_SIZE;
-        
-        if (bytesRead > 0) {
 
-			int amountTransferred;
-			if(bytesRemaining < bytesRead){
-				amountTransferred = bytesRemaining;
-			}else{
-				amountTransferred = bytesRead;
-			}
-            
-            memcpy(buffer + bufferPos, fcbArray[fd].buf, amountTransferred);
-            fcbArray[fd].index = amountTransferred;
-            fcbArray[fd].buflen = bytesRead;
-            fcbArray[fd].current_block++;
-            bytesReturned += amountTransferred;
+    // Part 3: read final partial block into the buffer
+    if (bytesRemaining > 0) {
+        if (b_fillBuffer(fcb, fcb->current_block) != 0) {
+            return bytesReturned;
         }
+
+        memcpy(buffer + bufferPos, fcb->buf, bytesRemaining);
+        fcb->index = bytesRemaining;
+        bytesReturned += bytesRemaining;
     }
-    
+
+    fcb->ra_position = position + bytesReturned;
+    if (fcb->ra_window != 0) {
+        b_readaheadSchedule(fcb);
+    }
+
     return bytesReturned;
 	}
-	
-// Interface to Close the file	
-int b_close (b_io_fd fd)
+
+int b_read (b_io_fd fd, char * buffer, int count)
+	{
+    b_init();  //Initialize our system
+
+	// check that fd is valid and the file is open
+    b_fcb * fcb = b_lockFCB(fd);
+    if (fcb == NULL) {
+        return (-1);  // invalid descriptor
+    }
+
+    b_lockFileRead(fcb);
+    int result = b_readFCB(fcb, buffer, count);
+    pthread_rwlock_unlock(b_fileLock(fcb->fi));
+    pthread_mutex_unlock(&fcb->lock);
+    return result;
+	}
+
+// Positional read, reads count bytes at offset without moving the file position.
+// The FCB stays locked throughout, so no other thread sees the moved position.
+int b_pread (b_io_fd fd, char * buffer, int count, off_t offset)
 	{
+	b_init();  //Initialize our system
 
-		// check that fd is between 0 and (MAXFCBS-1)
-		if ((fd < 0) || (fd >= MAXFCBS)) 
+	b_fcb * fcb = b_lockFCB(fd);
+	if (fcb == NULL)
 		{
-        return (-1);  					// invalid file descriptor
-    	}
+		return (-1);
+		}
+
+	int savedBlock = fcb->current_block;
+	int savedIndex = fcb->index;
+
+	int result = -1;
+	if (b_seekFCB(fcb, offset, SEEK_SET) >= 0)
+		{
+		b_lockFileRead(fcb);
+		result = b_readFCB(fcb, buffer, count);
+		pthread_rwlock_unlock(b_fileLock(fcb->fi));
+		}
+
+	fcb->current_block = savedBlock;
+	fcb->index = savedIndex;
+	pthread_mutex_unlock(&fcb->lock);
+	return (result);
+	}
+
+// Positional write, writes count bytes at offset without moving the file position
+int b_pwrite (b_io_fd fd, char * buffer, int count, off_t offset)
+	{
+	b_init();  //Initialize our system
+
+	b_fcb * fcb = b_lockFCB(fd);
+	if (fcb == NULL)
+		{
+		return (-1);
+		}
+
+	int savedBlock = fcb->current_block;
+	int savedIndex = fcb->index;
+
+	int result = -1;
+	if (b_seekFCB(fcb, offset, SEEK_SET) >= 0)
+		{
+		pthread_rwlock_wrlock(b_fileLock(fcb->fi));
+		result = b_writeFCB(fcb, buffer, count);
+		b_updateSize(fcb);
+		pthread_rwlock_unlock(b_fileLock(fcb->fi));
+		}
+
+	fcb->current_block = savedBlock;
+	fcb->index = savedIndex;
+	pthread_mutex_unlock(&fcb->lock);
+	return (result);
+	}
+
+// Scatter read, fills the buffers in order as one read of their total size.
+// The FCB is looked up and locked once for the whole vector.
+int b_readv (b_io_fd fd, const struct iovec * iov, int iovcnt)
+	{
+	b_init();  //Initialize our system
+
+	b_fcb * fcb = b_lockFCB(fd);
+	if (fcb == NULL || iovcnt < 0)
+		{
+		if (fcb != NULL)
+			pthread_mutex_unlock(&fcb->lock);
+		return (-1);
+		}
+
+	int total = 0;
+	b_lockFileRead(fcb);
+	for (int i = 0; i < iovcnt; i++)
+		{
+		int count = iov[i].iov_len;
+		int result = b_readFCB(fcb, iov[i].iov_base, count);
+		if (result < 0)
+			{
+			if (total == 0)
+				total = -1;
+			break;
+			}
+		total += result;
+		if (result < count)
+			{
+			break;	// end of file
+			}
+		}
+	pthread_rwlock_unlock(b_fileLock(fcb->fi));
+
+	pthread_mutex_unlock(&fcb->lock);
+	return (total);
+	}
+
+// Gather write, writes the buffers in order as one write of their total size.
+// Blocks for the whole vector are allocated in one go, and the directory
+// entry is written once at the end instead of once per buffer. If a buffer
+// fails part way, the blocks allocated past what was written are freed.
+int b_writev (b_io_fd fd, const struct iovec * iov, int iovcnt)
+	{
+	b_init();  //Initialize our system
+
+	b_fcb * fcb = b_lockFCB(fd);
+	if (fcb == NULL || iovcnt < 0)
+		{
+		if (fcb != NULL)
+			pthread_mutex_unlock(&fcb->lock);
+		return (-1);
+		}
+
+	int length = 0;
+	for (int i = 0; i < iovcnt; i++)
+		{
+		length += iov[i].iov_len;
+		}
+
+	int total = 0;
+	int position = -1;
+	char filled[MAX_DE_BLOCK_COUNT] = {0};
+	pthread_rwlock_wrlock(b_fileLock(fcb->fi));
+	if ((fcb->flags & (O_WRONLY | O_RDWR)) && !(fcb->fi->flags & DE_COMPRESS))
+		{
+		// one allocation keeps the new blocks together so the buffers
+		// below are written with as few LBA calls as possible
+		b_appendPosition(fcb);
+		position = fcb->current_block * B_CHUNK_SIZE + fcb->index;
+		b_reserveBlocks(fcb, position, position + length, filled);
+		}
+	for (int i = 0; i < iovcnt; i++)
+		{
+		int count = iov[i].iov_len;
+		int result = b_writeFCB(fcb, iov[i].iov_base, count);
+		if (result < 0)
+			{
+			if (total == 0)
+				total = -1;
+			break;
+			}
+		total += result;
+		if (result < count)
+			{
+			break;	// out of space
+			}
+		}
+	b_updateSize(fcb);
+	if (position >= 0 && total < length)
+		{
+		b_unreserveBlocks(fcb, position + ((total > 0) ? total : 0), filled);
+		}
+	pthread_rwlock_unlock(b_fileLock(fcb->fi));
+
+	pthread_mutex_unlock(&fcb->lock);
+	return (total);
+	}
+
+// Copy count bytes at offIn of one file to offOut of another (or the same)
+// file without going through the caller, like copy_file_range. The data
+// moves COPY_CHUNK_BLOCKS at a time, and whole blocks go straight between
+// the block cache and a staging buffer in one LBA call per contiguous run.
+// Neither file position moves. Returns the bytes copied, which is short at
+// the end of the source, or -1.
+int b_copy_range (b_io_fd fdIn, off_t offIn, b_io_fd fdOut, off_t offOut, int count)
+	{
+	b_init();  //Initialize our system
+
+	if (count < 0 || offIn < 0 || offOut < 0)
+		{
+		return (-1);
+		}
+
+	// both FCBs and both files are locked, always in the same order so two
+	// copies between the same files cannot deadlock
+	b_io_fd first = (fdIn < fdOut) ? fdIn : fdOut;
+	b_io_fd second = (fdIn < fdOut) ? fdOut : fdIn;
+	b_fcb * fcbFirst = b_lockFCB(first);
+	if (fcbFirst == NULL)
+		{
+		return (-1);
+		}
+	b_fcb * fcbSecond = fcbFirst;
+	if (second != first)
+		{
+		fcbSecond = b_lockFCB(second);
+		if (fcbSecond == NULL)
+			{
+			pthread_mutex_unlock(&fcbFirst->lock);
+			return (-1);
+			}
+		}
+	b_fcb * src = (first == fdIn) ? fcbFirst : fcbSecond;
+	b_fcb * dst = (first == fdOut) ? fcbFirst : fcbSecond;
+
+	pthread_rwlock_t * srcLock = b_fileLock(src->fi);
+	pthread_rwlock_t * dstLock = b_fileLock(dst->fi);
+	if (srcLock == dstLock)
+		{
+		pthread_rwlock_wrlock(dstLock);
+		}
+	else if (srcLock < dstLock)
+		{
+		b_lockFileRead(src);
+		pthread_rwlock_wrlock(dstLock);
+		}
+	else
+		{
+		pthread_rwlock_wrlock(dstLock);
+		b_lockFileRead(src);
+		}
+
+	int srcBlock = src->current_block;
+	int srcIndex = src->index;
+	int dstBlock = dst->current_block;
+	int dstIndex = dst->index;
+
+	int copied = 0;
+	char * stage = allocBlockBuffer(COPY_CHUNK_BLOCKS * B_CHUNK_SIZE);
+	if (stage == NULL)
+		{
+		printf("Memory allocation failed for copy buffer\n");
+		copied = -1;
+		}
+	while (stage != NULL && copied < count)
+		{
+		int chunk = count - copied;
+		if (chunk > COPY_CHUNK_BLOCKS * B_CHUNK_SIZE)
+			{
+			chunk = COPY_CHUNK_BLOCKS * B_CHUNK_SIZE;
+			}
+
+		if (b_seekFCB(src, offIn + copied, SEEK_SET) < 0)
+			{
+			break;
+			}
+		int got = b_readFCB(src, stage, chunk);
+		if (got <= 0)
+			{
+			break;
+			}
+
+		if (b_seekFCB(dst, offOut + copied, SEEK_SET) < 0)
+			{
+			break;
+			}
+		int put = b_writeFCB(dst, stage, got);
+		if (put > 0)
+			{
+			copied += put;
+			}
+		if (put != got || got < chunk)
+			{
+			break;
+			}
+		}
+	b_updateSize(dst);
+	free(stage);
+
+	src->current_block = srcBlock;
+	src->index = srcIndex;
+	dst->current_block = dstBlock;
+	dst->index = dstIndex;
+
+	pthread_rwlock_unlock(dstLock);
+	if (srcLock != dstLock)
+		{
+		pthread_rwlock_unlock(srcLock);
+		}
+	if (fcbSecond != fcbFirst)
+		{
+		pthread_mutex_unlock(&fcbSecond->lock);
+		}
+	pthread_mutex_unlock(&fcbFirst->lock);
+	return (copied);
+	}
+
+// Create dest as a copy of the file src, like cp --reflink. No data is
+// copied: dest gets the block map of src and every block gains a reference
+// in the free space map, so cloning costs one directory entry whatever the
+// size of the file. Either file then copies a shared block on its first
+// write to it (see b_ownBlocks). Data still waiting in the buffer of an FCB
+// of src is not part of the clone, b_fsync it first.
+int b_clone (char * src, char * dest)
+	{
+	b_init();  //Initialize our system
+
+	char srcPath[LOCAL_PATH_MAX];
+	char destPath[LOCAL_PATH_MAX];
+	strncpy(srcPath, src, LOCAL_PATH_MAX - 1);
+	srcPath[LOCAL_PATH_MAX - 1] = '\0';
+	strncpy(destPath, dest, LOCAL_PATH_MAX - 1);
+	destPath[LOCAL_PATH_MAX - 1] = '\0';
+
+	parseInfo srcInfo;
+	parseInfo destInfo;
+	if (parsePath(srcPath, &srcInfo) != 0 || srcInfo.index < 0)
+		{
+		printf("File not found: %s\n", src);
+		return (-1);
+		}
+	if (parsePath(destPath, &destInfo) != 0 || destInfo.index != -1)
+		{
+		printf("Cannot create %s\n", dest);
+		return (-1);
+		}
+
+	de_struct * srcParent = srcInfo.parent;
+	de_struct * destParent = destInfo.parent;
+
+	lockDirectory(srcParent, 0);
+	int slot = findInDirectory(srcInfo.lastElementName, srcParent);
+	unlockDirectory(srcParent);
+	if (slot == -1)
+		{
+		printf("File not found: %s\n", src);
+		return (-1);
+		}
+	de_struct * entry = &srcParent[slot];
+
+	// holding the file lock for writing keeps writers of src, which may be
+	// about to write a block in place, out while its blocks become shared
+	pthread_rwlock_wrlock(b_fileLock(entry));
+	lockDirectoryPair(srcParent, destParent);
+
+	int result = -1;
+	int destSlot = -1;
+	if (findInDirectory(srcInfo.lastElementName, srcParent) != slot || entry->is_directory)
+		{
+		printf("Cannot clone %s\n", src);
+		}
+	else if (findInDirectory(destInfo.lastElementName, destParent) != -1)
+		{
+		printf("Cannot create %s\n", dest);
+		}
+	else
+		{
+		for (int i = 0; i < DIRECTORY_ENTRIES; i++)
+			{
+			if (destParent[i].file_name[0] == '\0')
+				{
+				destSlot = i;
+				break;
+				}
+			}
+		if (destSlot == -1)
+			{
+			printf("Parent directory is full, cannot create file\n");
+			}
+		}
+
+	if (destSlot != -1 && shareBlocks(entry->blocks_allocated, entry->blocks_count) == 0)
+		{
+		de_struct * clone = &destParent[destSlot];
+		*clone = *entry;
+		strcpy(clone->file_name, destInfo.lastElementName);
+		clone->date_created = getTime();
+		clone->date_modified = clone->date_created;
+
+		result = writeDirectoryEntry(destParent, destSlot);
+		if (result != 0)
+			{
+			freeBlocks(clone->blocks_allocated, clone->blocks_count);
+			memset(clone, 0, sizeof(de_struct));
+			}
+		}
+
+	unlockDirectoryPair(srcParent, destParent);
+	pthread_rwlock_unlock(b_fileLock(entry));
+	return (result);
+	}
+
+// Turn compression on or off for a file, or for the files and directories
+// created in a directory from now on (like chattr +c). A file can only
+// change while it is empty, its data is never rewritten the other way.
+int b_compress (char * path, int on)
+	{
+	b_init();  //Initialize our system
 
-		// check if file is open
-		if (fcbArray[fd].fi == NULL) {
-			return -1;  // File not open
+	char pathCopy[LOCAL_PATH_MAX];
+	strncpy(pathCopy, path, LOCAL_PATH_MAX - 1);
+	pathCopy[LOCAL_PATH_MAX - 1] = '\0';
+
+	parseInfo info;
+	if (parsePath(pathCopy, &info) != 0 || info.index < 0)
+		{
+		printf("File not found: %s\n", path);
+		return (-1);
+		}
+	de_struct * parent = info.parent;
+	lockDirectory(parent, 0);
+	int slot = findInDirectory(info.lastElementName, parent);
+	unlockDirectory(parent);
+	if (slot == -1)
+		{
+		printf("File not found: %s\n", path);
+		return (-1);
 		}
+	de_struct * entry = &parent[slot];
+	int flag = on ? DE_COMPRESS : 0;
 
-		// flush any remaining data from the buffer before closing file
-		if (fcbArray[fd].index > 0) {
-			// only write if the file was opened with write permissions
-			if ((fcbArray[fd].flags & O_WRONLY) || (fcbArray[fd].flags & O_RDWR)) {
-				// write to disk
-				if (LBAwrite(fcbArray[fd].buf, 1, fcbArray[fd].start_block + fcbArray[fd].current_block) != 1) {
-					printf("Error writing final buffer in b_close\n");
+	int result = -1;
+	if (entry->is_directory)
+		{
+		// new entries inherit the flag from the directory's own . entry,
+		// the entry in its parent is kept the same
+		de_struct * dir = loadDirectory(entry);
+		if (dir == NULL)
+			{
+			return (-1);
+			}
+		lockDirectoryPair(parent, dir);
+		if (findInDirectory(info.lastElementName, parent) != slot)
+			{
+			printf("File not found: %s\n", path);
+			}
+		else
+			{
+			entry->flags = (entry->flags & ~DE_COMPRESS) | flag;
+			dir[0].flags = (dir[0].flags & ~DE_COMPRESS) | flag;
+			result = writeDirectoryEntry(parent, slot);
+			if (result == 0 && dir != parent)
+				{
+				result = writeDirectoryEntry(dir, 0);
 				}
 			}
-			fcbArray[fd].buflen = 0;
+		unlockDirectoryPair(parent, dir);
+		return (result);
+		}
+
+	pthread_rwlock_wrlock(b_fileLock(entry));
+	lockDirectory(parent, 1);
+	if (findInDirectory(info.lastElementName, parent) != slot)
+		{
+		printf("File not found: %s\n", path);
+		}
+	else if ((entry->flags & DE_COMPRESS) == flag)
+		{
+		result = 0;
+		}
+	else if (entry->size != 0)
+		{
+		printf("Cannot change compression of %s, it is not empty\n", path);
+		}
+	else
+		{
+		entry->flags = (entry->flags & ~DE_COMPRESS) | flag;
+		result = writeDirectoryEntry(parent, slot);
+		}
+	unlockDirectory(parent);
+	pthread_rwlock_unlock(b_fileLock(entry));
+	return (result);
+	}
+
+// Interface to flush a file, its data, directory entry and the free space
+// map are on disk when this returns
+int b_fsync (b_io_fd fd)
+	{
+	b_fcb * fcb = b_lockFCB(fd);
+	if (fcb == NULL)
+		{
+		return (-1);
+		}
+
+	b_lockFileRead(fcb);
+	if (b_flushBuffer(fcb) != 0 || b_writeMeta(fcb) != 0)
+		{
+		pthread_rwlock_unlock(b_fileLock(fcb->fi));
+		pthread_mutex_unlock(&fcb->lock);
+		return (-1);
+		}
+
+	int blocks[2 * MAX_DE_BLOCK_COUNT + FS_BLOCK_COUNT];
+	int count = 0;
+	for (int i = 0; i < fcb->fi->blocks_count; i++)
+		{
+		int lba = b_blockToLBA(fcb, i);
+		if (lba >= 0)
+			{
+			blocks[count++] = lba;
+			}
+		}
+	pthread_rwlock_unlock(b_fileLock(fcb->fi));
+	for (int i = 0; i < fcb->parent_dir[0].blocks_count; i++)
+		{
+		blocks[count++] = fcb->parent_dir[0].blocks_allocated[i];
+		}
+	for (int i = FS_RESERVED_BLOCK; i < FS_FIRST_USABLE_BLOCK; i++)
+		{
+		blocks[count++] = i;
+		}
+	pthread_mutex_unlock(&fcb->lock);
+
+	return (cacheSyncBlocks(blocks, count));
+	}
+
+// Interface to Close the file
+int b_close (b_io_fd fd)
+	{
+
+		// check that fd is valid and the file is open
+		b_fcb * fcb = b_lockFCB(fd);
+		if (fcb == NULL)
+		{
+        return (-1);  					// invalid file descriptor
+    	}
+
+		// flush any remaining data from the buffer before closing file, the
+		// file is closed either way but the caller learns the data is lost
+		int result = 0;
+		b_lockFileRead(fcb);
+		if (b_flushBuffer(fcb) != 0) {
+			printf("Error writing final buffer in b_close\n");
+			result = -1;
+		}
+		if (b_writeMeta(fcb) != 0) {
+			printf("Error writing directory entry in b_close\n");
+			result = -1;
 		}
+		b_releaseChunkBlocks(fcb);
+		pthread_rwlock_unlock(b_fileLock(fcb->fi));
+		fcb->buflen = 0;
+		fcb->buf_block = -1;
 
-		free(fcbArray[fd].buf);
-		fcbArray[fd].buf = NULL;
-		fcbArray[fd].fi = NULL;
-		fcbArray[fd].parent_dir = NULL;
+		// closed before the lock is dropped, so a close of the same fd by
+		// another thread finds it closed and the fd is freed only once
+		b_clearFCB(fcb);
+		pthread_mutex_unlock(&fcb->lock);
+		b_pushFree(fd, fd);
 
-		return 0;
+		return (result);
 	}
@@ -15,13 +15,28 @@
 #ifndef _B_IO_H
 #define _B_IO_H
 #include <fcntl.h>
+#include <sys/uio.h>
 
 typedef int b_io_fd;
 
+// Most files that can be open at once, the FCB table grows up to this
+#ifndef B_MAX_FCBS
+#define B_MAX_FCBS 65536
+#endif
+
 b_io_fd b_open (char * filename, int flags);
 int b_read (b_io_fd fd, char * buffer, int count);
 int b_write (b_io_fd fd, char * buffer, int count);
 int b_seek (b_io_fd fd, off_t offset, int whence);
+int b_pread (b_io_fd fd, char * buffer, int count, off_t offset);
+int b_pwrite (b_io_fd fd, char * buffer, int count, off_t offset);
+int b_readv (b_io_fd fd, const struct iovec * iov, int iovcnt);
+int b_writev (b_io_fd fd, const struct iovec * iov, int iovcnt);
+int b_copy_range (b_io_fd fdIn, off_t offIn, b_io_fd fdOut, off_t offOut, int count);
+int b_clone (char * src, char * dest);
+int b_compress (char * path, int on);
+int b_truncate (b_io_fd fd, off_t length);
+int b_fsync (b_io_fd fd);
 int b_close (b_io_fd fd);
 
 #endif
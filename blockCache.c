@@ -0,0 +1,725 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: blockCache.c
+ *
+ * Description::
+ *   Block cache between the file system and the block device.
+ *   Frames are found through a hash table keyed by LBA and are
+ *   recycled with the CLOCK (second chance) policy.
+ *
+ *   In write-back mode a write only dirties the cached copy. A
+ *   flusher thread writes dirty blocks out in LBA order once they
+ *   are old enough or once too much of the cache is dirty, and
+ *   cacheSync/cacheSyncBlocks write them out on demand.
+ *
+ **************************************************************/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blockCache.h"
+#include "blockDevice.h"
+#include "ioQueue.h"
+
+// The longest run of blocks moved with one device read or write.
+#define CACHE_MAX_RUN 64
+
+// Frame states
+#define FRAME_FREE 0
+#define FRAME_LOADING 1 // claimed by a reader, the data is still on its way from disk
+#define FRAME_VALID 2
+
+typedef struct cacheFrame {
+    uint64_t lba;
+    int state;
+    int referenced;    // CLOCK second chance bit
+    int dirty;         // the cached copy is newer than the disk
+    int flushing;      // being written out, must stay in the cache until done
+    time_t dirtySince; // when the frame went from clean to dirty
+    int hashNext;      // next frame in the same hash bucket, -1 ends the chain
+} cacheFrame;
+
+static cacheFrame *frames = NULL;
+static char *frameData = NULL;
+static int frameCount = 0;
+static int *buckets = NULL;
+static uint64_t bucketMask = 0;
+static int clockHand = 0;
+static uint64_t cacheBlockSize = 0;
+
+static int writeBack = 0;
+static int dirtyCount = 0;
+
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled whenever a loading frame becomes valid or is dropped.
+static pthread_cond_t cacheLoaded = PTHREAD_COND_INITIALIZER;
+
+// Only one thread writes dirty frames out at a time, so an older copy of a
+// block can never reach the disk after a newer one.
+static pthread_mutex_t flushLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusherWake = PTHREAD_COND_INITIALIZER;
+static pthread_t flusherThread;
+static int flusherRunning = 0;
+static int flusherStop = 0;
+
+static uint64_t hashLBA(uint64_t lba) {
+    return (lba * 0x9E3779B97F4A7C15ULL >> 17) & bucketMask;
+}
+
+static char *dataOf(int frame) {
+    return frameData + (uint64_t)frame * cacheBlockSize;
+}
+
+static int findFrame(uint64_t lba) {
+    for (int f = buckets[hashLBA(lba)]; f != -1; f = frames[f].hashNext) {
+        if (frames[f].lba == lba) {
+            return f;
+        }
+    }
+    return -1;
+}
+
+static void unhashFrame(int frame) {
+    int *link = &buckets[hashLBA(frames[frame].lba)];
+    while (*link != -1) {
+        if (*link == frame) {
+            *link = frames[frame].hashNext;
+            break;
+        }
+        link = &frames[*link].hashNext;
+    }
+    frames[frame].state = FRAME_FREE;
+    frames[frame].hashNext = -1;
+}
+
+// Take a frame for the given LBA, evicting with the CLOCK policy. Frames
+// that are loading, dirty or being flushed are never evicted.
+// Returns -1 if no frame can be taken.
+static int claimFrame(uint64_t lba, int state) {
+    for (int scanned = 0; scanned < 2 * frameCount; scanned++) {
+        int f = clockHand;
+        clockHand = (clockHand + 1) % frameCount;
+
+        if (frames[f].state == FRAME_LOADING || frames[f].dirty || frames[f].flushing) {
+            continue;
+        }
+        if (frames[f].state == FRAME_VALID) {
+            if (frames[f].referenced) {
+                frames[f].referenced = 0;
+                continue;
+            }
+            unhashFrame(f);
+        }
+
+        uint64_t bucket = hashLBA(lba);
+        frames[f].lba = lba;
+        frames[f].state = state;
+        frames[f].referenced = 1;
+        frames[f].hashNext = buckets[bucket];
+        buckets[bucket] = f;
+        return f;
+    }
+    return -1;
+}
+
+static int compareFrameLBA(const void *a, const void *b) {
+    uint64_t lbaA = frames[*(const int *)a].lba;
+    uint64_t lbaB = frames[*(const int *)b].lba;
+    return (lbaA > lbaB) - (lbaA < lbaB);
+}
+
+// Write the given dirty frames to disk sorted by LBA, one device write per run
+// of consecutive blocks. Caller holds flushLock but not cacheLock.
+static int writeFrames(int *list, int count) {
+    int result = 0;
+    char *staging = allocBlockBuffer(CACHE_MAX_RUN * cacheBlockSize);
+    if (staging == NULL) {
+        printf("[BlockCache] Failed to allocate flush buffer\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&cacheLock);
+    qsort(list, count, sizeof(int), compareFrameLBA);
+
+    for (int i = 0; i < count;) {
+        // copy out a run of consecutive blocks and mark it clean, a write
+        // that lands while we are on disk dirties the frame again
+        int run = 0;
+        uint64_t first = frames[list[i]].lba;
+        while (i + run < count && run < CACHE_MAX_RUN && frames[list[i + run]].lba == first + run) {
+            int f = list[i + run];
+            memcpy(staging + run * cacheBlockSize, dataOf(f), cacheBlockSize);
+            frames[f].dirty = 0;
+            frames[f].flushing = 1;
+            dirtyCount--;
+            run++;
+        }
+        pthread_mutex_unlock(&cacheLock);
+
+        uint64_t written = deviceWrite(staging, run, first);
+
+        pthread_mutex_lock(&cacheLock);
+        for (int k = 0; k < run; k++) {
+            int f = list[i + k];
+            frames[f].flushing = 0;
+            if ((uint64_t)k >= written && !frames[f].dirty) {
+                // keep it dirty so the data is not lost
+                frames[f].dirty = 1;
+                frames[f].dirtySince = time(NULL);
+                dirtyCount++;
+            }
+        }
+        if (written != (uint64_t)run) {
+            printf("[BlockCache] Error writing back blocks %lu-%lu\n", (unsigned long)first,
+                   (unsigned long)(first + run - 1));
+            result = -1;
+        }
+        i += run;
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    free(staging);
+    return result;
+}
+
+// Write out every dirty frame that went dirty at or before the given time.
+static int flushDirty(time_t dirtiedBefore) {
+    pthread_mutex_lock(&flushLock);
+
+    pthread_mutex_lock(&cacheLock);
+    int *list = malloc((dirtyCount + 1) * sizeof(int));
+    int count = 0;
+    if (list != NULL) {
+        for (int f = 0; f < frameCount; f++) {
+            if (frames[f].dirty && frames[f].dirtySince <= dirtiedBefore) {
+                list[count++] = f;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    int result = (list == NULL) ? -1 : writeFrames(list, count);
+    free(list);
+
+    pthread_mutex_unlock(&flushLock);
+    return result;
+}
+
+// Body of the flusher thread. Wakes up every CACHE_FLUSH_INTERVAL seconds,
+// or when writers push the dirty count over the background threshold.
+static void *flusherMain(void *arg) {
+    pthread_mutex_lock(&cacheLock);
+    while (!flusherStop) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += CACHE_FLUSH_INTERVAL;
+        pthread_cond_timedwait(&flusherWake, &cacheLock, &wake);
+        if (flusherStop) {
+            break;
+        }
+
+        time_t dirtiedBefore = time(NULL) - CACHE_DIRTY_EXPIRE;
+        if (dirtyCount * 100 >= frameCount * CACHE_DIRTY_BACKGROUND) {
+            dirtiedBefore = time(NULL);
+        }
+        pthread_mutex_unlock(&cacheLock);
+
+        flushDirty(dirtiedBefore);
+
+        pthread_mutex_lock(&cacheLock);
+    }
+    pthread_mutex_unlock(&cacheLock);
+    return NULL;
+}
+
+int initBlockCache(uint64_t budgetBytes, uint64_t blockSize) {
+    exitBlockCache();
+
+    cacheBlockSize = blockSize;
+    frameCount = budgetBytes / blockSize;
+    if (frameCount < CACHE_MAX_RUN) {
+        frameCount = CACHE_MAX_RUN;
+    }
+
+    uint64_t bucketCount = 1;
+    while (bucketCount < (uint64_t)frameCount) {
+        bucketCount <<= 1;
+    }
+    bucketMask = bucketCount - 1;
+
+    frames = malloc(frameCount * sizeof(cacheFrame));
+    frameData = allocBlockBuffer((uint64_t)frameCount * blockSize);
+    buckets = malloc(bucketCount * sizeof(int));
+    if (frames == NULL || frameData == NULL || buckets == NULL) {
+        printf("[BlockCache] Failed to allocate %d cache frames\n", frameCount);
+        exitBlockCache();
+        return -1;
+    }
+
+    for (int i = 0; i < frameCount; i++) {
+        frames[i].state = FRAME_FREE;
+        frames[i].referenced = 0;
+        frames[i].dirty = 0;
+        frames[i].flushing = 0;
+        frames[i].hashNext = -1;
+    }
+    for (uint64_t i = 0; i < bucketCount; i++) {
+        buckets[i] = -1;
+    }
+    clockHand = 0;
+    dirtyCount = 0;
+
+    writeBack = CACHE_WRITE_BACK;
+    if (writeBack) {
+        flusherStop = 0;
+        if (pthread_create(&flusherThread, NULL, flusherMain, NULL) != 0) {
+            printf("[BlockCache] Failed to start flusher, falling back to write-through\n");
+            writeBack = 0;
+        } else {
+            flusherRunning = 1;
+        }
+    }
+
+    return 0;
+}
+
+void exitBlockCache() {
+    if (flusherRunning) {
+        cacheSync();
+
+        pthread_mutex_lock(&cacheLock);
+        flusherStop = 1;
+        pthread_cond_signal(&flusherWake);
+        pthread_mutex_unlock(&cacheLock);
+        pthread_join(flusherThread, NULL);
+        flusherRunning = 0;
+    }
+    writeBack = 0;
+
+    free(frames);
+    free(frameData);
+    free(buckets);
+    frames = NULL;
+    frameData = NULL;
+    buckets = NULL;
+    frameCount = 0;
+}
+
+uint64_t cacheRead(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    if (frames == NULL) {
+        return deviceRead(buffer, lbaCount, lbaPosition);
+    }
+
+    char *dest = buffer;
+    uint64_t done = 0;
+
+    pthread_mutex_lock(&cacheLock);
+    while (done < lbaCount) {
+        int f = findFrame(lbaPosition + done);
+        if (f != -1 && frames[f].state == FRAME_LOADING) {
+            // someone else is reading this block already, wait for it
+            pthread_cond_wait(&cacheLoaded, &cacheLock);
+            continue;
+        }
+        if (f != -1) {
+            memcpy(dest + done * cacheBlockSize, dataOf(f), cacheBlockSize);
+            frames[f].referenced = 1;
+            done++;
+            continue;
+        }
+
+        // a device that maps its blocks hands out the ones we miss directly,
+        // there is no read to wait for and no point caching them twice
+        int missing = 0;
+        while (done + missing < lbaCount && missing < CACHE_MAX_RUN
+               && findFrame(lbaPosition + done + missing) == -1) {
+            missing++;
+        }
+        char *mapped = deviceMap(missing, lbaPosition + done);
+        if (mapped != NULL) {
+            memcpy(dest + done * cacheBlockSize, mapped, missing * cacheBlockSize);
+            done += missing;
+            continue;
+        }
+
+        // claim frames for the run of blocks that are missing so they can
+        // come in with a single device read
+        int run[CACHE_MAX_RUN];
+        int runLength = 0;
+        while (done + runLength < lbaCount && runLength < CACHE_MAX_RUN
+               && findFrame(lbaPosition + done + runLength) == -1) {
+            run[runLength] = claimFrame(lbaPosition + done + runLength, FRAME_LOADING);
+            runLength++;
+        }
+
+        pthread_mutex_unlock(&cacheLock);
+        uint64_t got = deviceRead(dest + done * cacheBlockSize, runLength, lbaPosition + done);
+        pthread_mutex_lock(&cacheLock);
+
+        for (int i = 0; i < runLength; i++) {
+            if (run[i] == -1) {
+                continue;
+            }
+            if (got == (uint64_t)runLength) {
+                memcpy(dataOf(run[i]), dest + (done + i) * cacheBlockSize, cacheBlockSize);
+                frames[run[i]].state = FRAME_VALID;
+            } else {
+                unhashFrame(run[i]);
+            }
+        }
+        pthread_cond_broadcast(&cacheLoaded);
+
+        if (got != (uint64_t)runLength) {
+            break;
+        }
+        done += runLength;
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    return done;
+}
+
+// Put new contents in a frame, dirtying it in write-back mode. Caller holds cacheLock.
+static void storeBlock(int frame, const char *src) {
+    memcpy(dataOf(frame), src, cacheBlockSize);
+    frames[frame].referenced = 1;
+    if (writeBack && !frames[frame].dirty) {
+        frames[frame].dirty = 1;
+        frames[frame].dirtySince = time(NULL);
+        dirtyCount++;
+    }
+}
+
+uint64_t cacheWrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    if (frames == NULL) {
+        return deviceWrite(buffer, lbaCount, lbaPosition);
+    }
+
+    char *src = buffer;
+    uint64_t written = 0;
+    int overBackground = 0;
+    int overLimit = 0;
+
+    // update or add the cached copy of every block
+    pthread_mutex_lock(&cacheLock);
+    for (uint64_t i = 0; i < lbaCount; i++) {
+        int f = findFrame(lbaPosition + i);
+        while (f != -1 && frames[f].state == FRAME_LOADING) {
+            pthread_cond_wait(&cacheLoaded, &cacheLock);
+            f = findFrame(lbaPosition + i);
+        }
+        if (f == -1) {
+            f = claimFrame(lbaPosition + i, FRAME_VALID);
+        }
+
+        if (f == -1) {
+            // nothing can be evicted right now, write this block straight through
+            pthread_mutex_unlock(&cacheLock);
+            uint64_t ok = deviceWrite(src + i * cacheBlockSize, 1, lbaPosition + i);
+            pthread_mutex_lock(&cacheLock);
+            if (ok != 1) {
+                break;
+            }
+            written++;
+            continue;
+        }
+
+        storeBlock(f, src + i * cacheBlockSize);
+        written++;
+    }
+    if (writeBack) {
+        overBackground = dirtyCount * 100 >= frameCount * CACHE_DIRTY_BACKGROUND;
+        overLimit = dirtyCount * 100 >= frameCount * CACHE_DIRTY_LIMIT;
+        if (overBackground) {
+            pthread_cond_signal(&flusherWake);
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    if (writeBack) {
+        // a writer that gets too far ahead of the disk has to help flush
+        if (overLimit) {
+            flushDirty(time(NULL));
+        }
+        return written;
+    }
+
+    // write-through
+    uint64_t onDisk = deviceWrite(buffer, lbaCount, lbaPosition);
+    if (onDisk != lbaCount) {
+        // the disk does not hold what we cached, forget it
+        pthread_mutex_lock(&cacheLock);
+        for (uint64_t i = onDisk; i < lbaCount; i++) {
+            int f = findFrame(lbaPosition + i);
+            if (f != -1 && frames[f].state == FRAME_VALID) {
+                unhashFrame(f);
+            }
+        }
+        pthread_mutex_unlock(&cacheLock);
+    }
+    return onDisk;
+}
+
+uint64_t cacheReadBlocks(void *buffer, int *lbaList, int count) {
+    char *dest = buffer;
+    ioQueue queue;
+    ioQueueInit(&queue, cacheBlockSize);
+    int *claimed = malloc(count * sizeof(int)); // frame each queued read fills, -1 for none
+    int *later = malloc(count * sizeof(int));   // blocks someone else is loading
+    int laterCount = 0;
+    int result = 0;
+    if (claimed == NULL || later == NULL) {
+        free(claimed);
+        free(later);
+        return 0;
+    }
+
+    // take what is cached, queue the rest. A block that is loading is
+    // read once the queue is done, waiting here while holding claimed
+    // frames could deadlock with another batch.
+    pthread_mutex_lock(&cacheLock);
+    for (int i = 0; i < count; i++) {
+        char *slot = dest + (uint64_t)i * cacheBlockSize;
+        int f = (frames != NULL) ? findFrame(lbaList[i]) : -1;
+        char *mapped;
+        if (f != -1 && frames[f].state == FRAME_LOADING) {
+            later[laterCount++] = i;
+        } else if (f != -1) {
+            memcpy(slot, dataOf(f), cacheBlockSize);
+            frames[f].referenced = 1;
+        } else if ((mapped = deviceMap(1, lbaList[i])) != NULL) {
+            memcpy(slot, mapped, cacheBlockSize);
+        } else {
+            claimed[queue.count] = (frames != NULL) ? claimFrame(lbaList[i], FRAME_LOADING) : -1;
+            if (ioQueueAdd(&queue, 0, slot, 1, lbaList[i]) != 0) {
+                if (claimed[queue.count] != -1) {
+                    unhashFrame(claimed[queue.count]);
+                }
+                result = -1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    if (ioQueueDispatch(&queue) != 0) {
+        result = -1;
+    }
+
+    pthread_mutex_lock(&cacheLock);
+    for (int k = 0; k < queue.count; k++) {
+        if (claimed[k] == -1) {
+            continue;
+        }
+        if (queue.requests[k].done == 1) {
+            memcpy(dataOf(claimed[k]), queue.requests[k].buffer, cacheBlockSize);
+            frames[claimed[k]].state = FRAME_VALID;
+        } else {
+            unhashFrame(claimed[k]);
+        }
+    }
+    pthread_cond_broadcast(&cacheLoaded);
+    pthread_mutex_unlock(&cacheLock);
+
+    for (int k = 0; k < laterCount && result == 0; k++) {
+        int i = later[k];
+        if (cacheRead(dest + (uint64_t)i * cacheBlockSize, 1, lbaList[i]) != 1) {
+            result = -1;
+        }
+    }
+
+    ioQueueFree(&queue);
+    free(claimed);
+    free(later);
+    return (result == 0) ? count : 0;
+}
+
+uint64_t cacheWriteBlocks(void *buffer, int *lbaList, int count) {
+    char *src = buffer;
+    ioQueue queue;
+    ioQueueInit(&queue, cacheBlockSize);
+    int overLimit = 0;
+    int result = 0;
+
+    // cache every block, queue the ones that have to reach the disk now:
+    // all of them in write-through mode, otherwise those without a frame
+    pthread_mutex_lock(&cacheLock);
+    for (int i = 0; i < count; i++) {
+        char *block = src + (uint64_t)i * cacheBlockSize;
+        int f = -1;
+        if (frames != NULL) {
+            f = findFrame(lbaList[i]);
+            while (f != -1 && frames[f].state == FRAME_LOADING) {
+                pthread_cond_wait(&cacheLoaded, &cacheLock);
+                f = findFrame(lbaList[i]);
+            }
+            if (f == -1) {
+                f = claimFrame(lbaList[i], FRAME_VALID);
+            }
+            if (f != -1) {
+                storeBlock(f, block);
+            }
+        }
+        if ((f == -1 || !writeBack) && ioQueueAdd(&queue, 1, block, 1, lbaList[i]) != 0) {
+            result = -1;
+            break;
+        }
+    }
+    if (writeBack) {
+        overLimit = dirtyCount * 100 >= frameCount * CACHE_DIRTY_LIMIT;
+        if (dirtyCount * 100 >= frameCount * CACHE_DIRTY_BACKGROUND) {
+            pthread_cond_signal(&flusherWake);
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    if (ioQueueDispatch(&queue) != 0) {
+        result = -1;
+        // the disk does not hold what we cached, forget it
+        pthread_mutex_lock(&cacheLock);
+        for (int k = 0; k < queue.count && frames != NULL; k++) {
+            int f = findFrame(queue.requests[k].lba);
+            if (queue.requests[k].done != 1 && f != -1 && frames[f].state == FRAME_VALID && !frames[f].dirty) {
+                unhashFrame(f);
+            }
+        }
+        pthread_mutex_unlock(&cacheLock);
+    }
+    ioQueueFree(&queue);
+
+    if (overLimit) {
+        flushDirty(time(NULL));
+    }
+    return (result == 0) ? count : 0;
+}
+
+static int compareLBA(const void *a, const void *b) {
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+int cacheDiscardBlocks(int *lbaList, int count) {
+    int *sorted = malloc((count + 1) * sizeof(int));
+    int *kept = malloc((count + 1) * sizeof(int)); // blocks the device did not drop
+    int keptCount = 0;
+    if (sorted == NULL || kept == NULL) {
+        free(sorted);
+        free(kept);
+        return -1;
+    }
+    memcpy(sorted, lbaList, count * sizeof(int));
+    qsort(sorted, count, sizeof(int), compareLBA);
+
+    // no dirty copy of these blocks may be written out once they are dropped
+    pthread_mutex_lock(&flushLock);
+    for (int i = 0; i < count;) {
+        int run = 1;
+        while (i + run < count && sorted[i + run] == sorted[i] + run) {
+            run++;
+        }
+        if (deviceDiscard(run, sorted[i]) != 0) {
+            memcpy(kept + keptCount, sorted + i, run * sizeof(int));
+            keptCount += run;
+        }
+        i += run;
+    }
+
+    // forget the cached copies of what was dropped, a frame that was
+    // loading meanwhile may hold the old contents
+    pthread_mutex_lock(&cacheLock);
+    for (int i = 0, k = 0; i < count && frames != NULL; i++) {
+        while (k < keptCount && kept[k] < sorted[i]) {
+            k++;
+        }
+        if (k < keptCount && kept[k] == sorted[i]) {
+            continue;
+        }
+        int f = findFrame(sorted[i]);
+        while (f != -1 && frames[f].state == FRAME_LOADING) {
+            pthread_cond_wait(&cacheLoaded, &cacheLock);
+            f = findFrame(sorted[i]);
+        }
+        if (f == -1) {
+            continue;
+        }
+        if (frames[f].dirty) {
+            frames[f].dirty = 0;
+            dirtyCount--;
+        }
+        unhashFrame(f);
+    }
+    pthread_mutex_unlock(&cacheLock);
+    pthread_mutex_unlock(&flushLock);
+
+    // the rest get zeros written the usual way
+    int result = 0;
+    if (keptCount > 0) {
+        char *zeroes = calloc(keptCount, cacheBlockSize);
+        if (zeroes == NULL || cacheWriteBlocks(zeroes, kept, keptCount) != (uint64_t)keptCount) {
+            result = -1;
+        }
+        free(zeroes);
+    }
+    free(sorted);
+    free(kept);
+    return result;
+}
+
+int cacheSync() {
+    int result = 0;
+    if (frames != NULL && writeBack) {
+        result = flushDirty(time(NULL));
+    }
+    // the blocks are written, now make the device keep them
+    if (deviceFlush() != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+int cacheSyncBlocks(int *lbaList, int count) {
+    if (frames == NULL || !writeBack || count <= 0) {
+        return deviceFlush();
+    }
+
+    pthread_mutex_lock(&flushLock);
+
+    pthread_mutex_lock(&cacheLock);
+    int *list = malloc(count * sizeof(int));
+    int found = 0;
+    if (list != NULL) {
+        for (int i = 0; i < count; i++) {
+            int f = findFrame(lbaList[i]);
+            if (f == -1 || !frames[f].dirty) {
+                continue;
+            }
+            // the same block may be listed twice
+            int seen = 0;
+            for (int k = 0; k < found && !seen; k++) {
+                seen = (list[k] == f);
+            }
+            if (!seen) {
+                list[found++] = f;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    int result = (list == NULL) ? -1 : writeFrames(list, found);
+    free(list);
+
+    pthread_mutex_unlock(&flushLock);
+    if (deviceFlush() != 0) {
+        result = -1;
+    }
+    return result;
+}
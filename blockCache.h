@@ -0,0 +1,59 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: blockCache.h
+ *
+ * Description::
+ *	Interface of the block cache shared by every layer above the
+ *	block device. File data, directories, the free space map and the
+ *	VCB are all read and written through it. Writes are held in the
+ *	cache until the flusher thread or a sync writes them out.
+ *
+ **************************************************************/
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "fsLow.h"
+
+// Memory used for cached blocks unless something else is passed to initBlockCache.
+#ifndef CACHE_DEFAULT_BUDGET
+#define CACHE_DEFAULT_BUDGET (2 * 1024 * 1024)
+#endif
+
+// Write-back mode, set to 0 to write every block through to disk.
+#ifndef CACHE_WRITE_BACK
+#define CACHE_WRITE_BACK 1
+#endif
+#define CACHE_FLUSH_INTERVAL 1    // seconds between flusher wake ups
+#define CACHE_DIRTY_EXPIRE 5      // seconds a block may stay dirty before the flusher writes it
+#define CACHE_DIRTY_BACKGROUND 25 // percent of the cache dirty that wakes the flusher early
+#define CACHE_DIRTY_LIMIT 50      // percent of the cache dirty that makes writers flush themselves
+
+int initBlockCache(uint64_t budgetBytes, uint64_t blockSize); // Set up the cache, returns 0 on success.
+void exitBlockCache();                                         // Write back dirty blocks and release the cache.
+
+// Same contract as LBAread/LBAwrite, returns the number of blocks transferred.
+uint64_t cacheRead(void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+uint64_t cacheWrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+
+// The same for a list of blocks anywhere on disk, buffer holds them one after the
+// other. The device calls for the blocks that are not cached are sorted and
+// merged (see ioQueue). Returns count if every block was transferred, 0 otherwise.
+uint64_t cacheReadBlocks(void *buffer, int *lbaList, int count);
+uint64_t cacheWriteBlocks(void *buffer, int *lbaList, int count);
+
+// The listed blocks are free: drop them from the cache and discard them on the
+// device so they read as zeros, writing zeros to those the device cannot
+// discard. Returns 0 on success, -1 if some may still hold their old contents.
+int cacheDiscardBlocks(int *lbaList, int count);
+
+int cacheSync();                             // Write every dirty block to disk and flush the device.
+int cacheSyncBlocks(int *lbaList, int count); // Write the listed blocks to disk if they are dirty, then flush the device.
+
+#endif
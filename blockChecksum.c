@@ -0,0 +1,337 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: blockChecksum.c
+ *
+ * Description::
+ *   Catches blocks that come back from the disk different from how
+ *   they were written. The table holds one CRC32C per block of the
+ *   volume, 0 for a block never written since it was formatted. It
+ *   lives in a contiguous run of blocks recorded in the VCB, is kept
+ *   in memory while the volume is open, and the table blocks that
+ *   changed are written out on every device flush, so the table is
+ *   as durable as the data it describes. The table blocks themselves
+ *   are not checksummed.
+ *
+ *   Blocks reach the disk before the table entries describing them,
+ *   so after a crash the table can be behind. The VCB records whether
+ *   the volume was unmounted cleanly, and if it was not the table is
+ *   brought up to date before the volume is used: a block that does
+ *   not match then is taken to have been written after the table,
+ *   not to have been corrupted.
+ *
+ *   Which blocks are metadata is only known in memory: the VCB and
+ *   free space map, and the directory blocks marked as directories
+ *   are created and loaded.
+ *
+ **************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blockChecksum.h"
+#include "blockDevice.h"
+#include "crc32c.h"
+
+#define CHECKSUM_BATCH 64              // blocks checksummed per crc32cBlocks call
+#define CHECKSUM_BENCH_LIMIT (256 << 20) // bytes read by each benchmark pass at most
+#define CHECKSUM_BENCH_ROUNDS 3
+
+static uint32_t *table = NULL;         // tableBlocks blocks, as on disk
+static unsigned char *tableDirty = NULL; // one per table block, changed since the last flush
+static unsigned char *metadata = NULL;   // one per volume block
+static uint64_t tableStart = 0;
+static uint64_t tableBlocks = 0;
+static uint64_t volumeBlocks = 0;
+static uint64_t checksumBlockSize = 0;
+static int verifyData = CHECKSUM_VERIFY_DATA;
+static int rebuilding = 0;  // checksumRebuild is running, mismatches are stale entries
+static uint64_t rebuilt = 0; // entries it replaced
+static pthread_mutex_t flushLock = PTHREAD_MUTEX_INITIALIZER;
+
+// 0 means never written, a block whose CRC happens to be 0 is recorded as 1
+static uint32_t stampOf(uint32_t crc) {
+    return (crc != 0) ? crc : 1;
+}
+
+static int inTable(uint64_t lba) {
+    return lba >= tableStart && lba < tableStart + tableBlocks;
+}
+
+uint64_t checksumTableBlocks(uint64_t blockCount, uint64_t blockSize) {
+    return (blockCount * sizeof(uint32_t) + blockSize - 1) / blockSize;
+}
+
+int checksumOpen(uint64_t start, uint64_t blocks, uint64_t blockCount, uint64_t blockSize, int create) {
+    checksumClose();
+    if (blocks < checksumTableBlocks(blockCount, blockSize)) {
+        printf("[checksum] Table of %llu blocks is too small for the volume\n", (ull_t)blocks);
+        return -1;
+    }
+
+    uint32_t *loaded = allocBlockBuffer(blocks * blockSize);
+    tableDirty = calloc(blocks, 1);
+    metadata = calloc(blockCount, 1);
+    if (loaded == NULL || tableDirty == NULL || metadata == NULL) {
+        printf("[checksum] Failed to allocate the checksum table\n");
+        free(loaded);
+        free(tableDirty);
+        free(metadata);
+        tableDirty = NULL;
+        metadata = NULL;
+        return -1;
+    }
+
+    if (create) {
+        memset(loaded, 0, blocks * blockSize);
+        memset(tableDirty, 1, blocks);
+    } else if (deviceRead(loaded, blocks, start) != blocks) {
+        printf("[checksum] Failed to read the checksum table\n");
+        free(loaded);
+        free(tableDirty);
+        free(metadata);
+        tableDirty = NULL;
+        metadata = NULL;
+        return -1;
+    }
+
+    tableStart = start;
+    tableBlocks = blocks;
+    volumeBlocks = blockCount;
+    checksumBlockSize = blockSize;
+    table = loaded;
+    return 0;
+}
+
+void checksumClose() {
+    free(table);
+    free(tableDirty);
+    free(metadata);
+    table = NULL;
+    tableDirty = NULL;
+    metadata = NULL;
+    tableBlocks = 0;
+}
+
+void checksumMarkMetadata(int *lbaList, int count) {
+    for (int i = 0; metadata != NULL && i < count; i++) {
+        if (lbaList[i] >= 0 && (uint64_t)lbaList[i] < volumeBlocks) {
+            metadata[lbaList[i]] = 1;
+        }
+    }
+}
+
+void checksumMarkMetadataRange(uint64_t lbaPosition, uint64_t lbaCount) {
+    for (uint64_t i = 0; metadata != NULL && i < lbaCount && lbaPosition + i < volumeBlocks; i++) {
+        metadata[lbaPosition + i] = 1;
+    }
+}
+
+void checksumVerifyData(int on) {
+    verifyData = on;
+}
+
+void checksumStamp(const void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    if (table == NULL) {
+        return;
+    }
+    uint32_t crcs[CHECKSUM_BATCH];
+    for (uint64_t done = 0; done < lbaCount; done += CHECKSUM_BATCH) {
+        uint64_t count = (lbaCount - done < CHECKSUM_BATCH) ? lbaCount - done : CHECKSUM_BATCH;
+        crc32cBlocks((const char *)buffer + done * checksumBlockSize, checksumBlockSize, count, crcs);
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t lba = lbaPosition + done + i;
+            if (lba >= volumeBlocks || inTable(lba)) {
+                continue;
+            }
+            __atomic_store_n(&table[lba], stampOf(crcs[i]), __ATOMIC_RELAXED);
+            __atomic_store_n(&tableDirty[lba * sizeof(uint32_t) / checksumBlockSize], 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+uint64_t checksumVerify(const void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    if (table == NULL) {
+        return lbaCount;
+    }
+    uint32_t crcs[CHECKSUM_BATCH];
+    for (uint64_t done = 0; done < lbaCount; done += CHECKSUM_BATCH) {
+        uint64_t count = (lbaCount - done < CHECKSUM_BATCH) ? lbaCount - done : CHECKSUM_BATCH;
+
+        // only pay for the checksums if a block of the batch is checked
+        int check = 0;
+        for (uint64_t i = 0; i < count && !check; i++) {
+            uint64_t lba = lbaPosition + done + i;
+            check = lba < volumeBlocks && !inTable(lba) && (verifyData || metadata[lba]) &&
+                    __atomic_load_n(&table[lba], __ATOMIC_RELAXED) != 0;
+        }
+        if (!check) {
+            continue;
+        }
+
+        crc32cBlocks((const char *)buffer + done * checksumBlockSize, checksumBlockSize, count, crcs);
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t lba = lbaPosition + done + i;
+            if (lba >= volumeBlocks || inTable(lba) || !(verifyData || metadata[lba])) {
+                continue;
+            }
+            uint32_t stored = __atomic_load_n(&table[lba], __ATOMIC_RELAXED);
+            if (stored != 0 && stored != stampOf(crcs[i]) && rebuilding) {
+                __atomic_store_n(&table[lba], stampOf(crcs[i]), __ATOMIC_RELAXED);
+                __atomic_store_n(&tableDirty[lba * sizeof(uint32_t) / checksumBlockSize], 1, __ATOMIC_RELEASE);
+                rebuilt++;
+            } else if (stored != 0 && stored != stampOf(crcs[i])) {
+                printf("[checksum] Block %llu is corrupt (checksum %08x, expected %08x)\n", (ull_t)lba,
+                       stampOf(crcs[i]), stored);
+                return done + i;
+            }
+        }
+    }
+    return lbaCount;
+}
+
+int checksumFlush() {
+    if (table == NULL) {
+        return 0;
+    }
+    int result = 0;
+    pthread_mutex_lock(&flushLock);
+    for (uint64_t b = 0; b < tableBlocks;) {
+        if (!__atomic_exchange_n(&tableDirty[b], 0, __ATOMIC_ACQUIRE)) {
+            b++;
+            continue;
+        }
+        // one write for the run of changed table blocks
+        uint64_t run = 1;
+        while (b + run < tableBlocks && __atomic_exchange_n(&tableDirty[b + run], 0, __ATOMIC_ACQUIRE)) {
+            run++;
+        }
+        char *at = (char *)table + b * checksumBlockSize;
+        if (deviceWrite(at, run, tableStart + b) != run) {
+            printf("[checksum] Failed to write checksum table blocks %llu-%llu\n", (ull_t)(tableStart + b),
+                   (ull_t)(tableStart + b + run - 1));
+            memset(tableDirty + b, 1, run);
+            result = -1;
+        }
+        b += run;
+    }
+    pthread_mutex_unlock(&flushLock);
+    return result;
+}
+
+int checksumRebuild() {
+    if (table == NULL) {
+        return 0;
+    }
+    char *buffer = allocBlockBuffer(CHECKSUM_BATCH * checksumBlockSize);
+    if (buffer == NULL) {
+        printf("[checksum] Failed to allocate the rebuild buffer\n");
+        return -1;
+    }
+
+    // every block read is checked and its entry replaced if it does not match
+    int savedVerify = verifyData;
+    verifyData = 1;
+    rebuilding = 1;
+    rebuilt = 0;
+    int result = 0;
+    for (uint64_t lba = 0; lba < volumeBlocks; lba += CHECKSUM_BATCH) {
+        uint64_t count = (volumeBlocks - lba < CHECKSUM_BATCH) ? volumeBlocks - lba : CHECKSUM_BATCH;
+
+        // blocks never written since the format have nothing to be out of date
+        int stamped = 0;
+        for (uint64_t i = 0; i < count && !stamped; i++) {
+            stamped = !inTable(lba + i) && table[lba + i] != 0;
+        }
+        if (stamped && deviceRead(buffer, count, lba) != count) {
+            printf("[checksum] Failed to read blocks %llu-%llu\n", (ull_t)lba, (ull_t)(lba + count - 1));
+            result = -1;
+            break;
+        }
+    }
+    rebuilding = 0;
+    verifyData = savedVerify;
+    free(buffer);
+    return (result == 0) ? (int)rebuilt : -1;
+}
+
+static double secondsSince(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// One sequential pass over the first blocks of the volume, checksumming
+// every block if verify is set. Returns the seconds taken, -1 on error.
+static double benchmarkPass(char *buffer, uint64_t blocks, int verify) {
+    uint32_t crcs[CHECKSUM_BATCH];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t lba = 0; lba < blocks; lba += CHECKSUM_BATCH) {
+        uint64_t count = (blocks - lba < CHECKSUM_BATCH) ? blocks - lba : CHECKSUM_BATCH;
+        if (deviceRead(buffer, count, lba) != count) {
+            return -1;
+        }
+        if (verify) {
+            crc32cBlocks(buffer, checksumBlockSize, count, crcs);
+        }
+    }
+    return secondsSince(&start);
+}
+
+int checksumBenchmark() {
+    if (table == NULL) {
+        printf("[checksum] The volume has no checksum table\n");
+        return -1;
+    }
+    uint64_t blocks = volumeBlocks;
+    if (blocks * checksumBlockSize > CHECKSUM_BENCH_LIMIT) {
+        blocks = CHECKSUM_BENCH_LIMIT / checksumBlockSize;
+    }
+    char *buffer = allocBlockBuffer(CHECKSUM_BATCH * checksumBlockSize);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    // data blocks are left to the benchmark, so the plain pass does no checksums
+    int savedVerify = verifyData;
+    verifyData = 0;
+    double plain = -1;
+    double checked = -1;
+    for (int round = 0; round < CHECKSUM_BENCH_ROUNDS; round++) {
+        double p = benchmarkPass(buffer, blocks, 0);
+        double c = benchmarkPass(buffer, blocks, 1);
+        if (p < 0 || c < 0) {
+            plain = checked = -1;
+            break;
+        }
+        if (plain < 0 || p < plain) {
+            plain = p;
+        }
+        if (checked < 0 || c < checked) {
+            checked = c;
+        }
+    }
+    verifyData = savedVerify;
+    free(buffer);
+
+    if (plain <= 0 || checked <= 0) {
+        printf("[checksum] Benchmark read failed\n");
+        return -1;
+    }
+    double megabytes = blocks * checksumBlockSize / 1e6;
+    printf("Sequential read of %.1f MB, best of %d, crc32c %s\n", megabytes, CHECKSUM_BENCH_ROUNDS,
+           crc32cImplementation());
+    printf("  without checksums  %8.1f MB/s\n", megabytes / plain);
+    printf("  with checksums     %8.1f MB/s  (%+.1f%%)\n", megabytes / checked,
+           (checked - plain) / plain * 100);
+    return 0;
+}
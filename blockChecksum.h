@@ -0,0 +1,60 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: blockChecksum.h
+ *
+ * Description::
+ *	Per block CRC32C checksums kept in a table on the volume. Every
+ *	block written to the device gets its checksum recorded, blocks
+ *	read back are checked against it: metadata always, file data
+ *	when CHECKSUM_VERIFY_DATA is set.
+ *
+ **************************************************************/
+
+#ifndef BLOCKCHECKSUM_H
+#define BLOCKCHECKSUM_H
+
+#include "fsLow.h"
+
+// Check file data on every read too, not only metadata.
+#ifndef CHECKSUM_VERIFY_DATA
+#define CHECKSUM_VERIFY_DATA 0
+#endif
+
+// Blocks the table of a volume of blockCount blocks takes.
+uint64_t checksumTableBlocks(uint64_t blockCount, uint64_t blockSize);
+
+// Start checking the volume with the table at tableStart, a new all empty
+// table if create is set, otherwise the one on disk. Returns 0 on success.
+int checksumOpen(uint64_t tableStart, uint64_t tableBlocks, uint64_t blockCount, uint64_t blockSize,
+                 int create);
+void checksumClose();
+
+// Read every block that has a checksum and replace the checksums that do not
+// match, for a volume that was not unmounted cleanly. Returns how many were
+// out of date, -1 if the volume could not be read.
+int checksumRebuild();
+
+// The listed blocks hold metadata, check them on every read.
+void checksumMarkMetadata(int *lbaList, int count);
+void checksumMarkMetadataRange(uint64_t lbaPosition, uint64_t lbaCount);
+void checksumVerifyData(int on);
+
+// Called by the block device layer: record the checksums of blocks just
+// written, check blocks just read (returns how many of them passed before
+// the first corrupt one), and write the changed part of the table before
+// the device is flushed.
+void checksumStamp(const void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+uint64_t checksumVerify(const void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+int checksumFlush();
+
+// Time a sequential read of the volume without and with every block
+// checksummed, and print the overhead. Returns 0 on success.
+int checksumBenchmark();
+
+#endif
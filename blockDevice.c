@@ -0,0 +1,204 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: blockDevice.c
+ *
+ * Description::
+ *   Picks the block device backend at startup and forwards the
+ *   block cache's reads and writes to it. The default "lba" backend
+ *   is a thin wrapper around LBAread/LBAwrite of fsLow, which also
+ *   owns the partition header of the volume file.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blockChecksum.h"
+#include "blockDevice.h"
+
+static int lbaOpen(blockDevice *dev, char *filename, uint64_t *volSize, uint64_t *blockSize) {
+    return startPartitionSystem(filename, volSize, blockSize);
+}
+
+static uint64_t lbaRead(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    return LBAread(buffer, lbaCount, lbaPosition);
+}
+
+static uint64_t lbaWrite(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    return LBAwrite(buffer, lbaCount, lbaPosition);
+}
+
+static int lbaClose(blockDevice *dev) {
+    return closePartitionSystem();
+}
+
+static blockDevice lbaDevice = {
+    .name = "lba",
+    .open = lbaOpen,
+    .read = lbaRead,
+    .write = lbaWrite,
+    .close = lbaClose,
+};
+
+// Every backend that can be picked by name.
+static blockDevice *backends[] = {
+    &lbaDevice,
+    &mmapDevice,
+    &directDevice,
+    &memoryDevice,
+    &simDevice,
+    &stripeDevice,
+    &mirrorDevice,
+};
+
+static blockDevice *device = &lbaDevice;
+static uint64_t deviceBlockSize = MINBLOCKSIZE;
+
+blockDevice *findBlockDevice(const char *name) {
+    for (int i = 0; i < (int)(sizeof(backends) / sizeof(backends[0])); i++) {
+        if (strcmp(backends[i]->name, name) == 0) {
+            return backends[i];
+        }
+    }
+    return NULL;
+}
+
+int configureBlockDevice(const char *backend, char *options) {
+    blockDevice *chosen = findBlockDevice((backend != NULL) ? backend : DEFAULT_BLOCK_DEVICE);
+    if (chosen == NULL || chosen->configure == NULL) {
+        printf("Block device %s takes no options\n", (backend != NULL) ? backend : DEFAULT_BLOCK_DEVICE);
+        return -1;
+    }
+    return chosen->configure(chosen, options);
+}
+
+int openBlockDevice(const char *backend, char *filename, uint64_t *volSize, uint64_t *blockSize) {
+    if (backend == NULL) {
+        backend = (strcmp(filename, MEMORY_VOLUME) == 0) ? memoryDevice.name : DEFAULT_BLOCK_DEVICE;
+    }
+
+    blockDevice *chosen = findBlockDevice(backend);
+    if (chosen == NULL) {
+        printf("Unknown block device: %s\n", backend);
+        return PART_ERR_INVALID;
+    }
+
+    int result = chosen->open(chosen, filename, volSize, blockSize);
+    if (result == PART_NOERROR) {
+        device = chosen;
+        deviceBlockSize = *blockSize;
+    }
+    return result;
+}
+
+int closeBlockDevice() {
+    int result = device->close(device);
+    device = &lbaDevice;
+    deviceBlockSize = MINBLOCKSIZE;
+    return result;
+}
+
+// Every block read is checked against its checksum and every block written
+// gets one (see blockChecksum), a corrupt block ends a read short.
+uint64_t deviceRead(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    uint64_t got = device->read(device, buffer, lbaCount, lbaPosition);
+    return checksumVerify(buffer, got, lbaPosition);
+}
+
+uint64_t deviceWrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    uint64_t written = device->write(device, buffer, lbaCount, lbaPosition);
+    checksumStamp(buffer, written, lbaPosition);
+    return written;
+}
+
+uint64_t deviceReadv(const struct iovec *iov, int iovcnt, uint64_t lbaPosition) {
+    if (device->readv != NULL) {
+        uint64_t got = device->readv(device, iov, iovcnt, lbaPosition);
+        uint64_t passed = 0;
+        for (int i = 0; i < iovcnt && passed < got; i++) {
+            uint64_t count = iov[i].iov_len / deviceBlockSize;
+            if (count > got - passed) {
+                count = got - passed;
+            }
+            uint64_t ok = checksumVerify(iov[i].iov_base, count, lbaPosition + passed);
+            passed += ok;
+            if (ok != count) {
+                break;
+            }
+        }
+        return passed;
+    }
+
+    // still one device read, scattered from a bounce buffer
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len / deviceBlockSize;
+    }
+    char *bounce = allocBlockBuffer(total * deviceBlockSize);
+    if (bounce == NULL) {
+        return 0;
+    }
+    uint64_t got = deviceRead(bounce, total, lbaPosition);
+    uint64_t done = 0;
+    for (int i = 0; i < iovcnt && done < got; i++) {
+        uint64_t count = iov[i].iov_len / deviceBlockSize;
+        if (count > got - done) {
+            count = got - done;
+        }
+        memcpy(iov[i].iov_base, bounce + done * deviceBlockSize, count * deviceBlockSize);
+        done += count;
+    }
+    free(bounce);
+    return got;
+}
+
+int deviceDiscard(uint64_t lbaCount, uint64_t lbaPosition) {
+    char *zeroes = calloc(1, deviceBlockSize);
+    if (zeroes == NULL || device->discard == NULL ||
+        device->discard(device, lbaCount, lbaPosition) != 0) {
+        free(zeroes);
+        return -1;
+    }
+    // the blocks read as zeros now, their checksums have to say so
+    for (uint64_t i = 0; i < lbaCount; i++) {
+        checksumStamp(zeroes, 1, lbaPosition + i);
+    }
+    free(zeroes);
+    return 0;
+}
+
+int deviceFlush() {
+    // the checksums of what was written go down with it
+    int result = checksumFlush();
+    if (device->flush != NULL && device->flush(device) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+void *deviceMap(uint64_t lbaCount, uint64_t lbaPosition) {
+    if (device->map == NULL) {
+        return NULL;
+    }
+    // a corrupt block is left to deviceRead to report
+    void *mapped = device->map(device, lbaCount, lbaPosition);
+    if (mapped != NULL && checksumVerify(mapped, lbaCount, lbaPosition) != lbaCount) {
+        return NULL;
+    }
+    return mapped;
+}
+
+void *allocBlockBuffer(size_t size) {
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, DEVICE_ALIGNMENT, size) != 0) {
+        return NULL;
+    }
+    return buffer;
+}
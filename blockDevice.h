@@ -0,0 +1,99 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: blockDevice.h
+ *
+ * Description::
+ *	Interface of the block device the block cache reads and writes.
+ *	A backend fills in a blockDevice with its functions, one of them
+ *	is picked by name when the volume is opened. The default backend
+ *	is the LBA layer of fsLow.
+ *
+ **************************************************************/
+
+#ifndef BLOCKDEVICE_H
+#define BLOCKDEVICE_H
+
+#include <sys/uio.h>
+
+#include "fsLow.h"
+
+#define DEFAULT_BLOCK_DEVICE "lba"
+#define MEMORY_VOLUME ":memory:" // volume name that picks the memory backend, nothing is saved
+
+// Memory aligned this way can be handed to any backend as is, the direct
+// backend has to bounce anything else through its own buffers.
+#ifndef DEVICE_ALIGNMENT
+#define DEVICE_ALIGNMENT 4096
+#endif
+
+typedef struct blockDevice {
+    const char *name;
+    // Take backend specific options ("key=value,..."), before open. Returns 0 on success.
+    int (*configure)(struct blockDevice *dev, char *options);
+    // Open the volume, same contract and return values as startPartitionSystem.
+    int (*open)(struct blockDevice *dev, char *filename, uint64_t *volSize, uint64_t *blockSize);
+    // Same contract as LBAread/LBAwrite, return the number of blocks transferred.
+    uint64_t (*read)(struct blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+    uint64_t (*write)(struct blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+    // Read consecutive blocks into several buffers, each a whole number of blocks long.
+    uint64_t (*readv)(struct blockDevice *dev, const struct iovec *iov, int iovcnt, uint64_t lbaPosition);
+    // The blocks are free, drop their contents so they read back as zeros.
+    // Returns 0 on success, -1 if they were left as they are.
+    int (*discard)(struct blockDevice *dev, uint64_t lbaCount, uint64_t lbaPosition);
+    // Everything written so far is on stable storage once this returns 0.
+    int (*flush)(struct blockDevice *dev);
+    int (*close)(struct blockDevice *dev);
+    // Address of the blocks in memory for devices that can map them, NULL otherwise.
+    void *(*map)(struct blockDevice *dev, uint64_t lbaCount, uint64_t lbaPosition);
+    void *state; // private to the backend
+} blockDevice;
+
+// configure, readv, discard, flush and map may be left NULL: readv then falls back to
+// one read through a bounce buffer, discard fails, flush does nothing and nothing is mapped.
+
+// Backends besides the default one
+extern blockDevice mmapDevice; // the volume file mapped into memory
+extern blockDevice directDevice; // the volume file opened with O_DIRECT, past the host page cache
+extern blockDevice memoryDevice; // the volume held in RAM, saved back to its file (if any) on close
+extern blockDevice stripeDevice; // the volume striped over several files, listed with commas
+extern blockDevice mirrorDevice; // a copy of the volume in each of several files, listed with commas
+extern blockDevice simDevice; // another backend slowed down to the latency and bandwidth of a slower device
+
+// The backend of that name, NULL if there is none.
+blockDevice *findBlockDevice(const char *name);
+
+// Pass options to the named backend (NULL for DEFAULT_BLOCK_DEVICE) before
+// it is opened. Returns -1 if it does not take them.
+int configureBlockDevice(const char *backend, char *options);
+
+// Open filename through the named backend (NULL for DEFAULT_BLOCK_DEVICE, or
+// the memory backend if filename is MEMORY_VOLUME).
+// Returns what the backend's open returns, or PART_ERR_INVALID for an unknown name.
+int openBlockDevice(const char *backend, char *filename, uint64_t *volSize, uint64_t *blockSize);
+int closeBlockDevice();
+
+// Go to the open device. Until openBlockDevice is called this is the LBA
+// layer, so code that calls startPartitionSystem itself keeps working.
+uint64_t deviceRead(void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+uint64_t deviceWrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+// Read consecutive blocks into several buffers with one device call.
+uint64_t deviceReadv(const struct iovec *iov, int iovcnt, uint64_t lbaPosition);
+// Drop free blocks, they read as zeros afterwards and their checksums match.
+// Returns -1 if the device cannot, the caller has to write the zeros then.
+int deviceDiscard(uint64_t lbaCount, uint64_t lbaPosition);
+int deviceFlush();
+// Where the blocks can be read in memory without a copy, NULL if the device
+// does not map them. Writes must still go through deviceWrite.
+void *deviceMap(uint64_t lbaCount, uint64_t lbaPosition);
+
+// Allocate a buffer aligned to DEVICE_ALIGNMENT for blocks going to or from
+// the device, released with free. NULL if out of memory.
+void *allocBlockBuffer(size_t size);
+
+#endif
@@ -0,0 +1,211 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: crc32c.c
+ *
+ * Description::
+ *   CRC32C checksums. The CPU is checked once: x86-64 with SSE4.2
+ *   and ARMv8 with the CRC extension use their crc32c instructions,
+ *   anything else the portable slicing-by-8 table version.
+ *
+ *   The crc32c instruction takes 3 cycles but a new one can start
+ *   every cycle, so a single checksum only uses a third of it.
+ *   crc32cBlocks keeps three independent blocks going at once to
+ *   fill that gap.
+ *
+ **************************************************************/
+
+#include <pthread.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // reversed Castagnoli polynomial
+
+typedef uint32_t (*crcFunction)(uint32_t crc, const unsigned char *p, size_t length);
+typedef void (*blocksFunction)(const unsigned char *p, size_t blockSize, uint64_t count, uint32_t *crcs);
+
+static uint32_t crcTable[8][256];
+static crcFunction crcUpdate = NULL;
+static blocksFunction crcBlocks = NULL;
+static const char *implementation = "table";
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t load64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Portable version, eight bytes per step through eight tables
+static uint32_t crcTableUpdate(uint32_t crc, const unsigned char *p, size_t length) {
+    while (length >= 8) {
+        uint64_t word = load64(p) ^ crc;
+        crc = crcTable[7][word & 0xFF] ^ crcTable[6][(word >> 8) & 0xFF] ^
+              crcTable[5][(word >> 16) & 0xFF] ^ crcTable[4][(word >> 24) & 0xFF] ^
+              crcTable[3][(word >> 32) & 0xFF] ^ crcTable[2][(word >> 40) & 0xFF] ^
+              crcTable[1][(word >> 48) & 0xFF] ^ crcTable[0][word >> 56];
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = crcTable[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void crcTableBlocks(const unsigned char *p, size_t blockSize, uint64_t count, uint32_t *crcs) {
+    for (uint64_t i = 0; i < count; i++) {
+        crcs[i] = ~crcTableUpdate(~0U, p + i * blockSize, blockSize);
+    }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2"))) static uint32_t crcSSE42Update(uint32_t crc, const unsigned char *p,
+                                                                 size_t length) {
+    uint64_t c = crc;
+    while (length >= 8) {
+        c = _mm_crc32_u64(c, load64(p));
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    }
+    return (uint32_t)c;
+}
+
+__attribute__((target("sse4.2"))) static void crcSSE42Blocks(const unsigned char *p, size_t blockSize,
+                                                             uint64_t count, uint32_t *crcs) {
+    uint64_t i = 0;
+    if (blockSize % 8 == 0) {
+        for (; i + 3 <= count; i += 3) {
+            const unsigned char *a = p + i * blockSize;
+            const unsigned char *b = a + blockSize;
+            const unsigned char *c = b + blockSize;
+            uint64_t ca = ~0U, cb = ~0U, cc = ~0U;
+            for (size_t k = 0; k < blockSize; k += 8) {
+                ca = _mm_crc32_u64(ca, load64(a + k));
+                cb = _mm_crc32_u64(cb, load64(b + k));
+                cc = _mm_crc32_u64(cc, load64(c + k));
+            }
+            crcs[i] = ~(uint32_t)ca;
+            crcs[i + 1] = ~(uint32_t)cb;
+            crcs[i + 2] = ~(uint32_t)cc;
+        }
+    }
+    for (; i < count; i++) {
+        crcs[i] = ~crcSSE42Update(~0U, p + i * blockSize, blockSize);
+    }
+}
+
+#elif defined(__aarch64__)
+
+__attribute__((target("arch=armv8-a+crc"))) static uint32_t crc32cx(uint32_t crc, uint64_t value) {
+    __asm__("crc32cx %w0, %w0, %x1" : "+r"(crc) : "r"(value));
+    return crc;
+}
+
+__attribute__((target("arch=armv8-a+crc"))) static uint32_t crc32cb(uint32_t crc, uint8_t value) {
+    __asm__("crc32cb %w0, %w0, %w1" : "+r"(crc) : "r"(value));
+    return crc;
+}
+
+static uint32_t crcARMv8Update(uint32_t crc, const unsigned char *p, size_t length) {
+    while (length >= 8) {
+        crc = crc32cx(crc, load64(p));
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+static void crcARMv8Blocks(const unsigned char *p, size_t blockSize, uint64_t count, uint32_t *crcs) {
+    uint64_t i = 0;
+    if (blockSize % 8 == 0) {
+        for (; i + 3 <= count; i += 3) {
+            const unsigned char *a = p + i * blockSize;
+            const unsigned char *b = a + blockSize;
+            const unsigned char *c = b + blockSize;
+            uint32_t ca = ~0U, cb = ~0U, cc = ~0U;
+            for (size_t k = 0; k < blockSize; k += 8) {
+                ca = crc32cx(ca, load64(a + k));
+                cb = crc32cx(cb, load64(b + k));
+                cc = crc32cx(cc, load64(c + k));
+            }
+            crcs[i] = ~ca;
+            crcs[i + 1] = ~cb;
+            crcs[i + 2] = ~cc;
+        }
+    }
+    for (; i < count; i++) {
+        crcs[i] = ~crcARMv8Update(~0U, p + i * blockSize, blockSize);
+    }
+}
+
+#endif
+
+// Build the tables and pick the fastest version the CPU can run
+static void crcInit() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crcTable[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int t = 1; t < 8; t++) {
+            crcTable[t][n] = crcTable[0][crcTable[t - 1][n] & 0xFF] ^ (crcTable[t - 1][n] >> 8);
+        }
+    }
+
+    crcUpdate = crcTableUpdate;
+    crcBlocks = crcTableBlocks;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        crcUpdate = crcSSE42Update;
+        crcBlocks = crcSSE42Blocks;
+        implementation = "sse4.2";
+    }
+#elif defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crcUpdate = crcARMv8Update;
+        crcBlocks = crcARMv8Blocks;
+        implementation = "armv8";
+    }
+#endif
+}
+
+uint32_t crc32c(const void *data, size_t length) {
+    pthread_once(&crcOnce, crcInit);
+    return ~crcUpdate(~0U, data, length);
+}
+
+void crc32cBlocks(const void *data, size_t blockSize, uint64_t count, uint32_t *crcs) {
+    pthread_once(&crcOnce, crcInit);
+    crcBlocks(data, blockSize, count, crcs);
+}
+
+const char *crc32cImplementation() {
+    pthread_once(&crcOnce, crcInit);
+    return implementation;
+}
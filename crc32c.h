@@ -0,0 +1,35 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: crc32c.h
+ *
+ * Description::
+ *	CRC32C (Castagnoli) checksums, with the CRC instructions of
+ *	SSE4.2 or ARMv8 when the CPU has them and a table driven
+ *	version otherwise.
+ *
+ **************************************************************/
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32C of length bytes, crc32c("123456789", 9) is 0xE3069283.
+uint32_t crc32c(const void *data, size_t length);
+
+// CRC32C of each of count blocks of blockSize bytes, one after the other
+// at data. Independent blocks are checksummed side by side, which is
+// faster than one at a time.
+void crc32cBlocks(const void *data, size_t blockSize, uint64_t count, uint32_t *crcs);
+
+// Name of the implementation in use: "sse4.2", "armv8" or "table".
+const char *crc32cImplementation();
+
+#endif
@@ -0,0 +1,215 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: directDevice.c
+ *
+ * Description::
+ *   Block device backend that opens the volume file with O_DIRECT,
+ *   so blocks go between our buffers and the disk without a copy in
+ *   the host page cache (the block cache already keeps the ones we
+ *   need). O_DIRECT wants aligned memory: buffers allocated with
+ *   allocBlockBuffer are used as they are, anything else is copied
+ *   through one of DIRECT_POOL_BUFFERS bounce buffers set aside when
+ *   the device is opened.
+ *
+ *   Like the mmap backend, fsLow creates or validates the volume
+ *   file and its partition header before it is reopened here.
+ *
+ **************************************************************/
+
+#define _GNU_SOURCE // O_DIRECT, fallocate
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blockDevice.h"
+
+#define DIRECT_POOL_BUFFERS 4 // bounce buffers, callers wait when all are in use
+#define DIRECT_POOL_BLOCKS 64 // blocks per bounce buffer
+
+typedef struct directState {
+    int fd;
+    uint64_t blockSize;
+    uint64_t blockCount;
+    char *pool;                          // DIRECT_POOL_BUFFERS bounce buffers back to back
+    int inUse[DIRECT_POOL_BUFFERS];
+    pthread_mutex_t lock;                // guards inUse
+    pthread_cond_t available;            // a bounce buffer was given back
+} directState;
+
+static directState direct = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER,
+                             .available = PTHREAD_COND_INITIALIZER};
+
+static int isAligned(const void *buffer) {
+    return ((uintptr_t)buffer % DEVICE_ALIGNMENT) == 0;
+}
+
+// Move len bytes at the given file offset, retrying short transfers.
+// Returns the bytes moved.
+static size_t transfer(directState *st, int write, char *buffer, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write ? pwrite(st->fd, buffer + done, len - done, offset + done)
+                          : pread(st->fd, buffer + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static char *takeBounceBuffer(directState *st) {
+    pthread_mutex_lock(&st->lock);
+    while (1) {
+        for (int i = 0; i < DIRECT_POOL_BUFFERS; i++) {
+            if (!st->inUse[i]) {
+                st->inUse[i] = 1;
+                pthread_mutex_unlock(&st->lock);
+                return st->pool + (size_t)i * DIRECT_POOL_BLOCKS * st->blockSize;
+            }
+        }
+        pthread_cond_wait(&st->available, &st->lock);
+    }
+}
+
+static void giveBounceBuffer(directState *st, char *bounce) {
+    int i = (bounce - st->pool) / (DIRECT_POOL_BLOCKS * st->blockSize);
+    pthread_mutex_lock(&st->lock);
+    st->inUse[i] = 0;
+    pthread_cond_signal(&st->available);
+    pthread_mutex_unlock(&st->lock);
+}
+
+// Read or write blocks, through a bounce buffer if the caller's is not aligned
+static uint64_t directTransfer(blockDevice *dev, int write, char *buffer, uint64_t lbaCount,
+                               uint64_t lbaPosition) {
+    directState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return 0;
+    }
+    // the partition header takes the first block of the file
+    off_t offset = (lbaPosition + 1) * st->blockSize;
+
+    if (isAligned(buffer)) {
+        return transfer(st, write, buffer, lbaCount * st->blockSize, offset) / st->blockSize;
+    }
+
+    char *bounce = takeBounceBuffer(st);
+    uint64_t done = 0;
+    while (done < lbaCount) {
+        uint64_t run = lbaCount - done;
+        if (run > DIRECT_POOL_BLOCKS) {
+            run = DIRECT_POOL_BLOCKS;
+        }
+        size_t len = run * st->blockSize;
+        char *data = buffer + done * st->blockSize;
+
+        if (write) {
+            memcpy(bounce, data, len);
+        }
+        size_t moved = transfer(st, write, bounce, len, offset + done * st->blockSize);
+        if (!write) {
+            memcpy(data, bounce, moved);
+        }
+        done += moved / st->blockSize;
+        if (moved != len) {
+            break;
+        }
+    }
+    giveBounceBuffer(st, bounce);
+    return done;
+}
+
+static int directOpen(blockDevice *dev, char *filename, uint64_t *volSize, uint64_t *blockSize) {
+    directState *st = dev->state;
+
+    // let the LBA layer create the file or check its header
+    int result = startPartitionSystem(filename, volSize, blockSize);
+    if (result != PART_NOERROR) {
+        return result;
+    }
+    closePartitionSystem();
+
+    st->blockSize = *blockSize;
+    st->blockCount = *volSize / *blockSize;
+    st->pool = allocBlockBuffer((size_t)DIRECT_POOL_BUFFERS * DIRECT_POOL_BLOCKS * st->blockSize);
+    if (st->pool == NULL) {
+        printf("[directDevice] Failed to allocate bounce buffers\n");
+        return -1;
+    }
+    memset(st->inUse, 0, sizeof(st->inUse));
+
+    st->fd = open(filename, O_RDWR | O_DIRECT);
+    if (st->fd < 0) {
+        printf("[directDevice] Cannot open %s with O_DIRECT\n", filename);
+        free(st->pool);
+        st->pool = NULL;
+        return -1;
+    }
+    return PART_NOERROR;
+}
+
+static uint64_t directRead(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    return directTransfer(dev, 0, buffer, lbaCount, lbaPosition);
+}
+
+static uint64_t directWrite(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    return directTransfer(dev, 1, buffer, lbaCount, lbaPosition);
+}
+
+static int directDiscard(blockDevice *dev, uint64_t lbaCount, uint64_t lbaPosition) {
+    directState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return -1;
+    }
+    off_t offset = (lbaPosition + 1) * st->blockSize;
+    return fallocate(st->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, lbaCount * st->blockSize);
+}
+
+static int directFlush(blockDevice *dev) {
+    directState *st = dev->state;
+    // O_DIRECT skips the page cache but not the disk's own cache
+    if (fdatasync(st->fd) != 0) {
+        printf("[directDevice] fdatasync failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int directClose(blockDevice *dev) {
+    directState *st = dev->state;
+    if (st->fd < 0) {
+        return 0;
+    }
+    int result = directFlush(dev);
+    close(st->fd);
+    st->fd = -1;
+    free(st->pool);
+    st->pool = NULL;
+    return result;
+}
+
+blockDevice directDevice = {
+    .name = "direct",
+    .open = directOpen,
+    .read = directRead,
+    .write = directWrite,
+    .discard = directDiscard,
+    .flush = directFlush,
+    .close = directClose,
+    .state = &direct,
+};
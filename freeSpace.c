@@ -13,19 +13,25 @@
  *
  **************************************************************/
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "blockCache.h"
+#include "blockDevice.h"
 #include "freeSpace.h"
 #include "fsLow.h"
 #include "mfs.h"
 
-// Other folks should just refer to this.
+// Other folks should just refer to this. One byte per block: 0 = free,
+// otherwise how many files reference the block (more than 1 once cloned).
 char *freeSpaceMap = NULL;
 // Holds the total managed free space size.
 int freeSpaceMapSize = 0;
+// Serializes every change to freeSpaceMap so threads never hand out the same block.
+static pthread_mutex_t freeSpaceLock = PTHREAD_MUTEX_INITIALIZER;
 
 // Initialize free space
 int initFreeSpace(int blockCount, int sizeOfBlock) {
@@ -34,7 +40,7 @@ int initFreeSpace(int blockCount, int sizeOfBlock) {
     int blocksToWrite = (bitmapBytes + sizeOfBlock - 1) / sizeOfBlock;
 
     // Malloc the space needed for freeSpaceMap
-    freeSpaceMap = (char *)malloc(blocksToWrite * sizeOfBlock);
+    freeSpaceMap = (char *)allocBlockBuffer(blocksToWrite * sizeOfBlock);
     freeSpaceMapSize = blockCount;
 
     if (freeSpaceMap == NULL) {
@@ -59,7 +65,7 @@ int initFreeSpace(int blockCount, int sizeOfBlock) {
     }
 
     // Write the bitmap to disk
-    int writtenDataToDisk = LBAwrite(freeSpaceMap, blocksToWrite, FS_RESERVED_BLOCK);
+    int writtenDataToDisk = cacheWrite(freeSpaceMap, blocksToWrite, FS_RESERVED_BLOCK);
     if (writtenDataToDisk != blocksToWrite) {
         printf("Error writing free space map to disk\n");
         free(freeSpaceMap);
@@ -71,7 +77,8 @@ int initFreeSpace(int blockCount, int sizeOfBlock) {
     return 0;
 }
 
-int *allocateBlocks(int count) {
+// Body of allocateBlocks, caller holds freeSpaceLock
+static int *allocateBlocksLocked(int count) {
     if (count <= 0 || freeSpaceMap == NULL || freeSpaceMapSize == 0) {
         printf("Invalid Free Space allocation request, or uninitialized free space\n");
         return NULL;
@@ -110,7 +117,7 @@ int *allocateBlocks(int count) {
     // Write the freeSpaceMap to disk and make sure all blocks are written.
     // If LBAWrite doesnt match what we expect, treat it as a failure.
     int blocksToWrite = (freeSpaceMapSize * sizeof(char) + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    int written = LBAwrite(freeSpaceMap, blocksToWrite, FS_RESERVED_BLOCK);
+    int written = cacheWrite(freeSpaceMap, blocksToWrite, FS_RESERVED_BLOCK);
     if (written != blocksToWrite) {
         printf("Error! Failed to write updated free space map to the disk after allocation\n");
         for (int i = 0; i < count; i++) {
@@ -124,7 +131,51 @@ int *allocateBlocks(int count) {
     return allocatedBlocks;
 }
 
-int freeBlocks(int *blockArray, int count) {
+int allocateContiguous(int count) {
+    pthread_mutex_lock(&freeSpaceLock);
+    if (count <= 0 || freeSpaceMap == NULL) {
+        pthread_mutex_unlock(&freeSpaceLock);
+        printf("Invalid Free Space allocation request, or uninitialized free space\n");
+        return -1;
+    }
+
+    // first run of free blocks long enough
+    int start = -1;
+    for (int i = FS_FIRST_USABLE_BLOCK, run = 0; i < freeSpaceMapSize; i++) {
+        run = (freeSpaceMap[i] == 0) ? run + 1 : 0;
+        if (run == count) {
+            start = i - count + 1;
+            break;
+        }
+    }
+    if (start == -1) {
+        pthread_mutex_unlock(&freeSpaceLock);
+        printf("Error finding %d consecutive free blocks.\n", count);
+        return -1;
+    }
+    memset(freeSpaceMap + start, 1, count);
+
+    int blocksToWrite = (freeSpaceMapSize * sizeof(char) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (cacheWrite(freeSpaceMap, blocksToWrite, FS_RESERVED_BLOCK) != blocksToWrite) {
+        printf("Error! Failed to write updated free space map to the disk after allocation\n");
+        memset(freeSpaceMap + start, 0, count);
+        start = -1;
+    }
+    pthread_mutex_unlock(&freeSpaceLock);
+    return start;
+}
+
+// Body of freeBlocks, caller holds freeSpaceLock
+static int freeBlocksLocked(int *blockArray, int count) {
+    // blocks losing their last reference, erased together once all are known
+    int *erase = malloc((count + 1) * sizeof(int));
+    int eraseCount = 0;
+    int result = 0;
+    if (erase == NULL) {
+        printf("Error: unable to allocate the list of blocks to erase\n");
+        return -1;
+    }
+
     int blockIndex = 0; // initialize variable outside loop
     for (int i = 0; i < count; i++) {
         blockIndex = blockArray[i];
@@ -134,34 +185,51 @@ int freeBlocks(int *blockArray, int count) {
         // Handle incorrect cases and protect FS reserved blocks.
         if (freeSpaceMap == NULL || blockIndex < 0 || blockIndex >= freeSpaceMapSize) {
             printf("Error: Invalid block number or uninitalized free space map!");
-            return -1;
+            result = -1;
+            break;
         }
 
         if (blockIndex < FS_RESERVED_BLOCK + FS_BLOCK_COUNT) {
             printf("Error: Block %d is assigned to File System. In order to free, please format the disk instead.", blockIndex);
-            return -1;
+            result = -1;
+            break;
         }
 
         if (freeSpaceMap[blockIndex] == 0) {
             printf("Error: Block %d is already free.\n", blockIndex);
-            return -1;
+            result = -1;
+            break;
         }
 
-        // Don't trust the system, set everything to zero.
-        uint8_t buffer[BLOCK_SIZE];
-        memset(buffer, 0, BLOCK_SIZE);
-        int erasedBlock = LBAwrite(buffer, 1, blockIndex);
-        if (!erasedBlock) {
-            printf("Error: unable to erase the block contents of block %d\n", blockIndex);
-            return -1;
+        // A block shared by clones only loses one reference.
+        if ((unsigned char)freeSpaceMap[blockIndex] > 1) {
+            freeSpaceMap[blockIndex]--;
+            continue;
         }
 
-        // Set the block free.
+        // Set free once erased below, so a block listed twice is caught here.
         freeSpaceMap[blockIndex] = 0;
+        erase[eraseCount++] = blockIndex;
+    }
+
+    // Don't trust the system, set everything to zero: the device discards
+    // what it can, the rest is zeroed in one sorted and merged batch.
+    if (eraseCount > 0 && cacheDiscardBlocks(erase, eraseCount) != 0) {
+        printf("Error: unable to erase the block contents of %d blocks\n", eraseCount);
+        // keep them allocated, their old contents may still be there
+        for (int k = 0; k < eraseCount; k++) {
+            freeSpaceMap[erase[k]] = 1;
+        }
+        free(erase);
+        return -1;
+    }
+    free(erase);
+    if (result != 0) {
+        return result;
     }
 
     int blocksToWrite = (freeSpaceMapSize * sizeof(char) + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    int writtenDataToDisk = LBAwrite(freeSpaceMap, blocksToWrite, FS_RESERVED_BLOCK);
+    int writtenDataToDisk = cacheWrite(freeSpaceMap, blocksToWrite, FS_RESERVED_BLOCK);
     if (writtenDataToDisk != blocksToWrite) {
         printf("Error writing updated freeSpaceMap to disk!\n");
         return -1;
@@ -170,7 +238,81 @@ int freeBlocks(int *blockArray, int count) {
     return 0;
 }
 
-int checkBlockAvailability(int blockIndex) {
+int *allocateBlocks(int count) {
+    pthread_mutex_lock(&freeSpaceLock);
+    int *allocatedBlocks = allocateBlocksLocked(count);
+    pthread_mutex_unlock(&freeSpaceLock);
+    return allocatedBlocks;
+}
+
+int freeBlocks(int *blockArray, int count) {
+    pthread_mutex_lock(&freeSpaceLock);
+    int result = freeBlocksLocked(blockArray, count);
+    pthread_mutex_unlock(&freeSpaceLock);
+    return result;
+}
+
+int shareBlocks(int *blockArray, int count) {
+    pthread_mutex_lock(&freeSpaceLock);
+    if (freeSpaceMap == NULL) {
+        pthread_mutex_unlock(&freeSpaceLock);
+        printf("Error: uninitalized free space map!\n");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int blockIndex = blockArray[i];
+        if (blockIndex < 0) {
+            continue; // a hole, nothing to share
+        }
+        if (blockIndex < FS_RESERVED_BLOCK + FS_BLOCK_COUNT || blockIndex >= freeSpaceMapSize ||
+            freeSpaceMap[blockIndex] == 0 || (unsigned char)freeSpaceMap[blockIndex] == MAX_BLOCK_REFS) {
+            printf("Error: Block %d cannot be shared.\n", blockIndex);
+            // Give back the references taken so far.
+            for (int k = 0; k < i; k++) {
+                if (blockArray[k] >= 0) {
+                    freeSpaceMap[blockArray[k]]--;
+                }
+            }
+            pthread_mutex_unlock(&freeSpaceLock);
+            return -1;
+        }
+        freeSpaceMap[blockIndex]++;
+    }
+
+    int blocksToWrite = (freeSpaceMapSize * sizeof(char) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int writtenDataToDisk = cacheWrite(freeSpaceMap, blocksToWrite, FS_RESERVED_BLOCK);
+    if (writtenDataToDisk != blocksToWrite) {
+        printf("Error writing updated freeSpaceMap to disk!\n");
+        for (int i = 0; i < count; i++) {
+            if (blockArray[i] >= 0) {
+                freeSpaceMap[blockArray[i]]--;
+            }
+        }
+        pthread_mutex_unlock(&freeSpaceLock);
+        return -1;
+    }
+
+    pthread_mutex_unlock(&freeSpaceLock);
+    return 0;
+}
+
+int sharedBlocks(int *blockArray, int count) {
+    int shared = 0;
+    pthread_mutex_lock(&freeSpaceLock);
+    for (int i = 0; i < count; i++) {
+        int blockIndex = blockArray[i];
+        if (freeSpaceMap != NULL && blockIndex > 0 && blockIndex < freeSpaceMapSize &&
+            (unsigned char)freeSpaceMap[blockIndex] > 1) {
+            shared++;
+        }
+    }
+    pthread_mutex_unlock(&freeSpaceLock);
+    return shared;
+}
+
+// Body of checkBlockAvailability, caller holds freeSpaceLock
+static int checkBlockAvailabilityLocked(int blockIndex) {
     // Handle incorrect cases.
     if (freeSpaceMap == NULL || blockIndex < 0 || blockIndex >= freeSpaceMapSize) {
         printf("Error: Invalid block number or uninitalized free space map!");
@@ -193,6 +335,13 @@ int checkBlockAvailability(int blockIndex) {
     }
 }
 
+int checkBlockAvailability(int blockIndex) {
+    pthread_mutex_lock(&freeSpaceLock);
+    int result = checkBlockAvailabilityLocked(blockIndex);
+    pthread_mutex_unlock(&freeSpaceLock);
+    return result;
+}
+
 // Function to load FreeSpaceMap while initialization.
 int loadFreeSpaceMap(int blockSize, int startBlock, int totalBlockCount) {
     if (freeSpaceMap != NULL) {
@@ -208,14 +357,14 @@ int loadFreeSpaceMap(int blockSize, int startBlock, int totalBlockCount) {
     int blocksToRead = (mapSizeBytes + blockSize - 1) / blockSize;
 
     // Malloc space to hold all freeSpaceMap sectors.
-    freeSpaceMap = malloc(blocksToRead * blockSize);
+    freeSpaceMap = allocBlockBuffer(blocksToRead * blockSize);
     if (freeSpaceMap == NULL) {
         printf("[FreeSpaceLoader] Failed to allocate memory for reading freeSpaceMap!\n");
         return -1;
     }
 
     // Check given blocks and attempt to read them
-    int check = LBAread(freeSpaceMap, blocksToRead, startBlock);
+    int check = cacheRead(freeSpaceMap, blocksToRead, startBlock);
     if (check != blocksToRead) {
         printf("[FreeSpaceLoader] LBAread failed for freeSpaceMap!\n");
         free(freeSpaceMap);
@@ -17,12 +17,17 @@
 #ifndef FREESPACE_H
 #define FREESPACE_H
 
+#define MAX_BLOCK_REFS 255 // A map entry is one byte, so a block can be shared this many times.
+
 extern char* freeSpaceMap;
 extern int freeSpaceMapSize;
 
 int initFreeSpace(int blockCount, int sizeOfBlock); // Initialize Free Space on disk.
 int* allocateBlocks(int count); // Allocates blocks 'count' times, returns an array of allocated blocks.
-int freeBlocks(int* blockArray, int count); // Set block free for given block index. 
+int allocateContiguous(int count); // Allocates 'count' consecutive blocks, returns the first one or -1.
+int freeBlocks(int* blockArray, int count); // Drop one reference to each block, a block is freed once nothing references it.
+int shareBlocks(int* blockArray, int count); // Add a reference to each (used) block, returns -1 and changes nothing on failure.
+int sharedBlocks(int* blockArray, int count); // Count the blocks referenced by more than one file.
 int checkBlockAvailability(int blockIndex); // Check block availability return 0 for used, 1 for free.
 int loadFreeSpaceMap(int blockSize, int startBlock, int totalBlockCount); // Load the freespacemap when reinitializing file system. 
 
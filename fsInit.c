@@ -20,23 +20,68 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "b_async.h"
+#include "blockCache.h"
+#include "blockChecksum.h"
+#include "blockDevice.h"
 #include "freeSpace.h"
 #include "fsLow.h"
 #include "mfs.h"
 
 #define VCB_SIGNATURE 0x4275675468756773 // "BugThugs" signature
 
+static uint64_t volumeBlockSize = 0; // of the mounted volume, 0 if none is
+
+// Write the VCB and flush the device, so it is on disk before anything after it
+static int writeVCB(vcb_struct *vcb) {
+    int vcbBlock = 0;
+    if (cacheWrite(vcb, 1, 0) != 1 || cacheSyncBlocks(&vcbBlock, 1) != 0) {
+        printf("LBAwrite error for vcb!\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Everything is on disk, the checksum table included, so the next mount can
+// trust the table as it is.
+static int markChecksumsClean() {
+    if (volumeBlockSize == 0) {
+        return 0;
+    }
+    vcb_struct *vcb = allocBlockBuffer(volumeBlockSize);
+    if (vcb == NULL) {
+        printf("Failed to malloc for vcb!\n");
+        return -1;
+    }
+    int result = 0;
+    if (cacheRead(vcb, 1, 0) != 1) {
+        printf("LBAread error for vcb!\n");
+        result = -1;
+    } else if (vcb->checksum_blocks > 0) {
+        vcb->checksum_clean = 1;
+        result = writeVCB(vcb);
+    }
+    free(vcb);
+    return result;
+}
+
 int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
     printf("Initializing File System with %ld blocks with a block size of %ld\n", numberOfBlocks, blockSize);
     /* TODO: Add any code you need to initialize your file system. */
 
-    vcb_struct *vcb = malloc(blockSize);
+    // Everything above the LBA layer goes through the block cache.
+    if (initBlockCache(CACHE_DEFAULT_BUDGET, blockSize) != 0) {
+        printf("Failed to initialize block cache!\n");
+        return -1;
+    }
+
+    vcb_struct *vcb = allocBlockBuffer(blockSize);
     if (vcb == NULL) {
         printf("Failed to malloc for vcb!\n");
         return -1;
     }
 
-    int read = LBAread(vcb, 1, 0);
+    int read = cacheRead(vcb, 1, 0);
     if (read != 1) {
         printf("LBAread error for vcb!\n");
         free(vcb);
@@ -46,7 +91,7 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
 
     int blocksNeeded = (ENTRY_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE;
     if (rootDir == NULL) {
-        rootDir = malloc(blocksNeeded * BLOCK_SIZE);
+        rootDir = allocBlockBuffer(blocksNeeded * BLOCK_SIZE);
         if (rootDir == NULL) {
             printf("Error mallocing rootDir\n");
             free(vcb);
@@ -71,6 +116,47 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
     if (vcb->signature == VCB_SIGNATURE) {
         printf("Volume is already formatted!\n");
 
+        // from here on blocks read are checked against their checksums
+        if (vcb->checksum_blocks > 0 &&
+            checksumOpen(vcb->checksum_start, vcb->checksum_blocks, vcb->block_count, blockSize, 0) != 0) {
+            printf("Failed to load the block checksums!\n");
+            free(vcb);
+            vcb = NULL;
+            free(rootDir);
+            rootDir = NULL;
+            return -1;
+        }
+        checksumMarkMetadataRange(0, FS_FIRST_USABLE_BLOCK);
+
+        if (vcb->checksum_blocks > 0) {
+            // after a crash the table can be behind the blocks it describes
+            if (!vcb->checksum_clean) {
+                printf("Volume was not unmounted cleanly, updating block checksums\n");
+                int stale = checksumRebuild();
+                if (stale > 0) {
+                    printf("%d block checksums were out of date\n", stale);
+                }
+                if (stale < 0) {
+                    printf("Failed to update the block checksums!\n");
+                    free(vcb);
+                    vcb = NULL;
+                    free(rootDir);
+                    rootDir = NULL;
+                    return -1;
+                }
+            }
+
+            // until the next clean unmount the table may fall behind again
+            vcb->checksum_clean = 0;
+            if (writeVCB(vcb) != 0) {
+                free(vcb);
+                vcb = NULL;
+                free(rootDir);
+                rootDir = NULL;
+                return -1;
+            }
+        }
+
         // Attempt to load the FreeSpaceMap via loadFreeSpaceMap() from freeSpace.c when we are re-reading the disk.
         if (loadFreeSpaceMap(blockSize, vcb->freespace_list_start, vcb->block_count) != 0) {
             printf("Failed to load freeSpaceMap from disk!\n");
@@ -82,8 +168,9 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
         }
 
         int rootBlock = vcb->root_dir_start;
+        checksumMarkMetadataRange(rootBlock, blocksNeeded);
 
-        int check = LBAread(rootDir, blocksNeeded, rootBlock);
+        int check = cacheRead(rootDir, blocksNeeded, rootBlock);
         if (check != blocksNeeded) {
             printf("LBAread error for rootDir\n");
             free(vcb);
@@ -111,9 +198,18 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
         printf("----- END PRINTING -----\n");
         */
 
+        // the root is shared through the directory cache like every other directory
+        if (registerDirectory(rootDir) != 0) {
+            free(vcb);
+            vcb = NULL;
+            free(rootDir);
+            rootDir = NULL;
+            return -1;
+        }
         cwDir = rootDir;
 
         printf("Root directory loaded from disk!\n");
+        volumeBlockSize = blockSize;
 
         free(vcb);
         vcb = NULL;
@@ -147,6 +243,17 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
             vcb = NULL;
             return -1;
         }
+
+        // a table with a checksum for every block, the volume works without one
+        int tableBlocks = checksumTableBlocks(numberOfBlocks, blockSize);
+        int tableStart = allocateContiguous(tableBlocks);
+        if (tableStart < 0 || checksumOpen(tableStart, tableBlocks, numberOfBlocks, blockSize, 1) != 0) {
+            printf("Volume is formatted without block checksums\n");
+        } else {
+            vcb->checksum_start = tableStart;
+            vcb->checksum_blocks = tableBlocks;
+        }
+        checksumMarkMetadataRange(0, FS_FIRST_USABLE_BLOCK);
     }
 
     /* TODO INIT ROOT DIR */
@@ -154,7 +261,7 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
     // get root dir block without allocating too few memory.
     // And wipe it clean for alll blocks
     blocksNeeded = (ENTRY_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    rootDir = malloc(blocksNeeded * BLOCK_SIZE);
+    rootDir = allocBlockBuffer(blocksNeeded * BLOCK_SIZE);
     memset(rootDir, 0, blocksNeeded * BLOCK_SIZE);
 
     // newDir->allocateBlocks() needs freeing
@@ -169,9 +276,16 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
     }
     // set new block as root dir start in vcb
     vcb->root_dir_start = rootBlocks[0];
+    if (registerDirectory(rootDir) != 0) {
+        free(rootDir);
+        rootDir = NULL;
+        free(vcb);
+        vcb = NULL;
+        return -1;
+    }
     cwDir = rootDir;
 
-    int write = LBAwrite(vcb, 1, 0);
+    int write = cacheWrite(vcb, 1, 0);
     if (write != 1) {
         printf("LBAwrite error for vcb!\n");
         if (cwDir == rootDir) {
@@ -185,6 +299,7 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
     }
 
     printf("Volume formatted!\n");
+    volumeBlockSize = blockSize;
 
     // free only if its not NULL otherwise the system gets segfault.
     if (rootBlocks != NULL) {
@@ -198,18 +313,21 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
 void exitFileSystem() {
     printf("System exiting\n");
 
-    if (rootDir != NULL) {
-        if (cwDir == rootDir) {
-            cwDir = NULL;
-        }
-        free(rootDir);
-        rootDir = NULL;
-    }
+    // Requests still queued for the async workers run before the cache is synced
+    b_async_shutdown();
 
-    if (cwDir != NULL && cwDir != rootDir) {
-        free(cwDir);
-        cwDir = NULL;
+    // Get everything still held in the cache onto the disk.
+    if (cacheSync() != 0) {
+        printf("Error writing cached blocks to disk!\n");
+    } else if (markChecksumsClean() != 0) {
+        printf("Error marking the block checksums clean!\n");
     }
+    volumeBlockSize = 0;
+
+    // rootDir, cwDir and every other loaded directory belong to the directory cache
+    freeDirectoryCache();
+    rootDir = NULL;
+    cwDir = NULL;
 
     if (cwdName != NULL) {
         free(cwdName);
@@ -220,4 +338,7 @@ void exitFileSystem() {
         free(freeSpaceMap);
         freeSpaceMap = NULL;
     }
+
+    exitBlockCache();
+    checksumClose();
 }
@@ -0,0 +1,214 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: fscrash.c
+ *
+ * Description::
+ *   Crash test (make crash). Each step mounts the volume in a child
+ *   process, so a step can end with the process killed instead of
+ *   exitFileSystem, the way a power cut or kill -9 would end it. The
+ *   next step has to mount the volume again and find everything that
+ *   reached the disk before the crash.
+ *
+ *   The first crash comes after the flusher thread has written the
+ *   dirty blocks out on its own, without the device being flushed,
+ *   the second one right after a write with the blocks still cached.
+ *
+ *   Usage: fscrash [-d device] [-o options] [volumeFileName volumeSize blockSize]
+ *   The volume is formatted from scratch and removed afterwards.
+ *
+ **************************************************************/
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "b_io.h"
+#include "blockCache.h"
+#include "blockDevice.h"
+#include "fsLow.h"
+#include "mfs.h"
+
+#define CRASH_FILE_SIZE 20000
+
+de_struct *rootDir = NULL;
+de_struct *cwDir = NULL;
+char *cwdName = NULL;
+
+static char *device = NULL;
+static char *deviceOptions = NULL;
+static char *filename = "CrashVolume";
+static uint64_t volumeSize = 10000000;
+static uint64_t blockSize = 512;
+
+// How a step ends
+#define STEP_UNMOUNT 0
+#define STEP_CRASH 1
+
+static int mountVolume() {
+    uint64_t size = volumeSize;
+    uint64_t block = blockSize;
+    if (deviceOptions != NULL && configureBlockDevice(device, deviceOptions) != 0) {
+        return -1;
+    }
+    if (openBlockDevice(device, filename, &size, &block) != PART_NOERROR) {
+        printf("[crash] Failed to open %s\n", filename);
+        return -1;
+    }
+    if (initFileSystem(size / block, block) != 0) {
+        printf("[crash] Failed to mount %s\n", filename);
+        closeBlockDevice();
+        return -1;
+    }
+    return 0;
+}
+
+static void fill(char *buffer, int length, int seed) {
+    for (int i = 0; i < length; i++) {
+        buffer[i] = (char)(seed * 13 + i * 7);
+    }
+}
+
+static int writeFile(const char *path, int seed) {
+    char copy[LOCAL_PATH_MAX];
+    char *data = malloc(CRASH_FILE_SIZE);
+    strcpy(copy, path);
+    b_io_fd fd = b_open(copy, O_WRONLY | O_CREAT | O_TRUNC);
+    if (data == NULL || fd < 0) {
+        free(data);
+        return -1;
+    }
+    fill(data, CRASH_FILE_SIZE, seed);
+    int written = b_write(fd, data, CRASH_FILE_SIZE);
+    free(data);
+    if (b_close(fd) != 0 || written != CRASH_FILE_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+static int checkFile(const char *path, int seed) {
+    char copy[LOCAL_PATH_MAX];
+    char *data = malloc(CRASH_FILE_SIZE);
+    char *back = malloc(CRASH_FILE_SIZE + 1);
+    strcpy(copy, path);
+    b_io_fd fd = b_open(copy, O_RDONLY);
+    int ok = data != NULL && back != NULL && fd >= 0;
+    if (ok) {
+        fill(data, CRASH_FILE_SIZE, seed);
+        ok = b_read(fd, back, CRASH_FILE_SIZE + 1) == CRASH_FILE_SIZE &&
+             memcmp(data, back, CRASH_FILE_SIZE) == 0;
+    }
+    if (fd >= 0) {
+        b_close(fd);
+    }
+    if (!ok) {
+        printf("[crash] %s is missing or wrong\n", path);
+    }
+    free(data);
+    free(back);
+    return ok ? 0 : -1;
+}
+
+// Format, nothing else
+static int stepFormat() {
+    return 0;
+}
+
+// Write a file and let the flusher put it on disk by itself
+static int stepWriteAndWait() {
+    char path[LOCAL_PATH_MAX];
+    strcpy(path, "/crash");
+    if (fs_mkdir(path, 0777) != 0 || writeFile("/crash/early", 1) != 0) {
+        return -1;
+    }
+    sleep(CACHE_DIRTY_EXPIRE + 2 * CACHE_FLUSH_INTERVAL);
+    return 0;
+}
+
+// What the flusher wrote survived, crash again before the next write is flushed
+static int stepCheckAndWrite() {
+    if (checkFile("/crash/early", 1) != 0) {
+        return -1;
+    }
+    return writeFile("/crash/late", 2);
+}
+
+// Still mountable, the flushed file still there
+static int stepCheck() {
+    return checkFile("/crash/early", 1);
+}
+
+// Run a step in a child process of its own. Returns 0 if it mounted the
+// volume, passed, and then unmounted or was killed as asked.
+static int runStep(const char *name, int (*step)(), int ending) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("[crash] fork failed\n");
+        return -1;
+    }
+    if (pid == 0) {
+        if (mountVolume() != 0 || step() != 0) {
+            fflush(stdout);
+            _exit(1);
+        }
+        if (ending == STEP_CRASH) {
+            fflush(stdout);
+            kill(getpid(), SIGKILL);
+        }
+        exitFileSystem();
+        closeBlockDevice();
+        fflush(stdout);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    int passed = (ending == STEP_CRASH) ? WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL
+                                        : WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    printf("[crash] %-40s %s\n", name, passed ? "ok" : "FAILED");
+    return passed ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:o:")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 'o':
+            deviceOptions = optarg;
+            break;
+        default:
+            printf("Usage: fscrash [-d device] [-o options] [volumeFileName volumeSize blockSize]\n");
+            return -1;
+        }
+    }
+    if (optind + 3 <= argc) {
+        filename = argv[optind];
+        volumeSize = atoll(argv[optind + 1]);
+        blockSize = atoll(argv[optind + 2]);
+    }
+
+    remove(filename);
+    int failed = runStep("format", stepFormat, STEP_UNMOUNT) != 0 ||
+                 runStep("write, wait for the flusher, crash", stepWriteAndWait, STEP_CRASH) != 0 ||
+                 runStep("remount, write, crash", stepCheckAndWrite, STEP_CRASH) != 0 ||
+                 runStep("remount, unmount", stepCheck, STEP_UNMOUNT) != 0 ||
+                 runStep("remount after a clean unmount", stepCheck, STEP_UNMOUNT) != 0;
+    remove(filename);
+
+    printf("[crash] %s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
@@ -26,6 +26,8 @@
 #include <string.h>
 
 #include "fsLow.h"
+#include "blockChecksum.h"
+#include "blockDevice.h"
 #include "mfs.h"
 
 #define PERMISSIONS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
@@ -33,6 +35,7 @@
 #define SINGLE_QUOTE	0x27
 #define DOUBLE_QUOTE	0x22
 #define BUFFERLEN		200
+#define CP_CHUNK		(64 * 1024)	// bytes cp hands to each b_copy_range call
 #define DIRMAX_LEN		4096
 
 /****   SET THESE TO 1 WHEN READY TO TEST THAT COMMAND ****/
@@ -47,6 +50,8 @@
 #define CMDPWD_ON	1
 #define CMDTOUCH_ON	1
 #define CMDCAT_ON	1
+#define CMDBENCH_ON	1
+#define CMDCOMPRESS_ON	1
 
 
 typedef struct dispatch_t
@@ -68,12 +73,14 @@ int cmd_cp2l (int argcnt, char *argvec[]);
 int cmd_cp2fs (int argcnt, char *argvec[]);
 int cmd_cd (int argcnt, char *argvec[]);
 int cmd_pwd (int argcnt, char *argvec[]);
+int cmd_bench (int argcnt, char *argvec[]);
+int cmd_compress (int argcnt, char *argvec[]);
 int cmd_history (int argcnt, char *argvec[]);
 int cmd_help (int argcnt, char *argvec[]);
 
 dispatch_t dispatchTable[] = {
 	{"ls", cmd_ls, "Lists the file in a directory"},
-	{"cp", cmd_cp, "Copies a file - source [dest]"},
+	{"cp", cmd_cp, "Copies a file - [--reflink] source [dest]"},
 	{"mv", cmd_mv, "Moves a file - source dest"},
 	{"md", cmd_md, "Make a new directory"},
 	{"rm", cmd_rm, "Removes a file or directory"},
@@ -83,6 +90,8 @@ dispatch_t dispatchTable[] = {
 	{"cp2fs", cmd_cp2fs, "Copies a file from the Linux file system to the test file system"},
 	{"cd", cmd_cd, "Changes directory"},
 	{"pwd", cmd_pwd, "Prints the working directory"},
+	{"bench", cmd_bench, "Times reading the volume with and without block checksums"},
+	{"compress", cmd_compress, "Compresses an empty file, or new files in a directory - path [on|off]"},
 	{"history", cmd_history, "Prints out the history"},
 	{"help", cmd_help, "Prints out help"}
 };
@@ -325,8 +334,17 @@ int cmd_cp (int argcnt, char *argvec[])
 	int testfs_dest_fd;
 	char * src;
 	char * dest;
-	int readcnt;
-	char buf[BUFFERLEN];
+	int copied;
+	off_t offset = 0;
+	int reflink = 0;
+
+	// cp --reflink src dest clones the file instead of copying its data
+	if (argcnt > 1 && strcmp(argvec[1], "--reflink") == 0)
+		{
+		reflink = 1;
+		argvec++;
+		argcnt--;
+		}
 	
 	switch (argcnt)
 		{
@@ -341,17 +359,34 @@ int cmd_cp (int argcnt, char *argvec[])
 			break;
 		
 		default:
-			printf("Usage: cp srcfile [destfile]\n");
+			printf("Usage: cp [--reflink] srcfile [destfile]\n");
 			return (-1);
 		}
 
+	if (reflink)
+		{
+		return (b_clone (src, dest));
+		}
+
 	testfs_src_fd = b_open (src, O_RDONLY);
+	if (testfs_src_fd < 0)
+		{
+		return (-1);
+		}
 	testfs_dest_fd = b_open (dest, O_WRONLY | O_CREAT | O_TRUNC);
+	if (testfs_dest_fd < 0)
+		{
+		b_close (testfs_src_fd);
+		return (-1);
+		}
+
+	// the data never leaves the file system, it is copied in large
+	// block runs instead of through a small buffer here
 	do 
 		{
-		readcnt = b_read (testfs_src_fd, buf, BUFFERLEN);
-		b_write (testfs_dest_fd, buf, readcnt);
-		} while (readcnt == BUFFERLEN);
+		copied = b_copy_range (testfs_src_fd, offset, testfs_dest_fd, offset, CP_CHUNK);
+		offset += copied;
+		} while (copied == CP_CHUNK);
 	b_close (testfs_src_fd);
 	b_close (testfs_dest_fd);
 #endif
@@ -575,6 +610,40 @@ int cmd_pwd (int argcnt, char *argvec[])
 	return 0;
 	}
 
+/****************************************************
+*  Bench commmand
+****************************************************/
+int cmd_bench (int argcnt, char *argvec[])
+	{
+#if (CMDBENCH_ON == 1)
+	if (argcnt != 1)
+		{
+		printf ("Usage: bench\n");
+		return (-1);
+		}
+	return checksumBenchmark ();
+#endif
+	return 0;
+	}
+
+/****************************************************
+*  Compress commmand
+****************************************************/
+int cmd_compress (int argcnt, char *argvec[])
+	{
+#if (CMDCOMPRESS_ON == 1)
+	if (argcnt < 2 || argcnt > 3 ||
+		(argcnt == 3 && strcmp(argvec[2], "on") != 0 && strcmp(argvec[2], "off") != 0))
+		{
+		printf ("Usage: compress path [on|off]\n");
+		return (-1);
+		}
+	int on = (argcnt == 2 || strcmp(argvec[2], "on") == 0);
+	return b_compress (argvec[1], on);
+#endif
+	return 0;
+	}
+
 /****************************************************
 *  History commmand
 ****************************************************/
@@ -726,6 +795,30 @@ int main (int argc, char * argv[])
 	uint64_t volumeSize;
 	uint64_t blockSize;
     int retVal;
+	char * device = NULL;		// block device backend, NULL for the default
+	char * deviceOptions = NULL;	// backend specific, key=value,...
+	int opt;
+
+	while ((opt = getopt (argc, argv, "d:o:")) != -1)
+		{
+		switch (opt)
+			{
+			case 'd':
+				device = optarg;
+				break;
+
+			case 'o':
+				deviceOptions = optarg;
+				break;
+
+			default:
+				printf ("Usage: fsLowDriver [-d device] [-o options] volumeFileName volumeSize blockSize\n");
+				return -1;
+			}
+		}
+	// the positional arguments follow the options
+	argc -= optind - 1;
+	argv += optind - 1;
     
 	if (argc > 3)
 		{
@@ -735,11 +828,16 @@ int main (int argc, char * argv[])
 		}
 	else
 		{
-		printf ("Usage: fsLowDriver volumeFileName volumeSize blockSize\n");
+		printf ("Usage: fsLowDriver [-d device] [-o options] volumeFileName volumeSize blockSize\n");
+		return -1;
+		}
+
+	if (deviceOptions != NULL && configureBlockDevice (device, deviceOptions) != 0)
+		{
 		return -1;
 		}
 		
-	retVal = startPartitionSystem (filename, &volumeSize, &blockSize);	
+	retVal = openBlockDevice (device, filename, &volumeSize, &blockSize);	
 	printf("Opened %s, Volume Size: %llu;  BlockSize: %llu; Return %d\n", filename, (ull_t)volumeSize, (ull_t)blockSize, retVal);
 
 	if (retVal != PART_NOERROR)
@@ -753,7 +851,7 @@ int main (int argc, char * argv[])
 	if (retVal != 0)
 		{
 		printf ("Initialize File System Failed:  %d\n", retVal);
-		closePartitionSystem();
+		closeBlockDevice();
 		return (retVal);
 		}
 
@@ -840,7 +938,7 @@ int main (int argc, char * argv[])
 			free (cmd);
 			cmd = NULL;
 			exitFileSystem();
-			closePartitionSystem();
+			closeBlockDevice();
 			// exit while loop and terminate shell
 			break;
 			}
@@ -0,0 +1,476 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: fsstress.c
+ *
+ * Description::
+ *   Multi-threaded stress test, meant to be built with ThreadSanitizer
+ *   (make stress). Every thread works in a directory of its own and in
+ *   one shared directory at the same time: it creates, writes, reads
+ *   back, stats, lists and deletes files, makes and removes
+ *   directories, pwrites and preads its own blocks of one file all
+ *   threads have open, and its own bytes of another, whose blocks it
+ *   shares with other threads, and appends records to a log every thread
+ *   has open with O_APPEND. Everything read is checked against what was
+ *   written, and the shared file and directory are checked again once
+ *   the threads are done. Last, the threads all close the same fd at
+ *   once, over and over.
+ *
+ *   Usage: fsstress [-d device] [-o options] [-t threads] [-i iterations]
+ *          [volumeFileName volumeSize blockSize]
+ *   The volume is formatted from scratch and removed afterwards.
+ *
+ **************************************************************/
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "b_io.h"
+#include "blockDevice.h"
+#include "fsLow.h"
+#include "mfs.h"
+
+#define STRESS_MAX_THREADS 13  // each keeps up to two files in /shared, which holds 32
+#define STRESS_FILE_SIZE 6000    // bytes of each private file, not a multiple of a block
+#define STRESS_SHARED_SIZE 1000  // bytes of each file in the shared directory
+#define STRESS_REGION_BLOCKS 3   // blocks of the shared file each thread owns
+#define STRESS_RACE_SIZE 400     // bytes every thread writes to the file they all recreate
+#define STRESS_SLICE_SIZE 40     // bytes of the mixed file each thread owns, several to a block
+#define STRESS_LOG_ROUNDS 100    // rounds that append to the log, which must fit in one file
+
+// What a thread appends to the log each round, records cross block boundaries
+typedef struct {
+    int id;
+    int round;
+    char fill[28];
+} logRecord;
+#define STRESS_CLOSE_ROUNDS 100  // times every thread closes the same fd at once
+
+de_struct *rootDir = NULL;
+de_struct *cwDir = NULL;
+char *cwdName = NULL;
+
+static int threads = 8;
+static int iterations = 20;
+static uint64_t stressBlockSize = 0;
+static int failures = 0;  // atomic
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            printf("[stress] %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);                      \
+            return NULL;                                                             \
+        }                                                                            \
+    } while (0)
+
+// Byte i of what thread id writes in round it
+static char pattern(long id, int round, int i) {
+    return (char)(id * 31 + round * 7 + i);
+}
+
+static void fill(char *buffer, int length, long id, int round) {
+    for (int i = 0; i < length; i++) {
+        buffer[i] = pattern(id, round, i);
+    }
+}
+
+static int matches(const char *buffer, int length, long id, int round) {
+    for (int i = 0; i < length; i++) {
+        if (buffer[i] != pattern(id, round, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Count the entries of a directory, -1 if it cannot be opened
+static int countEntries(const char *path) {
+    char copy[LOCAL_PATH_MAX];
+    strcpy(copy, path);
+    fdDir *dir = fs_opendir(copy);
+    if (dir == NULL) {
+        return -1;
+    }
+    int count = 0;
+    while (fs_readdir(dir) != NULL) {
+        count++;
+    }
+    fs_closedir(dir);
+    return count;
+}
+
+static off_t fileSize(const char *path) {
+    char copy[LOCAL_PATH_MAX];
+    struct fs_stat st;
+    strcpy(copy, path);
+    if (fs_stat(copy, &st) != 0) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+static void *worker(void *arg) {
+    long id = (long)arg;
+    int region = STRESS_REGION_BLOCKS * stressBlockSize;
+    char path[LOCAL_PATH_MAX];
+    char copy[LOCAL_PATH_MAX];
+    int length = (region > STRESS_FILE_SIZE) ? region : STRESS_FILE_SIZE;
+    char *data = malloc(length);
+    char *back = malloc(length);
+    if (data == NULL || back == NULL) {
+        free(data);
+        free(back);
+        CHECK(0);
+    }
+
+    sprintf(path, "/t%ld", id);
+    CHECK(fs_mkdir(path, 0777) == 0);
+
+    // one fd on each shared file for the whole run, pwrite and pread only
+    strcpy(copy, "/shared/common");
+    b_io_fd common = b_open(copy, O_RDWR);
+    CHECK(common >= 0);
+    strcpy(copy, "/shared/mixed");
+    b_io_fd mixed = b_open(copy, O_RDWR);
+    CHECK(mixed >= 0);
+    strcpy(copy, "/shared/log");
+    b_io_fd appendLog = b_open(copy, O_WRONLY | O_APPEND);
+    CHECK(appendLog >= 0);
+
+    for (int round = 0; round < iterations; round++) {
+        // a private file: create, write, read back, stat
+        fill(data, length, id, round);
+        sprintf(path, "/t%ld/f%d", id, round);
+        b_io_fd fd = b_open(path, O_RDWR | O_CREAT | O_TRUNC);
+        CHECK(fd >= 0);
+        CHECK(b_write(fd, data, STRESS_FILE_SIZE) == STRESS_FILE_SIZE);
+        CHECK(b_close(fd) == 0);
+
+        fd = b_open(path, O_RDONLY);
+        CHECK(fd >= 0);
+        CHECK(b_read(fd, back, STRESS_FILE_SIZE) == STRESS_FILE_SIZE);
+        CHECK(b_close(fd) == 0);
+        CHECK(matches(back, STRESS_FILE_SIZE, id, round));
+        CHECK(fileSize(path) == STRESS_FILE_SIZE);
+
+        // a file in the directory every thread adds to and lists
+        sprintf(path, "/shared/t%ld_%d", id, round);
+        fd = b_open(path, O_WRONLY | O_CREAT);
+        CHECK(fd >= 0);
+        CHECK(b_write(fd, data, STRESS_SHARED_SIZE) == STRESS_SHARED_SIZE);
+        CHECK(b_close(fd) == 0);
+        CHECK(countEntries("/shared") >= 3);
+
+        // every thread opens the same file with O_CREAT | O_TRUNC, so some
+        // of them find it created by another while they were creating it
+        strcpy(copy, "/shared/race");
+        fd = b_open(copy, O_RDWR | O_CREAT | O_TRUNC);
+        CHECK(fd >= 0);
+        CHECK(b_write(fd, data, STRESS_RACE_SIZE) == STRESS_RACE_SIZE);
+        CHECK(b_close(fd) == 0);
+
+        // this thread's blocks of the shared file
+        off_t at = id * region;
+        CHECK(b_pwrite(common, data, region, at) == region);
+        CHECK(b_pread(common, back, region, at) == region);
+        CHECK(matches(back, region, id, round));
+
+        // this thread's bytes of the mixed file, in blocks other threads
+        // write through their own fds at the same time
+        at = id * STRESS_SLICE_SIZE;
+        CHECK(b_pwrite(mixed, data, STRESS_SLICE_SIZE, at) == STRESS_SLICE_SIZE);
+        CHECK(b_pread(mixed, back, STRESS_SLICE_SIZE, at) == STRESS_SLICE_SIZE);
+        CHECK(matches(back, STRESS_SLICE_SIZE, id, round));
+
+        // a record at the end of the log, which the other threads append to
+        // through their own fds
+        if (round < STRESS_LOG_ROUNDS) {
+            logRecord record = {(int)id, round};
+            fill(record.fill, sizeof(record.fill), id, round);
+            CHECK(b_write(appendLog, (char *)&record, sizeof(record)) == sizeof(record));
+        }
+
+        // a directory that comes and goes, the calls take their path apart
+        sprintf(path, "/t%ld/d%d", id, round);
+        CHECK(fs_mkdir(path, 0777) == 0);
+        sprintf(path, "/t%ld/d%d", id, round);
+        CHECK(fs_isDir(path));
+        sprintf(path, "/t%ld/d%d", id, round);
+        CHECK(fs_rmdir(path) == 0);
+
+        // only the files of the last round are kept
+        if (round > 0) {
+            sprintf(path, "/t%ld/f%d", id, round - 1);
+            CHECK(fs_delete(path) == 0);
+            sprintf(path, "/shared/t%ld_%d", id, round - 1);
+            CHECK(fs_delete(path) == 0);
+        }
+    }
+    CHECK(b_close(common) == 0);
+    CHECK(b_close(mixed) == 0);
+    CHECK(b_close(appendLog) == 0);
+
+    sprintf(path, "/t%ld", id);
+    CHECK(countEntries(path) == 3);  // ".", ".." and the last private file
+
+    free(data);
+    free(back);
+    return NULL;
+}
+
+// The shared file and directory once every thread is done
+static int checkShared() {
+    int region = STRESS_REGION_BLOCKS * stressBlockSize;
+    int ok = 1;
+    char copy[LOCAL_PATH_MAX];
+    char *back = malloc(region);
+    strcpy(copy, "/shared/common");
+    b_io_fd fd = b_open(copy, O_RDONLY);
+    if (back == NULL || fd < 0) {
+        free(back);
+        return 0;
+    }
+    for (long id = 0; id < threads && ok; id++) {
+        if (b_read(fd, back, region) != region || !matches(back, region, id, iterations - 1)) {
+            printf("[stress] Region of thread %ld in the shared file is wrong\n", id);
+            ok = 0;
+        }
+    }
+    b_close(fd);
+
+    // no thread's last write to the mixed file was lost to another's
+    strcpy(copy, "/shared/mixed");
+    fd = b_open(copy, O_RDONLY);
+    for (long id = 0; id < threads && ok; id++) {
+        if (fd < 0 || b_read(fd, back, STRESS_SLICE_SIZE) != STRESS_SLICE_SIZE ||
+            !matches(back, STRESS_SLICE_SIZE, id, iterations - 1)) {
+            printf("[stress] Bytes of thread %ld in the mixed file are wrong\n", id);
+            ok = 0;
+        }
+    }
+    if (fd >= 0) {
+        b_close(fd);
+    }
+
+    // every record appended to the log is there once and whole
+    int rounds = (iterations < STRESS_LOG_ROUNDS) ? iterations : STRESS_LOG_ROUNDS;
+    int records = threads * rounds;
+    char *seen = calloc(records, 1);
+    strcpy(copy, "/shared/log");
+    fd = b_open(copy, O_RDONLY);
+    logRecord record;
+    int count = 0;
+    while (seen != NULL && fd >= 0 && b_read(fd, (char *)&record, sizeof(record)) == sizeof(record)) {
+        int slot = record.id * rounds + record.round;
+        if (record.id < 0 || record.id >= threads || record.round < 0 || record.round >= rounds ||
+            seen[slot] || !matches(record.fill, sizeof(record.fill), record.id, record.round)) {
+            break;
+        }
+        seen[slot] = 1;
+        count++;
+    }
+    if (count != records || fileSize("/shared/log") != (off_t)(records * sizeof(record))) {
+        printf("[stress] The log holds %d good records, expected %d\n", count, records);
+        ok = 0;
+    }
+    if (fd >= 0) {
+        b_close(fd);
+    }
+    free(seen);
+
+    // whoever wrote the recreated file last, it holds one whole write
+    strcpy(copy, "/shared/race");
+    fd = b_open(copy, O_RDONLY);
+    int found = 0;
+    if (fd >= 0 && b_read(fd, back, region) == STRESS_RACE_SIZE) {
+        for (long id = 0; id < threads && !found; id++) {
+            for (int round = 0; round < iterations && !found; round++) {
+                found = matches(back, STRESS_RACE_SIZE, id, round);
+            }
+        }
+    }
+    if (!found) {
+        printf("[stress] The recreated file does not hold one whole write\n");
+        ok = 0;
+    }
+    if (fd >= 0) {
+        b_close(fd);
+    }
+    free(back);
+
+    int expected = 6 + threads;  // ".", "..", common, mixed, log, race and one file per thread
+    int entries = countEntries("/shared");
+    if (entries != expected) {
+        printf("[stress] /shared has %d entries, expected %d\n", entries, expected);
+        ok = 0;
+    }
+    return ok;
+}
+
+// An fd every thread closes, and what b_close returned to this one
+typedef struct {
+    b_io_fd fd;
+    pthread_barrier_t *start;
+    int result;
+} closeArg;
+
+static void *closeFd(void *arg) {
+    closeArg *job = arg;
+    pthread_barrier_wait(job->start);
+    job->result = b_close(job->fd);
+    return NULL;
+}
+
+// Every thread closes the same fd at once, only one close may succeed and
+// free the fd. This runs with no other thread opening files, which could
+// otherwise be handed the fd between two of the closes.
+static int checkCloses() {
+    pthread_t thread[STRESS_MAX_THREADS];
+    closeArg job[STRESS_MAX_THREADS];
+    pthread_barrier_t start;
+    char copy[LOCAL_PATH_MAX];
+    int ok = 1;
+
+    for (int round = 0; round < STRESS_CLOSE_ROUNDS && ok; round++) {
+        b_io_fd fd = b_open(strcpy(copy, "/shared/common"), O_RDONLY);
+        if (fd < 0) {
+            return 0;
+        }
+        pthread_barrier_init(&start, NULL, threads);
+        for (int i = 0; i < threads; i++) {
+            job[i].fd = fd;
+            job[i].start = &start;
+            pthread_create(&thread[i], NULL, closeFd, &job[i]);
+        }
+        int closed = 0;
+        for (int i = 0; i < threads; i++) {
+            pthread_join(thread[i], NULL);
+            closed += job[i].result == 0;
+        }
+        pthread_barrier_destroy(&start);
+        if (closed != 1) {
+            printf("[stress] %d threads closing fd %d at once, %d closes succeeded\n", threads, fd, closed);
+            ok = 0;
+        }
+    }
+
+    // an fd freed more than once is on the free list twice, and files
+    // open at the same time would be given the same fd
+    b_io_fd open[STRESS_MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        open[i] = b_open(strcpy(copy, "/shared/common"), O_RDONLY);
+        for (int j = 0; j < i; j++) {
+            if (open[i] < 0 || open[i] == open[j]) {
+                printf("[stress] Two open files share fd %d\n", open[i]);
+                ok = 0;
+            }
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        b_close(open[i]);
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    char *device = NULL;
+    char *deviceOptions = NULL;
+    char *filename = "StressVolume";
+    uint64_t volumeSize = 10000000;
+    uint64_t blockSize = 512;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:o:t:i:")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 'o':
+            deviceOptions = optarg;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        default:
+            printf("Usage: fsstress [-d device] [-o options] [-t threads] [-i iterations] "
+                   "[volumeFileName volumeSize blockSize]\n");
+            return -1;
+        }
+    }
+    if (optind + 3 <= argc) {
+        filename = argv[optind];
+        volumeSize = atoll(argv[optind + 1]);
+        blockSize = atoll(argv[optind + 2]);
+    }
+    if (threads < 1 || threads > STRESS_MAX_THREADS || iterations < 1) {
+        printf("[stress] Need 1-%d threads and at least one iteration\n", STRESS_MAX_THREADS);
+        return -1;
+    }
+
+    remove(filename);
+    if (deviceOptions != NULL && configureBlockDevice(device, deviceOptions) != 0) {
+        return -1;
+    }
+    if (openBlockDevice(device, filename, &volumeSize, &blockSize) != PART_NOERROR) {
+        printf("[stress] Failed to open %s\n", filename);
+        return -1;
+    }
+    if (initFileSystem(volumeSize / blockSize, blockSize) != 0) {
+        printf("[stress] Failed to format %s\n", filename);
+        closeBlockDevice();
+        return -1;
+    }
+    stressBlockSize = blockSize;
+
+    // the shared files start out at their full size, every thread owns a
+    // region of one and a slice of the other, the log starts out empty
+    char path[LOCAL_PATH_MAX];
+    strcpy(path, "/shared");
+    int size = threads * STRESS_REGION_BLOCKS * blockSize;
+    int mixedSize = threads * STRESS_SLICE_SIZE;
+    char *zero = calloc(1, size);
+    b_io_fd fd = -1;
+    b_io_fd mixed = -1;
+    if (zero == NULL || fs_mkdir(path, 0777) != 0 ||
+        (fd = b_open(strcpy(path, "/shared/common"), O_WRONLY | O_CREAT)) < 0 ||
+        b_write(fd, zero, size) != size || b_close(fd) != 0 ||
+        (mixed = b_open(strcpy(path, "/shared/mixed"), O_WRONLY | O_CREAT)) < 0 ||
+        b_write(mixed, zero, mixedSize) != mixedSize || b_close(mixed) != 0 ||
+        (fd = b_open(strcpy(path, "/shared/log"), O_WRONLY | O_CREAT)) < 0 || b_close(fd) != 0) {
+        printf("[stress] Failed to create the shared files\n");
+        free(zero);
+        exitFileSystem();
+        closeBlockDevice();
+        return -1;
+    }
+    free(zero);
+
+    pthread_t thread[STRESS_MAX_THREADS];
+    for (long i = 0; i < threads; i++) {
+        pthread_create(&thread[i], NULL, worker, (void *)i);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(thread[i], NULL);
+    }
+
+    int ok = failures == 0 && checkShared() && checkCloses();
+    exitFileSystem();
+    closeBlockDevice();
+    remove(filename);
+
+    printf("[stress] %d threads x %d iterations: %s\n", threads, iterations, ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: ioQueue.c
+ *
+ * Description::
+ *   Batches block device requests. Callers that would loop over
+ *   single blocks (directory loads and rewrites, erasing freed
+ *   blocks) queue them instead and dispatch once: the requests of
+ *   every segment between barriers are sorted by LBA, one sweep
+ *   across the disk, and neighbours going the same way are merged
+ *   into a single device call: writes through a staging buffer,
+ *   reads with deviceReadv straight into each request's buffer.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blockDevice.h"
+#include "ioQueue.h"
+
+void ioQueueInit(ioQueue *queue, uint64_t blockSize) {
+    queue->requests = NULL;
+    queue->count = 0;
+    queue->capacity = 0;
+    queue->segment = 0;
+    queue->segmentStart = 0;
+    queue->blockSize = blockSize;
+    queue->deviceCalls = 0;
+}
+
+void ioQueueFree(ioQueue *queue) {
+    free(queue->requests);
+    ioQueueInit(queue, queue->blockSize);
+}
+
+void ioQueueBarrier(ioQueue *queue) {
+    if (queue->segmentStart < queue->count) {
+        queue->segment++;
+        queue->segmentStart = queue->count;
+    }
+}
+
+int ioQueueAdd(ioQueue *queue, int write, void *buffer, uint64_t count, uint64_t lba) {
+    if (queue->count == queue->capacity) {
+        int capacity = (queue->capacity == 0) ? 16 : queue->capacity * 2;
+        ioRequest *grown = realloc(queue->requests, capacity * sizeof(ioRequest));
+        if (grown == NULL) {
+            return -1;
+        }
+        queue->requests = grown;
+        queue->capacity = capacity;
+    }
+
+    for (int i = queue->segmentStart; i < queue->count; i++) {
+        ioRequest *other = &queue->requests[i];
+        if ((write || other->write) && lba < other->lba + other->count && other->lba < lba + count) {
+            ioQueueBarrier(queue);
+            break;
+        }
+    }
+
+    ioRequest *request = &queue->requests[queue->count++];
+    request->lba = lba;
+    request->count = count;
+    request->buffer = buffer;
+    request->write = write;
+    request->segment = queue->segment;
+    request->done = 0;
+    return 0;
+}
+
+// Segment first, then LBA, then the order they were queued in
+static int compareRequests(const void *a, const void *b) {
+    const ioRequest *x = *(ioRequest *const *)a;
+    const ioRequest *y = *(ioRequest *const *)b;
+    if (x->segment != y->segment) {
+        return x->segment - y->segment;
+    }
+    if (x->lba != y->lba) {
+        return (x->lba > y->lba) - (x->lba < y->lba);
+    }
+    return (x > y) - (x < y);
+}
+
+// Share the blocks one merged device call moved out among its requests
+static void creditRun(ioRequest **run, int length, uint64_t moved) {
+    for (int k = 0; k < length; k++) {
+        run[k]->done = (moved > run[k]->count) ? run[k]->count : moved;
+        moved -= run[k]->done;
+    }
+}
+
+int ioQueueDispatch(ioQueue *queue) {
+    queue->deviceCalls = 0;
+    if (queue->count == 0) {
+        return 0;
+    }
+
+    ioRequest **sorted = malloc(queue->count * sizeof(ioRequest *));
+    char *staging = allocBlockBuffer(IO_QUEUE_MAX_RUN * queue->blockSize);
+    if (sorted == NULL || staging == NULL) {
+        printf("[ioQueue] Failed to allocate dispatch buffers\n");
+        free(sorted);
+        free(staging);
+        return -1;
+    }
+    for (int i = 0; i < queue->count; i++) {
+        sorted[i] = &queue->requests[i];
+    }
+    qsort(sorted, queue->count, sizeof(ioRequest *), compareRequests);
+
+    int result = 0;
+    for (int i = 0; i < queue->count;) {
+        // gather the requests that continue where the previous one ends
+        ioRequest *first = sorted[i];
+        uint64_t blocks = first->count;
+        int length = 1;
+        while (i + length < queue->count) {
+            ioRequest *next = sorted[i + length];
+            if (next->segment != first->segment || next->write != first->write ||
+                next->lba != first->lba + blocks || blocks + next->count > IO_QUEUE_MAX_RUN) {
+                break;
+            }
+            blocks += next->count;
+            length++;
+        }
+
+        uint64_t moved;
+        if (length == 1) {
+            moved = first->write ? deviceWrite(first->buffer, first->count, first->lba)
+                                 : deviceRead(first->buffer, first->count, first->lba);
+        } else if (first->write) {
+            char *at = staging;
+            for (int k = 0; k < length; k++) {
+                memcpy(at, sorted[i + k]->buffer, sorted[i + k]->count * queue->blockSize);
+                at += sorted[i + k]->count * queue->blockSize;
+            }
+            moved = deviceWrite(staging, blocks, first->lba);
+        } else {
+            // every request's buffer takes its part of the run directly
+            struct iovec iov[IO_QUEUE_MAX_RUN];
+            for (int k = 0; k < length; k++) {
+                iov[k].iov_base = sorted[i + k]->buffer;
+                iov[k].iov_len = sorted[i + k]->count * queue->blockSize;
+            }
+            moved = deviceReadv(iov, length, first->lba);
+        }
+        queue->deviceCalls++;
+
+        creditRun(sorted + i, length, moved);
+        if (moved != blocks) {
+            result = -1;
+        }
+        i += length;
+    }
+
+    free(sorted);
+    free(staging);
+    return result;
+}
@@ -0,0 +1,63 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: ioQueue.h
+ *
+ * Description::
+ *	Queue of block device requests that are dispatched together:
+ *	sorted by LBA, adjacent ones merged into one device call. A
+ *	barrier keeps the requests queued before it ahead of the ones
+ *	queued after it.
+ *
+ **************************************************************/
+
+#ifndef IOQUEUE_H
+#define IOQUEUE_H
+
+#include "fsLow.h"
+
+// The longest run of blocks merged into one device call.
+#define IO_QUEUE_MAX_RUN 64
+
+typedef struct ioRequest {
+    uint64_t lba;
+    uint64_t count;
+    char *buffer;
+    int write;
+    int segment;   // requests are only reordered among those between the same barriers
+    uint64_t done; // blocks transferred, set by ioQueueDispatch
+} ioRequest;
+
+typedef struct ioQueue {
+    ioRequest *requests;
+    int count;
+    int capacity;
+    int segment;      // current segment, bumped by every barrier
+    int segmentStart; // first request of the current segment
+    uint64_t blockSize;
+    int deviceCalls;  // made by the last dispatch
+} ioQueue;
+
+void ioQueueInit(ioQueue *queue, uint64_t blockSize);
+void ioQueueFree(ioQueue *queue);
+
+// Queue a read or write of count blocks at lba, nothing moves until
+// ioQueueDispatch. A request overlapping one already queued, with a write
+// on either side, gets a barrier in front of it so it still sees or
+// overwrites the earlier one. Returns -1 if out of memory.
+int ioQueueAdd(ioQueue *queue, int write, void *buffer, uint64_t count, uint64_t lba);
+
+// Requests queued after this go to the device after all queued before it.
+void ioQueueBarrier(ioQueue *queue);
+
+// Run every queued request. requests[] stays in the order they were queued,
+// the done count of each tells what it moved. Returns 0 if all of them
+// were complete.
+int ioQueueDispatch(ioQueue *queue);
+
+#endif
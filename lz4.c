@@ -0,0 +1,230 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: lz4.c
+ *
+ * Description::
+ *   LZ4 block format: a run of sequences, each a token byte (literal
+ *   count in the high nibble, match length - 4 in the low one, 15
+ *   meaning more length bytes follow), the literals, and a two byte
+ *   offset back to the match. The last sequence is literals only.
+ *
+ *   The compressor is the greedy single pass kind: a hash of the next
+ *   four bytes finds the last position they were seen at, and the
+ *   longer it goes without a match the further it skips ahead, so
+ *   data that does not compress costs little time. Inputs are small
+ *   (a chunk of a file), so every offset fits in two bytes.
+ *
+ **************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4.h"
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_HASH_LOG 12
+#define LZ4_LAST_LITERALS 5 // the last bytes of a block are always literals
+#define LZ4_MATCH_LIMIT 12  // no match starts in the last bytes of a block
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_SKIP_TRIGGER 6  // misses before the step grows by one
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static int hash4(uint32_t value) {
+    return (value * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+// Length bytes after the token for a count of 15 or more
+static unsigned char *putLength(unsigned char *op, int length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+// Bytes a sequence with this many literals and match length takes at most
+static int sequenceSize(int literals, int matchLength) {
+    return 1 + literals / 255 + 1 + literals + 2 + matchLength / 255 + 1;
+}
+
+int lz4Compress(const void *source, int sourceLength, void *dest, int destCapacity) {
+    const unsigned char *base = source;
+    const unsigned char *end = base + sourceLength;
+    const unsigned char *ip = base;
+    const unsigned char *anchor = base; // first byte not covered by a sequence yet
+    unsigned char *op = dest;
+    unsigned char *opEnd = op + destCapacity;
+    int table[1 << LZ4_HASH_LOG];
+
+    if (sourceLength > LZ4_MAX_OFFSET + 1) {
+        return 0;
+    }
+
+    if (sourceLength > LZ4_MATCH_LIMIT) {
+        const unsigned char *matchStartLimit = end - LZ4_MATCH_LIMIT;
+        const unsigned char *matchEndLimit = end - LZ4_LAST_LITERALS;
+        memset(table, 0, sizeof(table));
+        int misses = 0;
+
+        while (ip <= matchStartLimit) {
+            uint32_t sequence = read32(ip);
+            int h = hash4(sequence);
+            const unsigned char *match = base + table[h];
+            table[h] = ip - base;
+
+            if (match >= ip || read32(match) != sequence) {
+                ip += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            // take in equal bytes before the match, then extend it forward
+            while (ip > anchor && match > base && ip[-1] == match[-1]) {
+                ip--;
+                match--;
+            }
+            const unsigned char *matchEnd = ip + LZ4_MIN_MATCH;
+            const unsigned char *other = match + LZ4_MIN_MATCH;
+            while (matchEnd < matchEndLimit && *matchEnd == *other) {
+                matchEnd++;
+                other++;
+            }
+
+            int literals = ip - anchor;
+            int matchLength = matchEnd - ip - LZ4_MIN_MATCH;
+            if (sequenceSize(literals, matchLength) > opEnd - op) {
+                return 0;
+            }
+
+            unsigned char *token = op++;
+            *token = ((literals < 15) ? literals : 15) << 4;
+            if (literals >= 15) {
+                op = putLength(op, literals - 15);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            int offset = ip - match;
+            *op++ = offset & 0xFF;
+            *op++ = offset >> 8;
+            *token |= (matchLength < 15) ? matchLength : 15;
+            if (matchLength >= 15) {
+                op = putLength(op, matchLength - 15);
+            }
+
+            ip = matchEnd;
+            anchor = ip;
+
+            // remember a position inside the match as well, repeats are
+            // often found right after one
+            table[hash4(read32(ip - 2))] = ip - 2 - base;
+        }
+    }
+
+    // the rest goes out as literals
+    int literals = end - anchor;
+    if (1 + literals / 255 + 1 + literals > opEnd - op) {
+        return 0;
+    }
+    unsigned char *token = op++;
+    *token = ((literals < 15) ? literals : 15) << 4;
+    if (literals >= 15) {
+        op = putLength(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    return op - (unsigned char *)dest;
+}
+
+// Read the length bytes after a token, -1 if the input ends first
+static int getLength(const unsigned char **ip, const unsigned char *ipEnd) {
+    int length = 0;
+    unsigned char byte;
+    do {
+        if (*ip >= ipEnd) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+int lz4Decompress(const void *source, int sourceLength, void *dest, int destLength) {
+    const unsigned char *ip = source;
+    const unsigned char *ipEnd = ip + sourceLength;
+    unsigned char *op = dest;
+    unsigned char *opEnd = op + destLength;
+
+    while (ip < ipEnd) {
+        unsigned char token = *ip++;
+
+        int literals = token >> 4;
+        if (literals == 15) {
+            int more = getLength(&ip, ipEnd);
+            if (more < 0) {
+                return -1;
+            }
+            literals += more;
+        }
+        if (literals > ipEnd - ip || literals > opEnd - op) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // the last sequence has no match
+        if (ip == ipEnd) {
+            break;
+        }
+
+        if (ipEnd - ip < 2) {
+            return -1;
+        }
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - (unsigned char *)dest) {
+            return -1;
+        }
+
+        int matchLength = token & 15;
+        if (matchLength == 15) {
+            int more = getLength(&ip, ipEnd);
+            if (more < 0) {
+                return -1;
+            }
+            matchLength += more;
+        }
+        matchLength += LZ4_MIN_MATCH;
+        if (matchLength > opEnd - op) {
+            return -1;
+        }
+
+        // a match closer than its length repeats the bytes it is copying
+        const unsigned char *match = op - offset;
+        if (offset >= matchLength) {
+            memcpy(op, match, matchLength);
+            op += matchLength;
+        } else {
+            while (matchLength-- > 0) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return op - (unsigned char *)dest;
+}
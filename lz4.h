@@ -0,0 +1,29 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: lz4.h
+ *
+ * Description::
+ *	Compression in the LZ4 block format, fast enough to sit in
+ *	the read and write path of compressed files.
+ *
+ **************************************************************/
+
+#ifndef LZ4_H
+#define LZ4_H
+
+// Compress sourceLength bytes (at most 64 KB) into dest. Returns the
+// compressed length, 0 if it does not fit in destCapacity bytes.
+int lz4Compress(const void *source, int sourceLength, void *dest, int destCapacity);
+
+// Decompress sourceLength bytes of compressed data into dest, which has
+// room for destLength bytes. Returns the decompressed length, -1 if the
+// data is malformed or would not fit.
+int lz4Decompress(const void *source, int sourceLength, void *dest, int destLength);
+
+#endif
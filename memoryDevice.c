@@ -0,0 +1,183 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: memoryDevice.c
+ *
+ * Description::
+ *   Block device backend that keeps the whole volume in RAM, so
+ *   benchmarks of the file system itself are not disturbed by the
+ *   host disk. A volume named MEMORY_VOLUME starts out empty and is
+ *   gone when it is closed. Any other name is a volume file that is
+ *   loaded into memory when opened and gets the blocks written since
+ *   then saved back when closed (a snapshot). The file is read and
+ *   written through the LBA layer, so it keeps its partition header.
+ *
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blockDevice.h"
+
+typedef struct memoryState {
+    char *blocks;        // the volume
+    char *written;       // one byte per block, set once the block changed
+    uint64_t blockSize;
+    uint64_t blockCount;
+    char *snapshot;      // volume file saved to on close, NULL for MEMORY_VOLUME
+} memoryState;
+
+static memoryState memory = {0};
+
+static int memoryOpen(blockDevice *dev, char *filename, uint64_t *volSize, uint64_t *blockSize) {
+    memoryState *st = dev->state;
+    int fromFile = strcmp(filename, MEMORY_VOLUME) != 0;
+
+    // a volume file may set its own size, same as with the LBA layer
+    if (fromFile) {
+        int result = startPartitionSystem(filename, volSize, blockSize);
+        if (result != PART_NOERROR) {
+            return result;
+        }
+    }
+
+    st->blockSize = *blockSize;
+    st->blockCount = *volSize / *blockSize;
+    st->blocks = allocBlockBuffer(st->blockCount * st->blockSize);
+    st->written = calloc(st->blockCount, 1);
+    if (st->blocks == NULL || st->written == NULL) {
+        printf("[memoryDevice] Not enough memory for a %llu byte volume\n", (ull_t)*volSize);
+        free(st->blocks);
+        free(st->written);
+        st->blocks = NULL;
+        st->written = NULL;
+        if (fromFile) {
+            closePartitionSystem();
+        }
+        return PART_ERR_INVALID;
+    }
+
+    if (!fromFile) {
+        memset(st->blocks, 0, st->blockCount * st->blockSize);
+        st->snapshot = NULL;
+        return PART_NOERROR;
+    }
+
+    uint64_t loaded = LBAread(st->blocks, st->blockCount, 0);
+    closePartitionSystem();
+    if (loaded != st->blockCount) {
+        printf("[memoryDevice] Failed to load %s\n", filename);
+        free(st->blocks);
+        free(st->written);
+        st->blocks = NULL;
+        st->written = NULL;
+        return -1;
+    }
+    st->snapshot = strdup(filename);
+    return PART_NOERROR;
+}
+
+static uint64_t memoryRead(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    memoryState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return 0;
+    }
+    memcpy(buffer, st->blocks + lbaPosition * st->blockSize, lbaCount * st->blockSize);
+    return lbaCount;
+}
+
+static uint64_t memoryWrite(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    memoryState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return 0;
+    }
+    memcpy(st->blocks + lbaPosition * st->blockSize, buffer, lbaCount * st->blockSize);
+    for (uint64_t i = 0; i < lbaCount; i++) {
+        __atomic_store_n(&st->written[lbaPosition + i], 1, __ATOMIC_RELAXED);
+    }
+    return lbaCount;
+}
+
+static int memoryDiscard(blockDevice *dev, uint64_t lbaCount, uint64_t lbaPosition) {
+    memoryState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return -1;
+    }
+    memset(st->blocks + lbaPosition * st->blockSize, 0, lbaCount * st->blockSize);
+    for (uint64_t i = 0; i < lbaCount; i++) {
+        __atomic_store_n(&st->written[lbaPosition + i], 1, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+// Write the blocks changed since the volume was loaded back to its file,
+// one LBAwrite per run of changed blocks
+static int memorySave(memoryState *st) {
+    uint64_t volSize = st->blockCount * st->blockSize;
+    uint64_t blockSize = st->blockSize;
+    if (startPartitionSystem(st->snapshot, &volSize, &blockSize) != PART_NOERROR) {
+        printf("[memoryDevice] Cannot open %s to save the volume\n", st->snapshot);
+        return -1;
+    }
+
+    int result = 0;
+    for (uint64_t i = 0; i < st->blockCount;) {
+        if (!st->written[i]) {
+            i++;
+            continue;
+        }
+        uint64_t run = 1;
+        while (i + run < st->blockCount && st->written[i + run]) {
+            run++;
+        }
+        if (LBAwrite(st->blocks + i * st->blockSize, run, i) != run) {
+            printf("[memoryDevice] Error saving blocks %llu-%llu\n", (ull_t)i, (ull_t)(i + run - 1));
+            result = -1;
+            break;
+        }
+        memset(st->written + i, 0, run);
+        i += run;
+    }
+    closePartitionSystem();
+    return result;
+}
+
+static int memoryClose(blockDevice *dev) {
+    memoryState *st = dev->state;
+    if (st->blocks == NULL) {
+        return 0;
+    }
+    int result = (st->snapshot != NULL) ? memorySave(st) : 0;
+    free(st->blocks);
+    free(st->written);
+    free(st->snapshot);
+    st->blocks = NULL;
+    st->written = NULL;
+    st->snapshot = NULL;
+    return result;
+}
+
+static void *memoryMap(blockDevice *dev, uint64_t lbaCount, uint64_t lbaPosition) {
+    memoryState *st = dev->state;
+    if (st->blocks == NULL || lbaPosition + lbaCount > st->blockCount) {
+        return NULL;
+    }
+    return st->blocks + lbaPosition * st->blockSize;
+}
+
+blockDevice memoryDevice = {
+    .name = "memory",
+    .open = memoryOpen,
+    .read = memoryRead,
+    .write = memoryWrite,
+    .discard = memoryDiscard,
+    .close = memoryClose,
+    .map = memoryMap,
+    .state = &memory,
+};
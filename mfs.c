@@ -14,14 +14,59 @@
  **************************************************************/
 
 #include "mfs.h"
+#include "blockCache.h"
+#include "blockChecksum.h"
+#include "blockDevice.h"
 #include "freeSpace.h"
 #include "fsLow.h"
+#include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <pthread.h>
+
+// Every directory in memory lives in the directory cache, keyed by its first
+// block. Sharing one copy keeps all users of a directory coherent and gives
+// each directory its own reader/writer lock.
+#define DIR_CACHE_BUCKETS 64
+
+typedef struct dirCacheEntry {
+    de_struct *dir;   // NULL while the directory is being read
+    int startBlock;   // first block of the directory on disk
+    int removed;      // set by rmdir or a failed read, the entry is only kept until exit
+    int loading;      // the directory is being read, wait on dirLoaded for it
+    pthread_rwlock_t lock;
+    struct dirCacheEntry *next;
+} dirCacheEntry;
+
+static dirCacheEntry *dirCache[DIR_CACHE_BUCKETS];
+static pthread_rwlock_t dirCacheLock = PTHREAD_RWLOCK_INITIALIZER;
+
+// A directory is read from disk without dirCacheLock held, behind an entry
+// marked loading. Other threads looking for it wait here until it is read.
+// Lock order is dirCacheLock, then dirLoadLock.
+static pthread_mutex_t dirLoadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dirLoaded = PTHREAD_COND_INITIALIZER;
+
+// A working directory that a thread can carry instead of the process wide
+// cwDir and cwdName
+struct fs_context {
+    de_struct *dir;
+    char name[LOCAL_PATH_MAX];
+};
+
+// Context bound to the calling thread, NULL while it uses cwDir and cwdName
+static _Thread_local fs_context *threadContext = NULL;
+
+// Guards cwDir and cwdName, which are shared by every thread without a context
+static pthread_mutex_t cwdLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void forgetDirectory(de_struct *dir);
+static int resolvePath(de_struct *startParent, char *pathName, parseInfo *ppi);
+static de_struct *currentDirectory(char *name);
 
 time_t getTime() {
     time_t now;
@@ -46,7 +91,7 @@ int *newDir(de_struct *parentDir, mode_t mode) {
     }
 
     // create directory de_struct array
-    de_struct *dir = malloc(blocksNeeded * BLOCK_SIZE);
+    de_struct *dir = allocBlockBuffer(blocksNeeded * BLOCK_SIZE);
     if (dir == NULL) {
         printf("Error allocating buffer for new directory\n");
         return NULL;
@@ -63,6 +108,7 @@ int *newDir(de_struct *parentDir, mode_t mode) {
         dir[i].date_created = 0;
         dir[i].date_modified = 0;
         dir[i].is_directory = 0;
+        dir[i].flags = 0;
     }
 
     // grab time
@@ -78,6 +124,7 @@ int *newDir(de_struct *parentDir, mode_t mode) {
     dir[0].date_created = now;
     dir[0].date_modified = now;
     dir[0].is_directory = 1;
+    dir[0].flags = isRoot ? 0 : (parentDir[0].flags & DE_COMPRESS); // compression is inherited
 
     // initialize .. entry
     strcpy(dir[1].file_name, "..");
@@ -93,15 +140,14 @@ int *newDir(de_struct *parentDir, mode_t mode) {
     dir[1].date_created = now;
     dir[1].date_modified = now;
     dir[1].is_directory = 1;
+    dir[1].flags = dir[0].flags;
 
-    // write each block individually based on . blocks_allocated array
-    for (int i = 0; i < blocksNeeded; i++) {
-        void *dirToBlocks = (void *)((char *)dir + i * BLOCK_SIZE);
-        if (LBAwrite(dirToBlocks, 1, dir[0].blocks_allocated[i]) != 1) {
-            printf("Error writing block %d for new directory\n", i);
-            free(dir);
-            return NULL;
-        }
+    // write the blocks listed in the . blocks_allocated array
+    checksumMarkMetadata(dir[0].blocks_allocated, blocksNeeded);
+    if (cacheWriteBlocks(dir, dir[0].blocks_allocated, blocksNeeded) != blocksNeeded) {
+        printf("Error writing blocks for new directory\n");
+        free(dir);
+        return NULL;
     }
 
     if (isRoot)
@@ -125,9 +171,12 @@ int fs_mkdir(const char *pathname, mode_t mode) {
     }
     parentDir = ppi->parent;
 
+    lockDirectory(parentDir, 1);
+
     // check if the directory already exists
     if (findInDirectory(ppi->lastElementName, parentDir) != -1) {
         printf("Error directory %s already exists at %s\n", ppi->lastElementName, pathname);
+        unlockDirectory(parentDir);
         free(ppi);
         return -1;
     }
@@ -136,6 +185,7 @@ int fs_mkdir(const char *pathname, mode_t mode) {
     int *newDirBlocks = newDir(parentDir, mode);
     if (newDirBlocks == NULL) {
         printf("Error creating new directory\n");
+        unlockDirectory(parentDir);
         free(ppi);
         return -1;
     }
@@ -157,30 +207,34 @@ int fs_mkdir(const char *pathname, mode_t mode) {
             parentDir[i].date_created = now;
             parentDir[i].date_modified = now;
             parentDir[i].is_directory = 1;
+            parentDir[i].flags = parentDir[0].flags & DE_COMPRESS;
 
             // write the updated directory to disk
-            for (int i = 0; i < parentDir[0].blocks_count; i++) {
-                void *dirToBlocks = (void *)((char *)parentDir + i * BLOCK_SIZE);
-                if (LBAwrite(dirToBlocks, 1, parentDir[0].blocks_allocated[i]) != 1) {
-                    printf("Error writing updated block %d for parent directory\n", i);
-                    if (parentDir != rootDir && parentDir != cwDir) {
-                        free(parentDir);
-                    }
-                    return -1;
-                }
+            if (cacheWriteBlocks(parentDir, parentDir[0].blocks_allocated, parentDir[0].blocks_count) !=
+                parentDir[0].blocks_count) {
+                printf("Error writing updated blocks of parent directory\n");
+                unlockDirectory(parentDir);
+                free(ppi);
+                return -1;
             }
+            unlockDirectory(parentDir);
+            free(ppi);
             return 0;
         }
     }
 
     printf("Error failed to find a blank directory entry in %s for %s\n", pathname, ppi->lastElementName);
+    unlockDirectory(parentDir);
+    free(ppi);
     return -1;
 }
 
 int fs_rmdir(const char *pathname) {
-
     // cannot delete cwd
-    if (strcmp(pathname, cwdName) == 0) {
+    char cwdCopy[LOCAL_PATH_MAX];
+    currentDirectory(cwdCopy);
+
+    if (strcmp(pathname, cwdCopy) == 0) {
         printf("Error cannot delete current working directory\n");
         return -1;
     }
@@ -197,36 +251,52 @@ int fs_rmdir(const char *pathname) {
     }
     parentDir = ppi->parent;
 
-    // check if the directory exists in the parent directory
-    if (findInDirectory(ppi->lastElementName, parentDir) == -1) {
-        printf("Error directory %s does not exist in parentDir\n", ppi->lastElementName);
+    // cannot delete cwd
+    const char *slash = strrchr(cwdCopy, '/');                   // gets the last slash
+    const char *pathEnd = (slash != NULL) ? slash + 1 : cwdCopy; // gets the last entry of the path
+    if (ppi->lastElementName != NULL && strcmp(ppi->lastElementName, pathEnd) == 0) {
+        printf("Error cannot delete current working directory\n");
         free(ppi);
         return -1;
     }
 
-    // cannot delete cwd
-    const char *slash = strrchr(cwdName, '/');                   // gets the last slash
-    const char *pathEnd = (slash != NULL) ? slash + 1 : cwdName; // gets the last entry of the path
-    if (strcmp(ppi->lastElementName, pathEnd) == 0) {
-        printf("Error cannot delete current working directory\n");
+    // check if the directory exists in the parent directory
+    lockDirectory(parentDir, 0);
+    int index = findInDirectory(ppi->lastElementName, parentDir);
+    if (index == -1) {
+        printf("Error directory %s does not exist in parentDir\n", ppi->lastElementName);
+        unlockDirectory(parentDir);
+        free(ppi);
         return -1;
     }
 
     // check if the directory entry is a direcotry
-    if (parentDir[ppi->index].is_directory == 0) {
+    if (parentDir[index].is_directory == 0) {
         printf("Error directory %s is not a directory\n", ppi->lastElementName);
+        unlockDirectory(parentDir);
         free(ppi);
         return -1;
     }
 
     // load the directory to remove
-    rmdir = loadDirectory(&parentDir[ppi->index]);
+    rmdir = loadDirectory(&parentDir[index]);
+    unlockDirectory(parentDir);
     if (rmdir == NULL) {
         printf("Error loading directory from memory for removal %s\n", pathname);
         free(ppi);
         return -1;
     }
 
+    // lock both and make sure the entry still names the directory we loaded
+    lockDirectoryPair(parentDir, rmdir);
+    index = findInDirectory(ppi->lastElementName, parentDir);
+    if (index == -1 || parentDir[index].blocks_allocated[0] != rmdir[0].blocks_allocated[0]) {
+        printf("Error directory %s does not exist in parentDir\n", ppi->lastElementName);
+        unlockDirectoryPair(parentDir, rmdir);
+        free(ppi);
+        return -1;
+    }
+
     // check if the directory is empty (only contains . and ..)
     // i am not sure if we need this check, this is just how linux does it
     int isEmpty = 1;
@@ -238,40 +308,43 @@ int fs_rmdir(const char *pathname) {
     }
     if (!isEmpty) {
         printf("Error directory %s is not empty\n", pathname);
+        unlockDirectoryPair(parentDir, rmdir);
         free(ppi);
-        free(rmdir);
         return -1;
     }
 
     // free the blocks allocated to the directory entry in parent directory
-    if (freeBlocks(parentDir[ppi->index].blocks_allocated, parentDir[ppi->index].blocks_count) == -1) {
+    if (freeBlocks(parentDir[index].blocks_allocated, parentDir[index].blocks_count) == -1) {
         printf("Error freeing blocks for directory %s\n", pathname);
+        unlockDirectoryPair(parentDir, rmdir);
         free(ppi);
-        free(rmdir);
         return -1;
     }
 
     // clear the entry data from the parent directory array
-    parentDir[ppi->index].file_name[0] = '\0';
-    parentDir[ppi->index].size = 0;
-    parentDir[ppi->index].mode = 0;
-    memset(parentDir[ppi->index].blocks_allocated, 0, BLOCKS_ALLOCATED_SIZE);
-    parentDir[ppi->index].blocks_count = 0;
-    parentDir[ppi->index].date_created = 0;
-    parentDir[ppi->index].date_modified = 0;
-    parentDir[ppi->index].is_directory = 0;
+    parentDir[index].file_name[0] = '\0';
+    parentDir[index].size = 0;
+    parentDir[index].mode = 0;
+    memset(parentDir[index].blocks_allocated, 0, BLOCKS_ALLOCATED_SIZE);
+    parentDir[index].blocks_count = 0;
+    parentDir[index].date_created = 0;
+    parentDir[index].date_modified = 0;
+    parentDir[index].is_directory = 0;
+    parentDir[index].flags = 0;
+
+    // the blocks may be reused by a new directory, stop handing out the old copy
+    forgetDirectory(rmdir);
 
     // write the updated parent directory to disk
-    for (int i = 0; i < parentDir[0].blocks_count; i++) {
-        void *dirToBlocks = (void *)((char *)parentDir + i * BLOCK_SIZE);
-        if (LBAwrite(dirToBlocks, 1, parentDir[0].blocks_allocated[i]) != 1) {
-            printf("Error writing updated block %d for parent directory\n", i);
-            return -1;
-        }
+    if (cacheWriteBlocks(parentDir, parentDir[0].blocks_allocated, parentDir[0].blocks_count) !=
+        parentDir[0].blocks_count) {
+        printf("Error writing updated blocks of parent directory\n");
+        unlockDirectoryPair(parentDir, rmdir);
+        free(ppi);
+        return -1;
     }
 
-    // free the directory from memory
-    free(rmdir);
+    unlockDirectoryPair(parentDir, rmdir);
     free(ppi);
 
     return 0;
@@ -282,46 +355,58 @@ int fs_mv(const char *srcPath, const char *dstPath) {
     de_struct *srcEntry = NULL;
     de_struct *dstParent = NULL;
     int dstIndex = -1;
+    char srcName[256];
 
     // parse the source path
     parseInfo *srcPpi = malloc(sizeof(parseInfo));
     // check if source is a full path or from current directory
     if (srcPath[0] == '/') {
         // printf("parsing %s\n", srcPath);
-        if (parsePath((char *)srcPath, srcPpi) == -1) {
+        char *absSrcPath = strdup(srcPath);
+        if (absSrcPath == NULL || parsePath(absSrcPath, srcPpi) == -1 || srcPpi->lastElementName == NULL) {
             printf("Error parsing source path %s\n", srcPath);
+            free(absSrcPath);
             free(srcPpi);
             return -1;
         }
+        strncpy(srcName, srcPpi->lastElementName, 255);
+        srcName[255] = '\0';
+        free(absSrcPath);
     } else {
         // make a temp path/to/source
-        char *cwSrcPath = malloc(strlen(cwdName) + strlen(srcPath) + 1);
-        strcpy(cwSrcPath, cwdName);
-        if (strcmp(cwdName, "/") != 0)
+        char cwdCopy[LOCAL_PATH_MAX];
+        currentDirectory(cwdCopy);
+        char *cwSrcPath = malloc(strlen(cwdCopy) + strlen(srcPath) + 2);
+        strcpy(cwSrcPath, cwdCopy);
+        if (strcmp(cwdCopy, "/") != 0)
             strcat(cwSrcPath, "/"); // add a slash to cwd (if not root)
         strcat(cwSrcPath, srcPath);
         // printf("parsing %s\n", cwSrcPath);
-        if (parsePath((char *)cwSrcPath, srcPpi) == -1) {
+        if (parsePath((char *)cwSrcPath, srcPpi) == -1 || srcPpi->lastElementName == NULL) {
             printf("Error parsing source path %s\n", cwSrcPath);
             free(cwSrcPath);
             free(srcPpi);
             return -1;
         }
+        strncpy(srcName, srcPpi->lastElementName, 255);
+        srcName[255] = '\0';
         free(cwSrcPath);
     }
 
     // get the source directory entry in source directory
     srcParent = srcPpi->parent;
-    if (srcParent == NULL)
+    if (srcParent == NULL) {
         printf("Error the source has no parent directory\n");
-    srcEntry = &srcParent[srcPpi->index];
+        free(srcPpi);
+        return -1;
+    }
 
     // parse the destination path
     parseInfo *dstPpi = malloc(sizeof(parseInfo));
     // check if file name is in path (add it if not)
     const char *slash = strrchr(dstPath, '/');                   // gets the last slash
     const char *pathEnd = (slash != NULL) ? slash + 1 : dstPath; // gets the last entry of the path
-    if (strcmp(pathEnd, srcEntry->file_name) == 0) {
+    if (strcmp(pathEnd, srcName) == 0) {
         // printf("parsing %s\n", dstPath);
         if (parsePath((char *)dstPath, dstPpi) == -1) {
             printf("Error parsing destination path %s\n", dstPath);
@@ -331,12 +416,12 @@ int fs_mv(const char *srcPath, const char *dstPath) {
         }
     } else {
         // make a temp path/to/destination/source_file
-        char *fullDstPath = malloc(strlen(dstPath) + strlen(srcEntry->file_name) + 1);
+        char *fullDstPath = malloc(strlen(dstPath) + strlen(srcName) + 2);
         strcpy(fullDstPath, dstPath);
         // add a slash if not root and if dstPath doesnt already have one
         if (strcmp(dstPath, "/") != 0 && dstPath[strlen(dstPath) - 1] != '/')
             strcat(fullDstPath, "/");
-        strcat(fullDstPath, srcEntry->file_name);
+        strcat(fullDstPath, srcName);
         // printf("parsing %s\n", fullDstPath);
         if (parsePath((char *)fullDstPath, dstPpi) == -1) {
             printf("Error parsing destination path %s\n", fullDstPath);
@@ -348,8 +433,25 @@ int fs_mv(const char *srcPath, const char *dstPath) {
         free(fullDstPath);
     }
     dstParent = dstPpi->parent;
-    if (dstParent == NULL)
+    if (dstParent == NULL) {
         printf("Error the destination has no parent directory\n");
+        free(srcPpi);
+        free(dstPpi);
+        return -1;
+    }
+
+    lockDirectoryPair(srcParent, dstParent);
+
+    // the source may have been moved or deleted since the path was parsed
+    int srcIndex = findInDirectory(srcName, srcParent);
+    if (srcIndex == -1) {
+        printf("Error source %s no longer exists\n", srcName);
+        unlockDirectoryPair(srcParent, dstParent);
+        free(srcPpi);
+        free(dstPpi);
+        return -1;
+    }
+    srcEntry = &srcParent[srcIndex];
 
     // check if there is space in the destination directory
     for (int i = 0; i < DIRECTORY_ENTRIES; i++) {
@@ -360,6 +462,7 @@ int fs_mv(const char *srcPath, const char *dstPath) {
     }
     if (dstIndex == -1) {
         printf("Error destination directory %s is full\n", dstPath);
+        unlockDirectoryPair(srcParent, dstParent);
         free(srcPpi);
         free(dstPpi);
         return -1;
@@ -376,6 +479,7 @@ int fs_mv(const char *srcPath, const char *dstPath) {
     dstParent[dstIndex].date_created = srcEntry->date_created;
     dstParent[dstIndex].date_modified = getTime();
     dstParent[dstIndex].is_directory = srcEntry->is_directory;
+    dstParent[dstIndex].flags = srcEntry->flags;
 
     // clear the source entry in the source parent directory
     srcEntry->file_name[0] = '\0';
@@ -386,29 +490,30 @@ int fs_mv(const char *srcPath, const char *dstPath) {
     srcEntry->date_created = 0;
     srcEntry->date_modified = 0;
     srcEntry->is_directory = 0;
+    srcEntry->flags = 0;
 
     // write the updated source parent directory to disk
-    for (int i = 0; i < srcParent[0].blocks_count; i++) {
-        void *dirToBlocks = (void *)((char *)srcParent + i * BLOCK_SIZE);
-        if (LBAwrite(dirToBlocks, 1, srcParent[0].blocks_allocated[i]) != 1) {
-            printf("Error writing updated block %d for source parent directory\n", i);
-            free(srcPpi);
-            free(dstPpi);
-            return -1;
-        }
+    if (cacheWriteBlocks(srcParent, srcParent[0].blocks_allocated, srcParent[0].blocks_count) !=
+        srcParent[0].blocks_count) {
+        printf("Error writing updated blocks of source parent directory\n");
+        unlockDirectoryPair(srcParent, dstParent);
+        free(srcPpi);
+        free(dstPpi);
+        return -1;
     }
 
     // write the updated destination parent directory to disk
-    for (int i = 0; i < dstParent[0].blocks_count; i++) {
-        void *dirToBlocks = (void *)((char *)dstParent + i * BLOCK_SIZE);
-        if (LBAwrite(dirToBlocks, 1, dstParent[0].blocks_allocated[i]) != 1) {
-            printf("Error writing updated block %d for destination parent directory\n", i);
-            free(srcPpi);
-            free(dstPpi);
-            return -1;
-        }
+    if (cacheWriteBlocks(dstParent, dstParent[0].blocks_allocated, dstParent[0].blocks_count) !=
+        dstParent[0].blocks_count) {
+        printf("Error writing updated blocks of destination parent directory\n");
+        unlockDirectoryPair(srcParent, dstParent);
+        free(srcPpi);
+        free(dstPpi);
+        return -1;
     }
 
+    unlockDirectoryPair(srcParent, dstParent);
+
     // cleanup
     free(srcPpi);
     free(dstPpi);
@@ -439,6 +544,7 @@ fdDir *fs_opendir(char *pathname) {
     }
 
     // initialize fd
+    lockDirectory(ppi->parent, 0);
     for (int i = 0; i < DIRECTORY_ENTRIES; i++) {
         fd->d_reclen += ppi->parent[i].size;
     }
@@ -447,8 +553,10 @@ fdDir *fs_opendir(char *pathname) {
 
     if (ppi->index == -2) {
         fd->directory = ppi->parent;
+        unlockDirectory(ppi->parent);
     } else {
         fd->directory = loadDirectory(&ppi->parent[ppi->index]);
+        unlockDirectory(ppi->parent);
         if (fd->directory == NULL) {
             printf("Error  loading fd->directory\n");
             free(ppi);
@@ -468,6 +576,7 @@ fdDir *fs_opendir(char *pathname) {
 }
 
 struct fs_diriteminfo *fs_readdir(fdDir *dirp) {
+    lockDirectory(dirp->directory, 0);
 
     // skip any invalid entries
     while (dirp->dirEntryPosition < DIRECTORY_ENTRIES && dirp->directory[dirp->dirEntryPosition].file_name[0] == '\0') {
@@ -475,6 +584,7 @@ struct fs_diriteminfo *fs_readdir(fdDir *dirp) {
     }
 
     if (dirp->dirEntryPosition >= DIRECTORY_ENTRIES) {
+        unlockDirectory(dirp->directory);
         return NULL;
     }
 
@@ -494,6 +604,7 @@ struct fs_diriteminfo *fs_readdir(fdDir *dirp) {
     // move to next entry for next call
     dirp->dirEntryPosition++;
 
+    unlockDirectory(dirp->directory);
     return dirp->di;
 }
 
@@ -502,10 +613,8 @@ int fs_closedir(fdDir *dirp) {
         return -1;
     }
 
-    if (dirp->directory != NULL && dirp->directory != rootDir && dirp->directory != cwDir) {
-        free(dirp->directory);
-        dirp->directory = NULL;
-    }
+    // the directory itself belongs to the directory cache
+    dirp->directory = NULL;
 
     if (dirp->di != NULL) {
         free(dirp->di);
@@ -522,15 +631,18 @@ char *fs_getcwd(char *pathname, size_t size) {
         return NULL;
     }
 
-    strncpy(pathname, cwdName, size - 1);
+    char cwdCopy[LOCAL_PATH_MAX];
+    currentDirectory(cwdCopy);
+    strncpy(pathname, cwdCopy, size - 1);
     // Force null terminate the EOL.
     pathname[size - 1] = '\0';
 
     return pathname;
 }
 
-// linux chdir
-int fs_setcwd(char *pathname) {
+// Body of fs_setcwd, changes the working directory *dir whose path is in
+// name. The caller owns the pair (holds cwdLock for cwDir and cwdName).
+static int setcwd(de_struct **dir, char *name, char *pathname) {
     // printf("setcwd pathname=%s\n", pathname);
 
     // Handle failures or edge cases.
@@ -541,19 +653,12 @@ int fs_setcwd(char *pathname) {
 
     // Special case for root directory
     if (strcmp(pathname, "/") == 0) {
-        cwDir = rootDir;
-        strcpy(cwdName, "/");
+        *dir = rootDir;
+        strcpy(name, "/");
         // printf("[fs_setcwd] Changed to root directory\n");
         return 0;
     }
 
-    // Save the original directory to free at the end
-    // This is needed to not hit double frees and segfaults when cding
-    de_struct *dirToFree = NULL;
-    if (cwDir != rootDir) {
-        dirToFree = cwDir;
-    }
-
     // Handle path with multiple subdirectories.
     if (strchr(pathname, '/') != NULL && pathname[0] != '/') {
 
@@ -570,7 +675,7 @@ int fs_setcwd(char *pathname) {
         // Process each path component
         while (part != NULL) {
             // If not able to set setcwd to the part return -1 and set 0 until we have a valid part.
-            if (fs_setcwd(part) != 0) {
+            if (setcwd(dir, name, part) != 0) {
                 return -1;
             }
             part = strtok_r(NULL, "/", &saveptr);
@@ -581,12 +686,12 @@ int fs_setcwd(char *pathname) {
 
     else if (pathname[0] == '/') {
         // Absolute path - start at root
-        cwDir = rootDir;
-        strcpy(cwdName, "/");
+        *dir = rootDir;
+        strcpy(name, "/");
 
         // Process the rest of the path if any
         if (strlen(pathname) > 1) {
-            return fs_setcwd(pathname + 1);
+            return setcwd(dir, name, pathname + 1);
         }
         return 0;
     }
@@ -594,18 +699,18 @@ int fs_setcwd(char *pathname) {
     // Handle ".." special case - parent directory
     if (strcmp(pathname, "..") == 0) {
         // Update path first
-        char *lastSlash = strrchr(cwdName, '/');
-        if (lastSlash == cwdName) {
+        char *lastSlash = strrchr(name, '/');
+        if (lastSlash == name) {
             // Already at root
-            cwDir = rootDir;
-            strcpy(cwdName, "/");
+            *dir = rootDir;
+            strcpy(name, "/");
             return 0;
         }
         *lastSlash = '\0';
 
         // If we ended up with empty string, set to root
-        if (strlen(cwdName) == 0) {
-            strcpy(cwdName, "/");
+        if (strlen(name) == 0) {
+            strcpy(name, "/");
         }
 
         // Find the parent directory
@@ -616,15 +721,15 @@ int fs_setcwd(char *pathname) {
         }
 
         char pathCopy[LOCAL_PATH_MAX];
-        strncpy(pathCopy, cwdName, LOCAL_PATH_MAX - 1);
+        strncpy(pathCopy, name, LOCAL_PATH_MAX - 1);
         pathCopy[LOCAL_PATH_MAX - 1] = '\0';
 
         // Validate result.
-        int result = parsePath(pathCopy, ppi);
+        int result = resolvePath(rootDir, pathCopy, ppi);
 
         // Special case for root
-        if (strcmp(cwdName, "/") == 0) {
-            cwDir = rootDir;
+        if (strcmp(name, "/") == 0) {
+            *dir = rootDir;
             free(ppi);
             ppi = NULL;
             return 0;
@@ -632,7 +737,7 @@ int fs_setcwd(char *pathname) {
 
         // We were not able to find anything.
         if (result != 0) {
-            printf("[fs_setcwd] Error: Could not resolve path: %s\n", cwdName);
+            printf("[fs_setcwd] Error: Could not resolve path: %s\n", name);
             free(ppi);
             return -1;
         }
@@ -640,29 +745,24 @@ int fs_setcwd(char *pathname) {
         // Load the parent directory
         if (ppi->index == -2) {
             // This means the target is root directory.
-            cwDir = rootDir;
+            *dir = rootDir;
         } else {
-            // free cwdir before loading it again
-            free(cwDir);
+            lockDirectory(ppi->parent, 0);
             de_struct *newDir = loadDirectory(&ppi->parent[ppi->index]);
+            unlockDirectory(ppi->parent);
             if (newDir == NULL) {
                 printf("[fs_setcwd] Error: Failed to load directory\n");
                 free(ppi);
                 return -1;
             }
-            cwDir = newDir;
+            *dir = newDir;
         }
 
         // Clean up parseInfo but not the parent directory
         free(ppi);
 
-        // printf("[fs_setcwd] Changed to directory: %s\n", cwDir[0].file_name);
-        // printf("[fs_setcwd] cwdName updated to: %s\n", cwdName);
-
-        // Free the original directory saved at the beginning if needed
-        if (dirToFree != NULL && dirToFree != cwDir && dirToFree != rootDir) {
-            free(dirToFree);
-        }
+        // printf("[fs_setcwd] Changed to directory: %s\n", (*dir)[0].file_name);
+        // printf("[fs_setcwd] name updated to: %s\n", name);
 
         return 0;
     }
@@ -678,7 +778,7 @@ int fs_setcwd(char *pathname) {
     strncpy(pathCopy, pathname, LOCAL_PATH_MAX - 1);
     pathCopy[LOCAL_PATH_MAX - 1] = '\0';
 
-    int result = parsePath(pathCopy, ppi);
+    int result = resolvePath(*dir, pathCopy, ppi);
 
     if (result != 0 || ppi->index == -1 || ppi->parent == NULL) {
         printf("[fs_setcwd] Error: Could not resolve path: %s\n", pathname);
@@ -689,15 +789,17 @@ int fs_setcwd(char *pathname) {
 
     // Handle special case for root directory
     if (ppi->index == -2) {
-        cwDir = rootDir;
-        strcpy(cwdName, "/");
+        *dir = rootDir;
+        strcpy(name, "/");
         // printf("[fs_setcwd] Changed to root directory\n");
     }
 
     else {
         // Check if it's a directory
+        lockDirectory(ppi->parent, 0);
         if (!ppi->parent[ppi->index].is_directory) {
             printf("[fs_setcwd] Error: %s is not a directory\n", pathname);
+            unlockDirectory(ppi->parent);
             free(ppi);
             ppi = NULL;
             return -1;
@@ -705,6 +807,7 @@ int fs_setcwd(char *pathname) {
 
         // Load the directory
         de_struct *newDir = loadDirectory(&ppi->parent[ppi->index]);
+        unlockDirectory(ppi->parent);
         if (newDir == NULL) {
             printf("[fs_setcwd] Error: Failed to load directory\n");
             free(ppi);
@@ -713,31 +816,84 @@ int fs_setcwd(char *pathname) {
         }
 
         // Update current directory
-        cwDir = newDir;
+        *dir = newDir;
 
         // Update path
         if (strcmp(pathname, ".") != 0) {
-            if (strcmp(cwdName, "/") != 0) {
-                strcat(cwdName, "/");
+            if (strcmp(name, "/") != 0) {
+                strcat(name, "/");
             }
-            strcat(cwdName, pathname);
+            strcat(name, pathname);
         }
 
-        // printf("[fs_setcwd] Changed to directory: %s\n", cwDir[0].file_name);
+        // printf("[fs_setcwd] Changed to directory: %s\n", (*dir)[0].file_name);
     }
 
-    // printf("[fs_setcwd] cwdName updated to: %s\n", cwdName);
+    // printf("[fs_setcwd] name updated to: %s\n", name);
 
     // Free the parseInfo but not the parent
     free(ppi);
     ppi = NULL;
 
-    // Free the original directory saved at the beginning if needed
-    if (dirToFree != NULL && dirToFree != cwDir && dirToFree != rootDir) {
-        free(dirToFree);
+    return 0;
+}
+
+// linux chdir
+int fs_setcwd(char *pathname) {
+    // a thread's own context is only ever touched by that thread
+    if (threadContext != NULL) {
+        return setcwd(&threadContext->dir, threadContext->name, pathname);
     }
 
-    return 0;
+    pthread_mutex_lock(&cwdLock);
+    int result = setcwd(&cwDir, cwdName, pathname);
+    pthread_mutex_unlock(&cwdLock);
+    return result;
+}
+
+// The working directory of the calling thread, its path is copied into name
+// (LOCAL_PATH_MAX bytes) unless name is NULL
+static de_struct *currentDirectory(char *name) {
+    if (threadContext != NULL) {
+        if (name != NULL) {
+            strcpy(name, threadContext->name);
+        }
+        return threadContext->dir;
+    }
+
+    pthread_mutex_lock(&cwdLock);
+    de_struct *dir = cwDir;
+    if (name != NULL) {
+        strcpy(name, cwdName);
+    }
+    pthread_mutex_unlock(&cwdLock);
+    return dir;
+}
+
+fs_context *fs_newcontext() {
+    fs_context *ctx = malloc(sizeof(fs_context));
+    if (ctx == NULL) {
+        printf("Error mallocing fs_context\n");
+        return NULL;
+    }
+
+    // start where the calling thread is, like a forked process does
+    ctx->dir = currentDirectory(ctx->name);
+    return ctx;
+}
+
+void fs_freecontext(fs_context *ctx) {
+    if (threadContext == ctx) {
+        threadContext = NULL;
+    }
+    // the directory belongs to the directory cache
+    free(ctx);
+}
+
+fs_context *fs_setcontext(fs_context *ctx) {
+    fs_context *previous = threadContext;
+    threadContext = ctx;
+    return previous;
 }
 
 // return 1 if file, 0 otherwise
@@ -750,7 +906,7 @@ int fs_isFile(char *filename) {
     }
 
     // create a temp path for parsePath
-    char *tmpPath = malloc(strlen(filename));
+    char *tmpPath = malloc(strlen(filename) + 1);
     if (tmpPath == NULL) {
         printf("Error mallocing space for temp pathname\n");
         return -1;
@@ -777,24 +933,19 @@ int fs_isFile(char *filename) {
     }
 
     // Access directory entry
-    de_struct *entry;
-    entry = &ppi->parent[ppi->index];
+    lockDirectory(ppi->parent, 0);
+    int isDirectory = ppi->parent[ppi->index].is_directory;
+    unlockDirectory(ppi->parent);
 
     // If the entry is a directory
-    if (entry->is_directory) {
+    if (isDirectory) {
         free(tmpPath);
-        if (ppi->parent != rootDir && ppi->parent != cwDir) {
-            free(ppi->parent);
-        }
         free(ppi);
         return 0;
     }
 
     // It is a file
     free(tmpPath);
-    if (ppi->parent != rootDir && ppi->parent != cwDir) {
-        free(ppi->parent);
-    }
     free(ppi);
     return 1;
 }
@@ -804,7 +955,7 @@ int fs_isFile(char *filename) {
 int fs_isDir(char *pathname) {
 
     // create a temp path for parsePath
-    char *tmpPath = malloc(strlen(pathname));
+    char *tmpPath = malloc(strlen(pathname) + 1);
     if (tmpPath == NULL) {
         printf("Error mallocing space for temp pathname\n");
         return -1;
@@ -826,11 +977,12 @@ int fs_isDir(char *pathname) {
         return 0;
     }
 
-    de_struct *entry;
-    entry = &ppi->parent[ppi->index];
+    lockDirectory(ppi->parent, 0);
+    int isDirectory = ppi->parent[ppi->index].is_directory;
+    unlockDirectory(ppi->parent);
 
     // If the entry is a directory
-    if (entry->is_directory) {
+    if (isDirectory) {
         free(tmpPath);
         free(ppi);
         return 1;
@@ -864,13 +1016,19 @@ int fs_delete(char *filename) {
         return -1;
     }
 
-    // Get the file entry from the parent directory
-    de_struct *entry = &ppi->parent[ppi->index];
+    // Get the file entry from the parent directory, it may have gone since
+    // the path was parsed
+    lockDirectory(ppi->parent, 1);
+    int index = findInDirectory(ppi->lastElementName, ppi->parent);
+    if (index < 0) {
+        unlockDirectory(ppi->parent);
+        free(ppi);
+        return -1;
+    }
+    de_struct *entry = &ppi->parent[index];
 
     // Free allocated blocks
-    for (int i = 0; i < entry->blocks_count; i++) {
-        freeBlocks(entry->blocks_allocated, entry->blocks_count);
-    }
+    freeBlocks(entry->blocks_allocated, entry->blocks_count);
 
     // Clear the entry to mark as deleted
     entry->file_name[0] = '\0';
@@ -879,18 +1037,33 @@ int fs_delete(char *filename) {
     entry->date_created = 0;
     entry->date_modified = 0;
     entry->is_directory = 0;
+    entry->flags = 0;
 
     // Calculate how many blocks the directory uses
     int dirBlocks = (ENTRY_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
     // Write parent dir back to disk
-    int dirStartBlock = ppi->parent[0].blocks_allocated[0];
-    LBAwrite(ppi->parent, dirBlocks, dirStartBlock);
+    cacheWriteBlocks(ppi->parent, ppi->parent[0].blocks_allocated, dirBlocks);
+    unlockDirectory(ppi->parent);
 
     free(ppi);
     return 0;
 }
 
+int fs_truncate(char *filename, off_t length) {
+    // truncating needs the same locking as writing, so go through b_io
+    int fd = b_open(filename, O_WRONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int result = b_truncate(fd, length);
+    if (b_close(fd) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
 int fs_stat(const char *path, struct fs_stat *buf) {
     // Check for valid input
     if (path == NULL || buf == NULL) {
@@ -908,38 +1081,39 @@ int fs_stat(const char *path, struct fs_stat *buf) {
     }
 
     // Get the entry
+    lockDirectory(ppi->parent, 0);
     de_struct *entry = &ppi->parent[ppi->index];
 
     // Fill in the stat struct
     buf->st_size = entry->size;
     buf->st_blksize = BLOCK_SIZE;
-    buf->st_blocks = entry->blocks_count * (BLOCK_SIZE / 512);
+    // holes and blocks saved by compression take no space, so st_blocks
+    // can be well below st_size
+    int mapped = 0;
+    for (int i = 0; i < entry->blocks_count; i++) {
+        if (entry->blocks_allocated[i] >= 0) {
+            mapped++;
+        }
+    }
+    buf->st_blocks = mapped * (BLOCK_SIZE / 512);
     buf->st_createtime = entry->date_created;
     buf->st_modtime = entry->date_modified;
     buf->st_accesstime = entry->date_modified;
+    unlockDirectory(ppi->parent);
 
     free(ppi);
     return 0;
 }
 
-int parsePath(char *pathName, parseInfo *ppi) {
+// Walk pathName starting at startParent. Each directory is read locked while
+// it is searched, so the parent handed back may change before the caller
+// locks it and callers that modify it look the name up again.
+static int resolvePath(de_struct *startParent, char *pathName, parseInfo *ppi) {
     de_struct *parent;
-    de_struct *startParent;
     char *savePtr;
     char *token1;
     char *token2;
 
-    if (pathName == NULL) {
-        printf("Error invalid pathname to parse\n");
-        return -1;
-    }
-
-    if (pathName[0] == '/') {
-        startParent = rootDir;
-    } else {
-        startParent = cwDir;
-    }
-
     parent = startParent;
 
     token1 = strtok_r(pathName, "/", &savePtr);
@@ -956,40 +1130,57 @@ int parsePath(char *pathName, parseInfo *ppi) {
     }
 
     while (1) {
+        lockDirectory(parent, 0);
         int idx = findInDirectory(token1, parent);
         token2 = strtok_r(NULL, "/", &savePtr);
 
         if (token2 == NULL) {
+            unlockDirectory(parent);
             ppi->parent = parent;
             ppi->index = idx;
             ppi->lastElementName = token1;
             return 0;
         } else {
             if (idx == -1) {
+                unlockDirectory(parent);
                 return -2;
             }
 
-            if (!isDEaDir(&parent[idx]))
+            if (!isDEaDir(&parent[idx])) {
+                unlockDirectory(parent);
                 return -1;
+            }
 
+            // the cache hands back rootDir itself for ".." entries that lead to the root
             de_struct *tempParent = loadDirectory(&parent[idx]);
+            unlockDirectory(parent);
             if (tempParent == NULL) {
                 return -1;
             }
 
-            if (parent != startParent && parent != rootDir && parent != cwDir) {
-                // free(parent);
-            }
-            if (tempParent[0].blocks_allocated[0] == rootDir[0].blocks_allocated[0]) {
-                parent = rootDir;
-            } else {
-                parent = tempParent;
-            }
+            parent = tempParent;
             token1 = token2;
         }
     }
 }
 
+int parsePath(char *pathName, parseInfo *ppi) {
+    de_struct *startParent;
+
+    if (pathName == NULL) {
+        printf("Error invalid pathname to parse\n");
+        return -1;
+    }
+
+    if (pathName[0] == '/') {
+        startParent = rootDir;
+    } else {
+        startParent = currentDirectory(NULL);
+    }
+
+    return resolvePath(startParent, pathName, ppi);
+}
+
 int findInDirectory(char *name, de_struct *parent) {
     if (name == NULL || parent == NULL) {
         return -1;
@@ -1016,33 +1207,216 @@ int isDEaDir(de_struct *target) {
     return 0;
 }
 
+// Find the cache entry of a directory in memory. Caller holds dirCacheLock.
+static dirCacheEntry *findCachedDirectory(de_struct *dir) {
+    int bucket = dir[0].blocks_allocated[0] % DIR_CACHE_BUCKETS;
+    for (dirCacheEntry *entry = dirCache[bucket]; entry != NULL; entry = entry->next) {
+        if (entry->dir == dir) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Add a directory to the cache, dir is NULL for one that is about to be
+// read. Caller holds dirCacheLock for writing.
+static dirCacheEntry *addCachedDirectory(de_struct *dir, int startBlock) {
+    dirCacheEntry *entry = malloc(sizeof(dirCacheEntry));
+    if (entry == NULL) {
+        printf("Error mallocing directory cache entry\n");
+        return NULL;
+    }
+
+    entry->dir = dir;
+    entry->startBlock = startBlock;
+    entry->removed = 0;
+    entry->loading = 0;
+    pthread_rwlock_init(&entry->lock, NULL);
+
+    int bucket = startBlock % DIR_CACHE_BUCKETS;
+    entry->next = dirCache[bucket];
+    dirCache[bucket] = entry;
+    return entry;
+}
+
+// Find the cache entry of the directory starting at startBlock, loaded or
+// still loading. Caller holds dirCacheLock.
+static dirCacheEntry *findStartBlock(int startBlock) {
+    for (dirCacheEntry *entry = dirCache[startBlock % DIR_CACHE_BUCKETS]; entry != NULL; entry = entry->next) {
+        if (entry->startBlock == startBlock && !entry->removed) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Read a directory into the entry made for it and publish it to the
+// threads waiting for it. Returns the directory, NULL if it could not be
+// read (the entry is then dropped from lookups).
+static de_struct *readDirectory(dirCacheEntry *entry, de_struct *target) {
+    // allocate memory for the directory entries
+    de_struct *entries = allocBlockBuffer(target->blocks_count * BLOCK_SIZE);
+    if (entries != NULL) {
+        // Clean the memory before loadDirectory
+        memset(entries, 0, target->blocks_count * BLOCK_SIZE);
+
+        // read the blocks listed in the blocks_allocated array
+        checksumMarkMetadata(target->blocks_allocated, target->blocks_count);
+        if (cacheReadBlocks(entries, target->blocks_allocated, target->blocks_count) != target->blocks_count) {
+            printf("Error reading blocks for directory\n");
+            free(entries);
+            entries = NULL;
+        }
+    }
+
+    pthread_rwlock_wrlock(&dirCacheLock);
+    pthread_mutex_lock(&dirLoadLock);
+    entry->dir = entries;
+    entry->removed = (entries == NULL);
+    entry->loading = 0;
+    pthread_cond_broadcast(&dirLoaded);
+    pthread_mutex_unlock(&dirLoadLock);
+    pthread_rwlock_unlock(&dirCacheLock);
+    return entries;
+}
+
+// Returns the cached copy of the directory target describes, reading it from
+// disk the first time. The caller must hold a lock on the directory target
+// lives in.
 de_struct *loadDirectory(de_struct *target) {
     // check if target is NULL or not a directory
     if (target == NULL || !target->is_directory) {
         return NULL;
     }
 
-    // allocate memory for the directory entries
-    de_struct *entries = malloc(target->blocks_count * BLOCK_SIZE);
-    if (entries == NULL) {
-        return NULL;
+    int startBlock = target->blocks_allocated[0];
+
+    pthread_rwlock_rdlock(&dirCacheLock);
+    dirCacheEntry *entry = findStartBlock(startBlock);
+    if (entry != NULL && !entry->loading) {
+        pthread_rwlock_unlock(&dirCacheLock);
+        return entry->dir;
     }
-    // Clean the memory before loadDirectory
-    memset(entries, 0, target->blocks_count * BLOCK_SIZE);
+    pthread_rwlock_unlock(&dirCacheLock);
 
-    // read each block individually based on the blocks_allocated array
-    for (int i = 0; i < target->blocks_count; i++) {
-        void *blockData = (void *)((char *)entries + i * BLOCK_SIZE);
-        if (LBAread(blockData, 1, target->blocks_allocated[i]) != 1) {
-            printf("Error reading block %d for directory\n", i);
-            free(entries);
+    // not cached, look again under the write lock in case somebody else
+    // started loading it in the meantime, and if not, make the entry this
+    // thread reads it into
+    int reader = 0;
+    pthread_rwlock_wrlock(&dirCacheLock);
+    entry = findStartBlock(startBlock);
+    if (entry == NULL) {
+        entry = addCachedDirectory(NULL, startBlock);
+        if (entry == NULL) {
+            pthread_rwlock_unlock(&dirCacheLock);
             return NULL;
         }
+        entry->loading = 1;
+        reader = 1;
     }
+    pthread_rwlock_unlock(&dirCacheLock);
 
-    // printf("[loadDirectory] Read success. First entry name: '%s'\n", entries[0].file_name);
-    // printf("[loadDirectory] Second entry name: '%s'\n", entries[1].file_name);
-    // printf("[loadDirectory] blocks_allocated count: '%d'\n", entries[0].blocks_count);
+    if (reader) {
+        return readDirectory(entry, target);
+    }
 
-    return entries;
+    // somebody else is reading it, NULL if they failed
+    pthread_mutex_lock(&dirLoadLock);
+    while (entry->loading) {
+        pthread_cond_wait(&dirLoaded, &dirLoadLock);
+    }
+    de_struct *dir = entry->dir;
+    pthread_mutex_unlock(&dirLoadLock);
+    return dir;
+}
+
+int registerDirectory(de_struct *dir) {
+    pthread_rwlock_wrlock(&dirCacheLock);
+    dirCacheEntry *entry = addCachedDirectory(dir, dir[0].blocks_allocated[0]);
+    pthread_rwlock_unlock(&dirCacheLock);
+    return (entry != NULL) ? 0 : -1;
+}
+
+// Drop a deleted directory from lookups. Its memory stays around until exit
+// because an open fdDir may still point at it.
+static void forgetDirectory(de_struct *dir) {
+    pthread_rwlock_wrlock(&dirCacheLock);
+    dirCacheEntry *entry = findCachedDirectory(dir);
+    if (entry != NULL) {
+        entry->removed = 1;
+    }
+    pthread_rwlock_unlock(&dirCacheLock);
+}
+
+void freeDirectoryCache() {
+    pthread_rwlock_wrlock(&dirCacheLock);
+    for (int i = 0; i < DIR_CACHE_BUCKETS; i++) {
+        dirCacheEntry *entry = dirCache[i];
+        while (entry != NULL) {
+            dirCacheEntry *next = entry->next;
+            pthread_rwlock_destroy(&entry->lock);
+            free(entry->dir);
+            free(entry);
+            entry = next;
+        }
+        dirCache[i] = NULL;
+    }
+    pthread_rwlock_unlock(&dirCacheLock);
+}
+
+// Every directory handed out comes from the directory cache, so one that is
+// not in it is a bug in the caller, which would otherwise go on unlocked
+void lockDirectory(de_struct *dir, int exclusive) {
+    pthread_rwlock_rdlock(&dirCacheLock);
+    dirCacheEntry *entry = findCachedDirectory(dir);
+    pthread_rwlock_unlock(&dirCacheLock);
+    assert(entry != NULL);
+
+    if (exclusive) {
+        pthread_rwlock_wrlock(&entry->lock);
+    } else {
+        pthread_rwlock_rdlock(&entry->lock);
+    }
+}
+
+void unlockDirectory(de_struct *dir) {
+    pthread_rwlock_rdlock(&dirCacheLock);
+    dirCacheEntry *entry = findCachedDirectory(dir);
+    pthread_rwlock_unlock(&dirCacheLock);
+    assert(entry != NULL);
+    pthread_rwlock_unlock(&entry->lock);
+}
+
+// Write the blocks of a cached directory that hold one of its entries,
+// instead of the whole directory. Caller holds a lock on the directory.
+int writeDirectoryEntry(de_struct *dir, int index) {
+    int first = index * sizeof(de_struct) / BLOCK_SIZE;
+    int last = ((index + 1) * sizeof(de_struct) - 1) / BLOCK_SIZE;
+    int count = last - first + 1;
+    if (cacheWriteBlocks((char *)dir + first * BLOCK_SIZE, &dir[0].blocks_allocated[first], count) != count) {
+        printf("Error writing blocks %d-%d of directory entry %d\n", first, last, index);
+        return -1;
+    }
+    return 0;
+}
+
+// Write lock two directories, always in the same order so two threads
+// locking the same pair cannot deadlock
+void lockDirectoryPair(de_struct *a, de_struct *b) {
+    if (a == b) {
+        lockDirectory(a, 1);
+    } else if (a < b) {
+        lockDirectory(a, 1);
+        lockDirectory(b, 1);
+    } else {
+        lockDirectory(b, 1);
+        lockDirectory(a, 1);
+    }
+}
+
+void unlockDirectoryPair(de_struct *a, de_struct *b) {
+    unlockDirectory(a);
+    if (a != b) {
+        unlockDirectory(b);
+    }
 }
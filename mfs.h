@@ -41,6 +41,10 @@
 // ensure de is exactly 1024 bytes or 2 blocks
 #define MAX_DE_BLOCK_COUNT 182 // this is about 90 KB of data
 #define BLOCKS_ALLOCATED_SIZE (MAX_DE_BLOCK_COUNT * sizeof(int))
+#define BLOCK_HOLE -1 // blocks_allocated entry of a file block never written, it reads as zeros
+#define BLOCK_PACKED -2 // blocks_allocated entry of a block stored in the compressed extent of its chunk
+
+#define DE_COMPRESS 0x1 // de_struct flag: file data is stored compressed, new entries of a directory inherit it
 
 #define LOCAL_PATH_MAX 256
 
@@ -80,6 +84,8 @@ typedef struct de_struct {
     time_t date_modified;
     // flag indicating blob is a directory
     int is_directory;
+    // DE_COMPRESS, takes what was padding so the entry stays 1024 bytes (0 on older volumes)
+    int flags;
 } de_struct;
 
 // This is a private structure used only by fs_opendir, fs_readdir, and fs_closedir
@@ -113,8 +119,17 @@ int fs_setcwd(char *pathname); // linux chdir
 int fs_isFile(char *filename); // return 1 if file, 0 otherwise
 int fs_isDir(char *pathname);  // return 1 if directory, 0 otherwise
 int fs_delete(char *filename); // removes a file
+int fs_truncate(char *filename, off_t length); // linux truncate
 time_t getTime();              // returns the current time
 
+// Working directory contexts. A thread that binds a context of its own
+// resolves relative paths against it and fs_setcwd/fs_getcwd act on it, so
+// threads can move around the tree without touching cwDir and cwdName.
+typedef struct fs_context fs_context;
+fs_context *fs_newcontext();                // new context at the calling thread's working directory
+void fs_freecontext(fs_context *ctx);
+fs_context *fs_setcontext(fs_context *ctx); // bind ctx to the calling thread (NULL for cwDir/cwdName), returns the previous one
+
 typedef struct parseInfo {
     de_struct *parent;
     int index;
@@ -132,6 +147,16 @@ int findInDirectory(char *name, de_struct *parent);
 int isDEaDir(de_struct *target); // returns 0 when it is a dir
 de_struct *loadDirectory(de_struct *target);
 
+// Directory cache, every directory in memory is shared by all its users and
+// owned by the cache, so callers never free a directory themselves.
+int registerDirectory(de_struct *dir);           // add a directory read by the caller (the root)
+void freeDirectoryCache();                       // release every cached directory at exit
+void lockDirectory(de_struct *dir, int exclusive); // take the directory's reader/writer lock
+void unlockDirectory(de_struct *dir);
+void lockDirectoryPair(de_struct *a, de_struct *b); // lock two directories for writing without deadlock
+void unlockDirectoryPair(de_struct *a, de_struct *b);
+int writeDirectoryEntry(de_struct *dir, int index); // write only the blocks holding dir[index]
+
 // This is the strucutre that is filled in from a call to fs_stat
 struct fs_stat {
     off_t st_size;        /* total size, in bytes */
@@ -165,6 +190,11 @@ typedef struct vcb_struct {
     int root_dir_start;
     // signature to identify valid volume control block (up to 64 bits)
     long long signature;
+    // first block and length of the block checksum table, 0 blocks if the volume has none
+    int checksum_start;
+    int checksum_blocks;
+    // 1 if the table on disk matched every block at the last unmount, 0 while mounted
+    int checksum_clean;
 } vcb_struct;
 
 #endif
@@ -0,0 +1,545 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: mirrorDevice.c
+ *
+ * Description::
+ *   Block device backend that keeps a full copy of the volume in
+ *   every replica file (RAID-1). The volume name lists the replicas
+ *   separated by commas. Writes go to all replicas, each read goes
+ *   to one of them: the one with the fewest reads in flight, or the
+ *   one whose last read ended nearest to it, so concurrent readers
+ *   (readahead, async I/O, several threads) are spread over them.
+ *
+ *   Replicas may disagree after a crash in the middle of a write. To
+ *   avoid copying whole replicas afterwards, the volume is cut into
+ *   regions and a write-intent bitmap after the header block of
+ *   every replica has one bit per region. The bit is set on stable
+ *   storage before the first write into the region and cleared once
+ *   a flush has made the writes durable everywhere. On open, the
+ *   regions still marked were written when the volume went down and
+ *   are copied from the first replica to the others (resync).
+ *
+ *   Replica file layout:
+ *     block 0                 header (layout, volume id, place)
+ *     blocks 1..bitmapBlocks  write-intent bitmap
+ *     after that              the volume
+ *
+ *   Options (fsshell -o), comma separated:
+ *     read=depth|near   how reads pick a replica (default depth)
+ *     region=<blocks>   blocks per bitmap bit for a new volume (default 128)
+ *
+ **************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blockDevice.h"
+
+#define MIRROR_SIGNATURE 0x4D6972726F725630 // "MirrorV0"
+#define MIRROR_CAPTION "CSC-415 - Mirrored Volume Replica Header\n\n"
+#define MIRROR_MAX_REPLICAS 8
+#define MIRROR_DEFAULT_REGION 128
+#define MIRROR_RESYNC_BLOCKS 256 // blocks copied at a time by the resync
+
+#define READ_BY_DEPTH 0
+#define READ_BY_DISTANCE 1
+
+typedef struct mirrorHeader {
+    char caption[64];
+    uint64_t signature;
+    uint64_t volumeId;     // the same in every replica of the volume
+    uint64_t blockSize;
+    uint64_t blockCount;
+    uint64_t regionBlocks; // blocks covered by one bit of the bitmap
+    uint32_t replicaCount;
+    uint32_t replicaIndex;
+} mirrorHeader;
+
+typedef struct mirrorReplica {
+    int fd;
+    int inFlight;          // reads going on now
+    uint64_t lastPosition; // LBA after the last read
+} mirrorReplica;
+
+typedef struct mirrorState {
+    mirrorReplica replicas[MIRROR_MAX_REPLICAS];
+    int replicaCount;
+    uint64_t blockSize;
+    uint64_t blockCount;
+    uint64_t regionBlocks;
+    uint64_t bitmapBlocks;
+    int readPolicy;
+    uint64_t newRegion;    // region size used when a volume is created
+
+    pthread_mutex_t lock;  // guards the bitmap and the write counters
+    unsigned char *bitmap; // bitmapBlocks blocks, as on disk
+    int bitsSet;
+    int writesInFlight;
+    uint64_t writesStarted;
+} mirrorState;
+
+static mirrorState mirror = {.readPolicy = READ_BY_DEPTH, .newRegion = MIRROR_DEFAULT_REGION,
+                             .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Move len bytes at the given file offset, retrying short transfers.
+// Returns the bytes moved.
+static size_t replicaTransfer(int fd, int write, char *buffer, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write ? pwrite(fd, buffer + done, len - done, offset + done)
+                          : pread(fd, buffer + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static off_t dataOffset(mirrorState *st, uint64_t lbaPosition) {
+    return (off_t)(1 + st->bitmapBlocks + lbaPosition) * st->blockSize;
+}
+
+// Write the bitmap to every replica, and make it durable if sync is set
+static int saveBitmap(mirrorState *st, int sync) {
+    size_t len = st->bitmapBlocks * st->blockSize;
+    int result = 0;
+    for (int r = 0; r < st->replicaCount; r++) {
+        int fd = st->replicas[r].fd;
+        if (replicaTransfer(fd, 1, (char *)st->bitmap, len, st->blockSize) != len ||
+            (sync && fdatasync(fd) != 0)) {
+            printf("[mirrorDevice] Cannot save the write-intent bitmap of replica %d\n", r);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// Mark the regions of a write before it starts. Returns -1 if the marks
+// could not be made durable.
+static int beginWrite(mirrorState *st, uint64_t lbaCount, uint64_t lbaPosition) {
+    pthread_mutex_lock(&st->lock);
+    int marked = 0;
+    uint64_t last = (lbaPosition + lbaCount - 1) / st->regionBlocks;
+    for (uint64_t region = lbaPosition / st->regionBlocks; region <= last; region++) {
+        unsigned char bit = 1 << (region % 8);
+        if (!(st->bitmap[region / 8] & bit)) {
+            st->bitmap[region / 8] |= bit;
+            st->bitsSet++;
+            marked = 1;
+        }
+    }
+    // other writers into these regions wait here until the marks are durable
+    if (marked && saveBitmap(st, 1) != 0) {
+        pthread_mutex_unlock(&st->lock);
+        return -1;
+    }
+    st->writesInFlight++;
+    st->writesStarted++;
+    pthread_mutex_unlock(&st->lock);
+    return 0;
+}
+
+static void endWrite(mirrorState *st) {
+    pthread_mutex_lock(&st->lock);
+    st->writesInFlight--;
+    pthread_mutex_unlock(&st->lock);
+}
+
+// Pick the replica for a read and count the read as in flight on it
+static mirrorReplica *chooseReplica(mirrorState *st, uint64_t lbaPosition, int skip) {
+    mirrorReplica *best = NULL;
+    uint64_t bestDistance = 0;
+    int bestDepth = 0;
+    for (int r = 0; r < st->replicaCount; r++) {
+        if (r == skip) {
+            continue;
+        }
+        mirrorReplica *replica = &st->replicas[r];
+        int depth = __atomic_load_n(&replica->inFlight, __ATOMIC_RELAXED);
+        uint64_t last = __atomic_load_n(&replica->lastPosition, __ATOMIC_RELAXED);
+        uint64_t distance = (last > lbaPosition) ? last - lbaPosition : lbaPosition - last;
+
+        int better;
+        if (best == NULL) {
+            better = 1;
+        } else if (st->readPolicy == READ_BY_DEPTH) {
+            better = depth < bestDepth || (depth == bestDepth && distance < bestDistance);
+        } else {
+            better = distance < bestDistance || (distance == bestDistance && depth < bestDepth);
+        }
+        if (better) {
+            best = replica;
+            bestDepth = depth;
+            bestDistance = distance;
+        }
+    }
+    if (best != NULL) {
+        __atomic_add_fetch(&best->inFlight, 1, __ATOMIC_RELAXED);
+    }
+    return best;
+}
+
+static uint64_t mirrorRead(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    mirrorState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return 0;
+    }
+    size_t len = lbaCount * st->blockSize;
+
+    // a replica that fails the read is left out for a second try on another
+    mirrorReplica *replica = chooseReplica(st, lbaPosition, -1);
+    size_t moved = replicaTransfer(replica->fd, 0, buffer, len, dataOffset(st, lbaPosition));
+    __atomic_store_n(&replica->lastPosition, lbaPosition + lbaCount, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&replica->inFlight, 1, __ATOMIC_RELAXED);
+
+    if (moved != len && st->replicaCount > 1) {
+        int failed = replica - st->replicas;
+        printf("[mirrorDevice] Read of blocks %llu-%llu failed on replica %d\n", (ull_t)lbaPosition,
+               (ull_t)(lbaPosition + lbaCount - 1), failed);
+        replica = chooseReplica(st, lbaPosition, failed);
+        moved = replicaTransfer(replica->fd, 0, buffer, len, dataOffset(st, lbaPosition));
+        __atomic_sub_fetch(&replica->inFlight, 1, __ATOMIC_RELAXED);
+    }
+    return moved / st->blockSize;
+}
+
+static uint64_t mirrorWrite(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    mirrorState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount || lbaCount == 0) {
+        return 0;
+    }
+    if (beginWrite(st, lbaCount, lbaPosition) != 0) {
+        return 0;
+    }
+
+    size_t len = lbaCount * st->blockSize;
+    uint64_t result = lbaCount;
+    for (int r = 0; r < st->replicaCount; r++) {
+        if (replicaTransfer(st->replicas[r].fd, 1, buffer, len, dataOffset(st, lbaPosition)) != len) {
+            printf("[mirrorDevice] Write of blocks %llu-%llu failed on replica %d\n", (ull_t)lbaPosition,
+                   (ull_t)(lbaPosition + lbaCount - 1), r);
+            result = 0;
+        }
+    }
+    endWrite(st);
+    return result;
+}
+
+static int mirrorFlush(blockDevice *dev) {
+    mirrorState *st = dev->state;
+
+    pthread_mutex_lock(&st->lock);
+    int busy = st->writesInFlight;
+    uint64_t started = st->writesStarted;
+    pthread_mutex_unlock(&st->lock);
+
+    int result = 0;
+    for (int r = 0; r < st->replicaCount; r++) {
+        if (fdatasync(st->replicas[r].fd) != 0) {
+            printf("[mirrorDevice] fdatasync of replica %d failed\n", r);
+            result = -1;
+        }
+    }
+
+    // every marked region is durable on all replicas, unless a write
+    // was going on or started while syncing
+    pthread_mutex_lock(&st->lock);
+    if (result == 0 && busy == 0 && st->writesStarted == started && st->bitsSet > 0) {
+        memset(st->bitmap, 0, st->bitmapBlocks * st->blockSize);
+        st->bitsSet = 0;
+        result = saveBitmap(st, 0);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return result;
+}
+
+// Copy the regions marked in the bitmap from the first replica to the
+// others. Returns the number of regions copied, -1 on error.
+static int mirrorResync(mirrorState *st) {
+    uint64_t regions = (st->blockCount + st->regionBlocks - 1) / st->regionBlocks;
+    size_t chunk = MIRROR_RESYNC_BLOCKS * st->blockSize;
+    char *buffer = allocBlockBuffer(chunk);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    int copied = 0;
+    for (uint64_t region = 0; region < regions; region++) {
+        if (!(st->bitmap[region / 8] & (1 << (region % 8)))) {
+            continue;
+        }
+        uint64_t start = region * st->regionBlocks;
+        uint64_t end = start + st->regionBlocks;
+        if (end > st->blockCount) {
+            end = st->blockCount;
+        }
+        for (uint64_t lba = start; lba < end; lba += MIRROR_RESYNC_BLOCKS) {
+            uint64_t count = (end - lba < MIRROR_RESYNC_BLOCKS) ? end - lba : MIRROR_RESYNC_BLOCKS;
+            size_t len = count * st->blockSize;
+            if (replicaTransfer(st->replicas[0].fd, 0, buffer, len, dataOffset(st, lba)) != len) {
+                free(buffer);
+                return -1;
+            }
+            for (int r = 1; r < st->replicaCount; r++) {
+                if (replicaTransfer(st->replicas[r].fd, 1, buffer, len, dataOffset(st, lba)) != len) {
+                    free(buffer);
+                    return -1;
+                }
+            }
+        }
+        copied++;
+    }
+    free(buffer);
+
+    for (int r = 1; r < st->replicaCount; r++) {
+        if (fdatasync(st->replicas[r].fd) != 0) {
+            return -1;
+        }
+    }
+    memset(st->bitmap, 0, st->bitmapBlocks * st->blockSize);
+    st->bitsSet = 0;
+    if (saveBitmap(st, 1) != 0) {
+        return -1;
+    }
+    return copied;
+}
+
+static int mirrorConfigure(blockDevice *dev, char *options) {
+    mirrorState *st = dev->state;
+    char *const keys[] = {"read", "region", NULL};
+    char *value;
+
+    while (*options != '\0') {
+        int key = getsubopt(&options, keys, &value);
+        if (key == -1) {
+            printf("[mirrorDevice] Unknown option: %s\n", value);
+            return -1;
+        }
+        if (value == NULL) {
+            printf("[mirrorDevice] Option %s needs a value\n", keys[key]);
+            return -1;
+        }
+        if (key == 0 && strcmp(value, "depth") == 0) {
+            st->readPolicy = READ_BY_DEPTH;
+        } else if (key == 0 && strcmp(value, "near") == 0) {
+            st->readPolicy = READ_BY_DISTANCE;
+        } else if (key == 1 && atol(value) > 0) {
+            st->newRegion = atol(value);
+        } else {
+            printf("[mirrorDevice] Bad value for %s: %s\n", keys[key], value);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void setLayout(mirrorState *st, uint64_t blockSize, uint64_t blockCount, uint64_t regionBlocks) {
+    st->blockSize = blockSize;
+    st->blockCount = blockCount;
+    st->regionBlocks = regionBlocks;
+    uint64_t bitmapBytes = ((blockCount + regionBlocks - 1) / regionBlocks + 7) / 8;
+    st->bitmapBlocks = (bitmapBytes + blockSize - 1) / blockSize;
+}
+
+static void closeReplicas(mirrorState *st) {
+    for (int r = 0; r < st->replicaCount; r++) {
+        if (st->replicas[r].fd >= 0) {
+            close(st->replicas[r].fd);
+        }
+    }
+    st->replicaCount = 0;
+    free(st->bitmap);
+    st->bitmap = NULL;
+}
+
+// Write the header of every replica and size them for a new volume
+static int createReplicas(mirrorState *st, uint64_t volSize, uint64_t blockSize) {
+    if (blockSize < MINBLOCKSIZE || (blockSize & (blockSize - 1)) != 0) {
+        printf("[mirrorDevice] Block size %llu is not a power of 2\n", (ull_t)blockSize);
+        return PART_ERR_INVALID;
+    }
+    setLayout(st, blockSize, volSize / blockSize, st->newRegion);
+
+    char *block = calloc(1, blockSize);
+    if (block == NULL) {
+        return -1;
+    }
+    mirrorHeader *header = (mirrorHeader *)block;
+    strncpy(header->caption, MIRROR_CAPTION, sizeof(header->caption));
+    header->signature = MIRROR_SIGNATURE;
+    header->volumeId = ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid();
+    header->blockSize = st->blockSize;
+    header->blockCount = st->blockCount;
+    header->regionBlocks = st->regionBlocks;
+    header->replicaCount = st->replicaCount;
+
+    int result = PART_NOERROR;
+    for (int r = 0; r < st->replicaCount && result == PART_NOERROR; r++) {
+        header->replicaIndex = r;
+        // the bitmap comes out of ftruncate all clear
+        if (ftruncate(st->replicas[r].fd, dataOffset(st, st->blockCount)) != 0) {
+            result = -2;
+        } else if (pwrite(st->replicas[r].fd, block, blockSize, 0) != (ssize_t)blockSize) {
+            result = -1;
+        }
+    }
+    free(block);
+    return result;
+}
+
+// Check the replica headers belong to one volume, put the replicas in
+// order and merge their bitmaps
+static int loadReplicas(mirrorState *st) {
+    mirrorReplica ordered[MIRROR_MAX_REPLICAS];
+    int seen[MIRROR_MAX_REPLICAS] = {0};
+    mirrorHeader first;
+
+    for (int r = 0; r < st->replicaCount; r++) {
+        mirrorHeader header;
+        if (pread(st->replicas[r].fd, &header, sizeof(header), 0) != sizeof(header) ||
+            header.signature != MIRROR_SIGNATURE) {
+            printf("[mirrorDevice] Replica %d is not part of a mirrored volume\n", r);
+            return PART_ERR_INVALID;
+        }
+        if (r == 0) {
+            first = header;
+        }
+        if (header.volumeId != first.volumeId || header.replicaCount != (uint32_t)st->replicaCount ||
+            header.replicaIndex >= (uint32_t)st->replicaCount || seen[header.replicaIndex]) {
+            printf("[mirrorDevice] Replica %d does not belong with the others (volume of %u replicas)\n",
+                   r, header.replicaCount);
+            return PART_ERR_INVALID;
+        }
+        seen[header.replicaIndex] = 1;
+        ordered[header.replicaIndex] = st->replicas[r];
+    }
+    memcpy(st->replicas, ordered, sizeof(mirrorReplica) * st->replicaCount);
+    setLayout(st, first.blockSize, first.blockCount, first.regionBlocks);
+
+    // a region marked in any replica may differ between them
+    size_t len = st->bitmapBlocks * st->blockSize;
+    st->bitmap = calloc(1, len);
+    unsigned char *other = malloc(len);
+    if (st->bitmap == NULL || other == NULL) {
+        free(other);
+        return -1;
+    }
+    for (int r = 0; r < st->replicaCount; r++) {
+        if (replicaTransfer(st->replicas[r].fd, 0, (char *)other, len, st->blockSize) != len) {
+            printf("[mirrorDevice] Cannot read the write-intent bitmap of replica %d\n", r);
+            free(other);
+            return -1;
+        }
+        for (size_t i = 0; i < len; i++) {
+            st->bitmap[i] |= other[i];
+        }
+    }
+    free(other);
+    return PART_NOERROR;
+}
+
+static int mirrorOpen(blockDevice *dev, char *filename, uint64_t *volSize, uint64_t *blockSize) {
+    mirrorState *st = dev->state;
+    char *names = strdup(filename);
+    char *save = NULL;
+    int existing = 0;
+
+    st->replicaCount = 0;
+    for (char *name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        if (st->replicaCount == MIRROR_MAX_REPLICAS) {
+            printf("[mirrorDevice] At most %d replicas\n", MIRROR_MAX_REPLICAS);
+            closeReplicas(st);
+            free(names);
+            return PART_ERR_INVALID;
+        }
+        int fd = open(name, O_RDWR);
+        if (fd >= 0) {
+            existing++;
+        } else if (errno == ENOENT) {
+            fd = open(name, O_RDWR | O_CREAT, 0644);
+        }
+        if (fd < 0) {
+            printf("[mirrorDevice] Cannot open replica %s\n", name);
+            closeReplicas(st);
+            free(names);
+            return -1;
+        }
+        st->replicas[st->replicaCount].fd = fd;
+        st->replicas[st->replicaCount].inFlight = 0;
+        st->replicas[st->replicaCount].lastPosition = 0;
+        st->replicaCount++;
+    }
+    free(names);
+
+    int result;
+    if (existing == 0) {
+        result = createReplicas(st, *volSize, *blockSize);
+        if (result == PART_NOERROR) {
+            st->bitmap = calloc(st->bitmapBlocks, st->blockSize);
+            result = (st->bitmap != NULL) ? PART_NOERROR : -1;
+        }
+    } else if (existing != st->replicaCount) {
+        printf("[mirrorDevice] Only %d of the %d replicas exist\n", existing, st->replicaCount);
+        result = PART_ERR_INVALID;
+    } else {
+        result = loadReplicas(st);
+    }
+    if (result == PART_NOERROR && existing > 0) {
+        int copied = mirrorResync(st);
+        if (copied < 0) {
+            printf("[mirrorDevice] Resync failed\n");
+            result = -1;
+        } else if (copied > 0) {
+            printf("[mirrorDevice] Volume was not closed cleanly, resynced %d regions\n", copied);
+        }
+    }
+    if (result != PART_NOERROR) {
+        closeReplicas(st);
+        return result;
+    }
+
+    st->bitsSet = 0;
+    st->writesInFlight = 0;
+    st->writesStarted = 0;
+    *volSize = st->blockCount * st->blockSize;
+    *blockSize = st->blockSize;
+    return PART_NOERROR;
+}
+
+static int mirrorClose(blockDevice *dev) {
+    mirrorState *st = dev->state;
+    if (st->replicaCount == 0) {
+        return 0;
+    }
+    // leaves the bitmap clear, nothing to resync next time
+    int result = mirrorFlush(dev);
+    closeReplicas(st);
+    return result;
+}
+
+blockDevice mirrorDevice = {
+    .name = "mirror",
+    .configure = mirrorConfigure,
+    .open = mirrorOpen,
+    .read = mirrorRead,
+    .write = mirrorWrite,
+    .flush = mirrorFlush,
+    .close = mirrorClose,
+    .state = &mirror,
+};
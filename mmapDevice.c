@@ -0,0 +1,214 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: mmapDevice.c
+ *
+ * Description::
+ *   Block device backend that maps the whole volume file into
+ *   memory. Reads and writes are plain copies to and from the
+ *   mapping, and the block cache reads blocks it does not hold
+ *   straight out of it (see deviceMap). Flushing msyncs the range
+ *   written since the last flush. Freed blocks are punched out of
+ *   the file.
+ *
+ *   The volume file keeps the layout of the LBA layer: fsLow
+ *   creates or validates it and its partition header, then the
+ *   file is mapped with the header block skipped.
+ *
+ **************************************************************/
+
+#define _GNU_SOURCE // fallocate
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blockDevice.h"
+
+typedef struct mmapState {
+    int fd;
+    char *base;         // the whole file, header block first
+    size_t length;
+    uint64_t blockSize;
+    uint64_t blockCount;
+    pthread_mutex_t lock; // guards the dirty range
+    size_t dirtyStart;    // bytes of the file written since the last msync
+    size_t dirtyEnd;
+} mmapState;
+
+static mmapState mapped = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Address of a block in the mapping, the partition header takes the first block
+static char *blockAddress(mmapState *st, uint64_t lbaPosition) {
+    return st->base + (lbaPosition + 1) * st->blockSize;
+}
+
+static int mmapOpen(blockDevice *dev, char *filename, uint64_t *volSize, uint64_t *blockSize) {
+    mmapState *st = dev->state;
+
+    // let the LBA layer create the file or check its header
+    int result = startPartitionSystem(filename, volSize, blockSize);
+    if (result != PART_NOERROR) {
+        return result;
+    }
+    closePartitionSystem();
+
+    st->blockSize = *blockSize;
+    st->blockCount = *volSize / *blockSize;
+    st->length = (st->blockCount + 1) * st->blockSize;
+
+    st->fd = open(filename, O_RDWR);
+    if (st->fd < 0) {
+        printf("[mmapDevice] Cannot open %s\n", filename);
+        return -1;
+    }
+    struct stat info;
+    if (fstat(st->fd, &info) != 0 || (size_t)info.st_size < st->length) {
+        printf("[mmapDevice] %s is shorter than its volume\n", filename);
+        close(st->fd);
+        st->fd = -1;
+        return PART_ERR_INVALID;
+    }
+
+    st->base = mmap(NULL, st->length, PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, 0);
+    if (st->base == MAP_FAILED) {
+        printf("[mmapDevice] Cannot map %s\n", filename);
+        st->base = NULL;
+        close(st->fd);
+        st->fd = -1;
+        return -1;
+    }
+    st->dirtyStart = st->length;
+    st->dirtyEnd = 0;
+    return PART_NOERROR;
+}
+
+static uint64_t mmapRead(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    mmapState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return 0;
+    }
+    memcpy(buffer, blockAddress(st, lbaPosition), lbaCount * st->blockSize);
+    return lbaCount;
+}
+
+static uint64_t mmapWrite(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    mmapState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return 0;
+    }
+    memcpy(blockAddress(st, lbaPosition), buffer, lbaCount * st->blockSize);
+
+    size_t start = (lbaPosition + 1) * st->blockSize;
+    size_t end = start + lbaCount * st->blockSize;
+    pthread_mutex_lock(&st->lock);
+    if (start < st->dirtyStart) {
+        st->dirtyStart = start;
+    }
+    if (end > st->dirtyEnd) {
+        st->dirtyEnd = end;
+    }
+    pthread_mutex_unlock(&st->lock);
+    return lbaCount;
+}
+
+static uint64_t mmapReadv(blockDevice *dev, const struct iovec *iov, int iovcnt, uint64_t lbaPosition) {
+    mmapState *st = dev->state;
+    uint64_t done = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        uint64_t count = iov[i].iov_len / st->blockSize;
+        if (mmapRead(dev, iov[i].iov_base, count, lbaPosition + done) != count) {
+            break;
+        }
+        done += count;
+    }
+    return done;
+}
+
+// Punch the blocks out of the file, the mapping reads zeros there afterwards
+static int mmapDiscard(blockDevice *dev, uint64_t lbaCount, uint64_t lbaPosition) {
+    mmapState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return -1;
+    }
+    size_t start = (lbaPosition + 1) * st->blockSize;
+    size_t end = start + lbaCount * st->blockSize;
+    if (fallocate(st->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start) != 0) {
+        return -1;
+    }
+    // the next msync makes the hole stick
+    pthread_mutex_lock(&st->lock);
+    if (start < st->dirtyStart) {
+        st->dirtyStart = start;
+    }
+    if (end > st->dirtyEnd) {
+        st->dirtyEnd = end;
+    }
+    pthread_mutex_unlock(&st->lock);
+    return 0;
+}
+
+static int mmapFlush(blockDevice *dev) {
+    mmapState *st = dev->state;
+
+    pthread_mutex_lock(&st->lock);
+    size_t start = st->dirtyStart;
+    size_t end = st->dirtyEnd;
+    st->dirtyStart = st->length;
+    st->dirtyEnd = 0;
+    pthread_mutex_unlock(&st->lock);
+
+    if (start >= end) {
+        return 0;
+    }
+    // msync wants a page aligned start
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    start -= start % page;
+    if (msync(st->base + start, end - start, MS_SYNC) != 0) {
+        printf("[mmapDevice] msync failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int mmapClose(blockDevice *dev) {
+    mmapState *st = dev->state;
+    if (st->base == NULL) {
+        return 0;
+    }
+    int result = mmapFlush(dev);
+    munmap(st->base, st->length);
+    close(st->fd);
+    st->base = NULL;
+    st->fd = -1;
+    return result;
+}
+
+static void *mmapMap(blockDevice *dev, uint64_t lbaCount, uint64_t lbaPosition) {
+    mmapState *st = dev->state;
+    if (st->base == NULL || lbaPosition + lbaCount > st->blockCount) {
+        return NULL;
+    }
+    return blockAddress(st, lbaPosition);
+}
+
+blockDevice mmapDevice = {
+    .name = "mmap",
+    .open = mmapOpen,
+    .read = mmapRead,
+    .write = mmapWrite,
+    .readv = mmapReadv,
+    .discard = mmapDiscard,
+    .flush = mmapFlush,
+    .close = mmapClose,
+    .map = mmapMap,
+    .state = &mapped,
+};
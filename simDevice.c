@@ -0,0 +1,238 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: simDevice.c
+ *
+ * Description::
+ *   Block device backend that passes every request on to another
+ *   backend, but first makes it wait as long as it would on a slower
+ *   device, so the effect of readahead, write coalescing and block
+ *   placement can be measured on any machine. A request costs
+ *   - a fixed latency,
+ *   - a seek scaled by how far it is from where the last one ended
+ *     (a full stroke across the volume costs the whole seek time),
+ *   - its transfer time at the bandwidth cap. The bandwidth is shared,
+ *     so requests in flight together queue for it.
+ *   At most depth requests are in flight, the others wait for a slot.
+ *
+ *   Options (fsshell -o), comma separated:
+ *     device=<backend>  backend underneath (default lba)
+ *     latency=<us>      per request
+ *     seek=<us>         full stroke seek, 0 for no seeks (SSD)
+ *     bandwidth=<KB/s>  0 for no cap
+ *     depth=<n>         requests in flight, 0 for no limit
+ *
+ **************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blockDevice.h"
+
+typedef struct simState {
+    blockDevice *lower;    // the backend doing the real work
+    long latency;          // microseconds
+    long seek;             // microseconds
+    long bandwidth;        // KB per second
+    int depth;
+
+    uint64_t blockSize;
+    uint64_t blockCount;
+
+    pthread_mutex_t lock;
+    pthread_cond_t slotFree;
+    int inFlight;
+    uint64_t headPosition;   // LBA after the last request
+    struct timespec busyUntil; // the channel is transferring until then
+
+    // totals reported on close
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t blocks;
+    uint64_t waitedUs;
+} simState;
+
+static simState sim = {.lock = PTHREAD_MUTEX_INITIALIZER, .slotFree = PTHREAD_COND_INITIALIZER};
+
+static void addMicroseconds(struct timespec *t, long us) {
+    t->tv_sec += us / 1000000;
+    t->tv_nsec += (us % 1000000) * 1000;
+    if (t->tv_nsec >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+static int isBefore(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static long microsecondsBetween(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+// Take a slot and wait out the cost of the request
+static void simBegin(simState *st, int write, uint64_t lbaCount, uint64_t lbaPosition) {
+    pthread_mutex_lock(&st->lock);
+    while (st->depth > 0 && st->inFlight >= st->depth) {
+        pthread_cond_wait(&st->slotFree, &st->lock);
+    }
+    st->inFlight++;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long cost = st->latency;
+    if (st->seek > 0 && st->blockCount > 0) {
+        uint64_t distance = (lbaPosition > st->headPosition) ? lbaPosition - st->headPosition
+                                                             : st->headPosition - lbaPosition;
+        cost += (long)((double)st->seek * distance / st->blockCount);
+    }
+    st->headPosition = lbaPosition + lbaCount;
+
+    // the transfer starts once the channel is free and is over at busyUntil
+    struct timespec done = now;
+    addMicroseconds(&done, cost);
+    if (st->bandwidth > 0) {
+        if (isBefore(&done, &st->busyUntil)) {
+            done = st->busyUntil;
+        }
+        addMicroseconds(&done, (long)(lbaCount * st->blockSize * 1000 / st->bandwidth));
+        st->busyUntil = done;
+    }
+
+    if (write) {
+        st->writes++;
+    } else {
+        st->reads++;
+    }
+    st->blocks += lbaCount;
+    st->waitedUs += microsecondsBetween(&now, &done);
+    pthread_mutex_unlock(&st->lock);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &done, NULL) != 0) {
+        // interrupted, sleep the rest
+    }
+}
+
+static void simEnd(simState *st) {
+    pthread_mutex_lock(&st->lock);
+    st->inFlight--;
+    pthread_cond_signal(&st->slotFree);
+    pthread_mutex_unlock(&st->lock);
+}
+
+static int simConfigure(blockDevice *dev, char *options) {
+    simState *st = dev->state;
+    char *const keys[] = {"device", "latency", "seek", "bandwidth", "depth", NULL};
+    char *value;
+
+    while (*options != '\0') {
+        int key = getsubopt(&options, keys, &value);
+        if (key == -1) {
+            printf("[simDevice] Unknown option: %s\n", value);
+            return -1;
+        }
+        if (value == NULL) {
+            printf("[simDevice] Option %s needs a value\n", keys[key]);
+            return -1;
+        }
+        switch (key) {
+        case 0:
+            st->lower = findBlockDevice(value);
+            if (st->lower == NULL || st->lower == dev) {
+                printf("[simDevice] Cannot run on top of %s\n", value);
+                st->lower = NULL;
+                return -1;
+            }
+            break;
+        case 1:
+            st->latency = atol(value);
+            break;
+        case 2:
+            st->seek = atol(value);
+            break;
+        case 3:
+            st->bandwidth = atol(value);
+            break;
+        case 4:
+            st->depth = atoi(value);
+            break;
+        }
+    }
+    return 0;
+}
+
+static int simOpen(blockDevice *dev, char *filename, uint64_t *volSize, uint64_t *blockSize) {
+    simState *st = dev->state;
+    if (st->lower == NULL) {
+        st->lower = findBlockDevice(DEFAULT_BLOCK_DEVICE);
+    }
+
+    int result = st->lower->open(st->lower, filename, volSize, blockSize);
+    if (result != PART_NOERROR) {
+        return result;
+    }
+    st->blockSize = *blockSize;
+    st->blockCount = *volSize / *blockSize;
+    st->headPosition = 0;
+    clock_gettime(CLOCK_MONOTONIC, &st->busyUntil);
+    st->reads = st->writes = st->blocks = st->waitedUs = 0;
+    return PART_NOERROR;
+}
+
+static uint64_t simRead(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    simState *st = dev->state;
+    simBegin(st, 0, lbaCount, lbaPosition);
+    uint64_t result = st->lower->read(st->lower, buffer, lbaCount, lbaPosition);
+    simEnd(st);
+    return result;
+}
+
+static uint64_t simWrite(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    simState *st = dev->state;
+    simBegin(st, 1, lbaCount, lbaPosition);
+    uint64_t result = st->lower->write(st->lower, buffer, lbaCount, lbaPosition);
+    simEnd(st);
+    return result;
+}
+
+// Discards are free on the devices modelled here, they pass straight through
+static int simDiscard(blockDevice *dev, uint64_t lbaCount, uint64_t lbaPosition) {
+    simState *st = dev->state;
+    return (st->lower->discard != NULL) ? st->lower->discard(st->lower, lbaCount, lbaPosition) : -1;
+}
+
+static int simFlush(blockDevice *dev) {
+    simState *st = dev->state;
+    return (st->lower->flush != NULL) ? st->lower->flush(st->lower) : 0;
+}
+
+static int simClose(blockDevice *dev) {
+    simState *st = dev->state;
+    printf("[simDevice] %llu reads, %llu writes, %llu blocks, %llu ms waited\n", (ull_t)st->reads,
+           (ull_t)st->writes, (ull_t)st->blocks, (ull_t)(st->waitedUs / 1000));
+    return st->lower->close(st->lower);
+}
+
+// Reads of blocks handed out by map would skip the simulated cost, so
+// map is left out even if the backend underneath has it.
+blockDevice simDevice = {
+    .name = "sim",
+    .configure = simConfigure,
+    .open = simOpen,
+    .read = simRead,
+    .write = simWrite,
+    .discard = simDiscard,
+    .flush = simFlush,
+    .close = simClose,
+    .state = &sim,
+};
@@ -0,0 +1,492 @@
+/**************************************************************
+ * Class::  CSC-415-02 Spring 2025
+ * Name:: Randy Chen, Michael Thompson, Eric Ahsue, Utku Tarhan
+ * Student IDs:: 922525848, 922707016, 922711514, 918371654
+ * GitHub-Name:: Jasuv
+ * Group-Name:: Debug Thugs
+ * Project:: Basic File System
+ *
+ * File:: stripeDevice.c
+ *
+ * Description::
+ *   Block device backend that stripes the volume over several
+ *   member files (RAID-0), ideally each on its own disk. The volume
+ *   name lists the members separated by commas. Blocks are dealt
+ *   out to the members stripeUnit at a time, round robin:
+ *
+ *     member 0    member 1    member 2
+ *     unit 0      unit 1      unit 2
+ *     unit 3      unit 4      unit 5  ...
+ *
+ *   A request that covers more than one member is split, every
+ *   member gets one preadv/pwritev for its share and the shares are
+ *   done in parallel by one worker thread per member.
+ *
+ *   Each member file starts with a header block recording the
+ *   layout (member count, its own place, stripe unit, block size and
+ *   volume size) and an id shared by the members of one volume, so
+ *   the members can be listed in any order once the volume exists.
+ *
+ *   Options (fsshell -o):
+ *     unit=<blocks>     stripe unit for a new volume (default 16)
+ *
+ **************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blockDevice.h"
+
+#define STRIPE_SIGNATURE 0x5374726970655630 // "StripeV0"
+#define STRIPE_CAPTION "CSC-415 - Striped Volume Member Header\n\n"
+#define STRIPE_MAX_MEMBERS 16
+#define STRIPE_DEFAULT_UNIT 16
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // buffers per preadv/pwritev
+#endif
+
+typedef struct stripeHeader {
+    char caption[64];
+    uint64_t signature;
+    uint64_t volumeId;     // the same in every member of the volume
+    uint64_t blockSize;
+    uint64_t blockCount;   // of the whole volume
+    uint32_t memberCount;
+    uint32_t memberIndex;  // place of this member in the stripe
+    uint32_t stripeUnit;   // blocks
+} stripeHeader;
+
+// One member's share of a request
+typedef struct stripeTask {
+    struct stripeTask *next;
+    int write;
+    struct iovec *iov;
+    int iovcnt;
+    off_t offset;
+    size_t length;
+    struct stripeRequest *request;
+} stripeTask;
+
+// Waits for the shares handed to the workers
+typedef struct stripeRequest {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;
+    int failed;
+} stripeRequest;
+
+typedef struct stripeMember {
+    int fd;
+    pthread_t worker;
+    pthread_mutex_t lock;  // guards the queue and stop
+    pthread_cond_t work;
+    stripeTask *head;
+    stripeTask *tail;
+    int stop;
+} stripeMember;
+
+typedef struct stripeState {
+    stripeMember members[STRIPE_MAX_MEMBERS];
+    int memberCount;
+    uint64_t stripeUnit;
+    uint64_t blockSize;
+    uint64_t blockCount;
+    uint64_t newUnit;      // stripe unit used when a volume is created
+} stripeState;
+
+static stripeState stripe = {.newUnit = STRIPE_DEFAULT_UNIT};
+
+// Move all the bytes of iov at offset, retrying short transfers.
+// Returns the bytes moved. iov is used up on the way.
+static size_t memberTransfer(int fd, int write, struct iovec *iov, int iovcnt, off_t offset) {
+    size_t done = 0;
+    while (iovcnt > 0) {
+        int batch = (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt;
+        ssize_t n = write ? pwritev(fd, iov, batch, offset + done) : preadv(fd, iov, batch, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return done;
+}
+
+static int runTask(stripeMember *member, stripeTask *task) {
+    return memberTransfer(member->fd, task->write, task->iov, task->iovcnt, task->offset) == task->length;
+}
+
+static void *memberWorker(void *arg) {
+    stripeMember *member = arg;
+    pthread_mutex_lock(&member->lock);
+    while (1) {
+        while (member->head == NULL && !member->stop) {
+            pthread_cond_wait(&member->work, &member->lock);
+        }
+        if (member->head == NULL) {
+            break;
+        }
+        stripeTask *task = member->head;
+        member->head = task->next;
+        if (member->head == NULL) {
+            member->tail = NULL;
+        }
+        pthread_mutex_unlock(&member->lock);
+
+        int ok = runTask(member, task);
+
+        stripeRequest *request = task->request;
+        pthread_mutex_lock(&request->lock);
+        if (!ok) {
+            request->failed = 1;
+        }
+        if (--request->pending == 0) {
+            pthread_cond_signal(&request->done);
+        }
+        pthread_mutex_unlock(&request->lock);
+
+        pthread_mutex_lock(&member->lock);
+    }
+    pthread_mutex_unlock(&member->lock);
+    return NULL;
+}
+
+static void queueTask(stripeMember *member, stripeTask *task) {
+    task->next = NULL;
+    pthread_mutex_lock(&member->lock);
+    if (member->tail == NULL) {
+        member->head = task;
+    } else {
+        member->tail->next = task;
+    }
+    member->tail = task;
+    pthread_cond_signal(&member->work);
+    pthread_mutex_unlock(&member->lock);
+}
+
+// File offset of a block in its member, the header takes the first block
+static off_t memberOffset(stripeState *st, uint64_t stripeNo, uint64_t within) {
+    return (off_t)(stripeNo / st->memberCount * st->stripeUnit + within + 1) * st->blockSize;
+}
+
+// Split the request into one share per member and run the shares in parallel.
+static uint64_t stripeTransfer(blockDevice *dev, int write, char *buffer, uint64_t lbaCount,
+                               uint64_t lbaPosition) {
+    stripeState *st = dev->state;
+    if (lbaPosition + lbaCount > st->blockCount) {
+        return 0;
+    }
+    if (lbaCount == 0) {
+        return 0;
+    }
+
+    uint64_t unit = st->stripeUnit;
+    int n = st->memberCount;
+    uint64_t stripeNo = lbaPosition / unit;
+
+    // most requests stay inside one stripe unit
+    if (lbaPosition % unit + lbaCount <= unit) {
+        struct iovec iov = {buffer, lbaCount * st->blockSize};
+        size_t moved = memberTransfer(st->members[stripeNo % n].fd, write, &iov, 1,
+                                      memberOffset(st, stripeNo, lbaPosition % unit));
+        return moved / st->blockSize;
+    }
+
+    // a member gets at most one piece per stripe row the request touches
+    int perMember = (int)(lbaCount / (unit * n)) + 2;
+    struct iovec *iovs = malloc(sizeof(struct iovec) * perMember * n);
+    if (iovs == NULL) {
+        printf("[stripeDevice] Out of memory\n");
+        return 0;
+    }
+    stripeTask tasks[STRIPE_MAX_MEMBERS];
+    for (int m = 0; m < n; m++) {
+        tasks[m].write = write;
+        tasks[m].iov = iovs + m * perMember;
+        tasks[m].iovcnt = 0;
+        tasks[m].length = 0;
+    }
+
+    // deal the blocks out the way they are laid out, each member's
+    // pieces are consecutive on that member
+    uint64_t done = 0;
+    while (done < lbaCount) {
+        uint64_t lba = lbaPosition + done;
+        uint64_t within = lba % unit;
+        uint64_t run = unit - within;
+        if (run > lbaCount - done) {
+            run = lbaCount - done;
+        }
+        stripeTask *task = &tasks[(lba / unit) % n];
+        if (task->iovcnt == 0) {
+            task->offset = memberOffset(st, lba / unit, within);
+        }
+        task->iov[task->iovcnt].iov_base = buffer + done * st->blockSize;
+        task->iov[task->iovcnt].iov_len = run * st->blockSize;
+        task->iovcnt++;
+        task->length += run * st->blockSize;
+        done += run;
+    }
+
+    // hand every share but the first member's to the workers, do that one here
+    stripeRequest request = {.lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+    int first = (int)(stripeNo % n);
+    for (int m = 0; m < n; m++) {
+        if (m != first && tasks[m].iovcnt > 0) {
+            request.pending++;
+        }
+    }
+    for (int m = 0; m < n; m++) {
+        if (m != first && tasks[m].iovcnt > 0) {
+            tasks[m].request = &request;
+            queueTask(&st->members[m], &tasks[m]);
+        }
+    }
+    int ok = runTask(&st->members[first], &tasks[first]);
+
+    pthread_mutex_lock(&request.lock);
+    while (request.pending > 0) {
+        pthread_cond_wait(&request.done, &request.lock);
+    }
+    if (request.failed) {
+        ok = 0;
+    }
+    pthread_mutex_unlock(&request.lock);
+    pthread_mutex_destroy(&request.lock);
+    pthread_cond_destroy(&request.done);
+    free(iovs);
+
+    // the shares finish in any order, so there is no partial count to give
+    if (!ok) {
+        printf("[stripeDevice] %s of blocks %llu-%llu failed\n", write ? "Write" : "Read",
+               (ull_t)lbaPosition, (ull_t)(lbaPosition + lbaCount - 1));
+        return 0;
+    }
+    return lbaCount;
+}
+
+static int stripeConfigure(blockDevice *dev, char *options) {
+    stripeState *st = dev->state;
+    char *const keys[] = {"unit", NULL};
+    char *value;
+
+    while (*options != '\0') {
+        int key = getsubopt(&options, keys, &value);
+        if (key == -1) {
+            printf("[stripeDevice] Unknown option: %s\n", value);
+            return -1;
+        }
+        if (value == NULL || atol(value) <= 0) {
+            printf("[stripeDevice] Option %s needs a positive value\n", keys[key]);
+            return -1;
+        }
+        st->newUnit = atol(value);
+    }
+    return 0;
+}
+
+static void closeMembers(stripeState *st) {
+    for (int m = 0; m < st->memberCount; m++) {
+        if (st->members[m].fd >= 0) {
+            close(st->members[m].fd);
+        }
+    }
+    st->memberCount = 0;
+}
+
+// Write the header of every member and size them for a new volume
+static int createMembers(stripeState *st, uint64_t volSize, uint64_t blockSize) {
+    if (blockSize < MINBLOCKSIZE || (blockSize & (blockSize - 1)) != 0) {
+        printf("[stripeDevice] Block size %llu is not a power of 2\n", (ull_t)blockSize);
+        return PART_ERR_INVALID;
+    }
+    st->blockSize = blockSize;
+    st->blockCount = volSize / blockSize;
+    st->stripeUnit = st->newUnit;
+
+    uint64_t rowBlocks = st->stripeUnit * st->memberCount;
+    uint64_t memberBlocks = (st->blockCount + rowBlocks - 1) / rowBlocks * st->stripeUnit;
+
+    char *block = calloc(1, blockSize);
+    if (block == NULL) {
+        return -1;
+    }
+    stripeHeader *header = (stripeHeader *)block;
+    strncpy(header->caption, STRIPE_CAPTION, sizeof(header->caption));
+    header->signature = STRIPE_SIGNATURE;
+    header->volumeId = ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid();
+    header->blockSize = blockSize;
+    header->blockCount = st->blockCount;
+    header->memberCount = st->memberCount;
+    header->stripeUnit = st->stripeUnit;
+
+    int result = PART_NOERROR;
+    for (int m = 0; m < st->memberCount && result == PART_NOERROR; m++) {
+        header->memberIndex = m;
+        if (ftruncate(st->members[m].fd, (off_t)(memberBlocks + 1) * blockSize) != 0) {
+            result = -2;
+        } else if (pwrite(st->members[m].fd, block, blockSize, 0) != (ssize_t)blockSize) {
+            result = -1;
+        }
+    }
+    free(block);
+    return result;
+}
+
+// Check the member headers belong to one volume and put the members in stripe order
+static int loadMembers(stripeState *st) {
+    stripeMember ordered[STRIPE_MAX_MEMBERS];
+    int seen[STRIPE_MAX_MEMBERS] = {0};
+    stripeHeader first;
+
+    for (int m = 0; m < st->memberCount; m++) {
+        stripeHeader header;
+        if (pread(st->members[m].fd, &header, sizeof(header), 0) != sizeof(header) ||
+            header.signature != STRIPE_SIGNATURE) {
+            printf("[stripeDevice] Member %d is not part of a striped volume\n", m);
+            return PART_ERR_INVALID;
+        }
+        if (m == 0) {
+            first = header;
+        }
+        if (header.volumeId != first.volumeId || header.memberCount != (uint32_t)st->memberCount ||
+            header.memberIndex >= (uint32_t)st->memberCount || seen[header.memberIndex]) {
+            printf("[stripeDevice] Member %d does not belong with the others (volume of %u members)\n",
+                   m, header.memberCount);
+            return PART_ERR_INVALID;
+        }
+        seen[header.memberIndex] = 1;
+        ordered[header.memberIndex] = st->members[m];
+    }
+
+    memcpy(st->members, ordered, sizeof(stripeMember) * st->memberCount);
+    st->blockSize = first.blockSize;
+    st->blockCount = first.blockCount;
+    st->stripeUnit = first.stripeUnit;
+    return PART_NOERROR;
+}
+
+static int stripeOpen(blockDevice *dev, char *filename, uint64_t *volSize, uint64_t *blockSize) {
+    stripeState *st = dev->state;
+    char *names = strdup(filename);
+    char *save = NULL;
+    int existing = 0;
+
+    st->memberCount = 0;
+    for (char *name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        if (st->memberCount == STRIPE_MAX_MEMBERS) {
+            printf("[stripeDevice] At most %d members\n", STRIPE_MAX_MEMBERS);
+            closeMembers(st);
+            free(names);
+            return PART_ERR_INVALID;
+        }
+        int fd = open(name, O_RDWR);
+        if (fd >= 0) {
+            existing++;
+        } else if (errno == ENOENT) {
+            fd = open(name, O_RDWR | O_CREAT, 0644);
+        }
+        if (fd < 0) {
+            printf("[stripeDevice] Cannot open member %s\n", name);
+            closeMembers(st);
+            free(names);
+            return -1;
+        }
+        st->members[st->memberCount++].fd = fd;
+    }
+    free(names);
+
+    int result;
+    if (existing == 0) {
+        result = createMembers(st, *volSize, *blockSize);
+    } else if (existing != st->memberCount) {
+        printf("[stripeDevice] Only %d of the %d members exist\n", existing, st->memberCount);
+        result = PART_ERR_INVALID;
+    } else {
+        result = loadMembers(st);
+    }
+    if (result != PART_NOERROR) {
+        closeMembers(st);
+        return result;
+    }
+
+    for (int m = 0; m < st->memberCount; m++) {
+        stripeMember *member = &st->members[m];
+        pthread_mutex_init(&member->lock, NULL);
+        pthread_cond_init(&member->work, NULL);
+        member->head = member->tail = NULL;
+        member->stop = 0;
+        pthread_create(&member->worker, NULL, memberWorker, member);
+    }
+
+    *volSize = st->blockCount * st->blockSize;
+    *blockSize = st->blockSize;
+    return PART_NOERROR;
+}
+
+static uint64_t stripeRead(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    return stripeTransfer(dev, 0, buffer, lbaCount, lbaPosition);
+}
+
+static uint64_t stripeWrite(blockDevice *dev, void *buffer, uint64_t lbaCount, uint64_t lbaPosition) {
+    return stripeTransfer(dev, 1, buffer, lbaCount, lbaPosition);
+}
+
+static int stripeFlush(blockDevice *dev) {
+    stripeState *st = dev->state;
+    int result = 0;
+    for (int m = 0; m < st->memberCount; m++) {
+        if (fdatasync(st->members[m].fd) != 0) {
+            printf("[stripeDevice] fdatasync of member %d failed\n", m);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+static int stripeClose(blockDevice *dev) {
+    stripeState *st = dev->state;
+    for (int m = 0; m < st->memberCount; m++) {
+        stripeMember *member = &st->members[m];
+        pthread_mutex_lock(&member->lock);
+        member->stop = 1;
+        pthread_cond_signal(&member->work);
+        pthread_mutex_unlock(&member->lock);
+        pthread_join(member->worker, NULL);
+        pthread_mutex_destroy(&member->lock);
+        pthread_cond_destroy(&member->work);
+    }
+    int result = stripeFlush(dev);
+    closeMembers(st);
+    return result;
+}
+
+blockDevice stripeDevice = {
+    .name = "stripe",
+    .configure = stripeConfigure,
+    .open = stripeOpen,
+    .read = stripeRead,
+    .write = stripeWrite,
+    .flush = stripeFlush,
+    .close = stripeClose,
+    .state = &stripe,
+};